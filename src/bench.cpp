@@ -0,0 +1,601 @@
+#include "caching_bot_api.h"
+#include "configuration.h"
+#include "dispatch_dedupe.h"
+#include "event_arena.h"
+#include "fake_bot_api.h"
+#include "guild_directory.h"
+#include "screening.h"
+#include "handlers.h"
+#include "reaction_roles.h"
+#include "shared_config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef BENCH_BUILD_TYPE
+#define BENCH_BUILD_TYPE ""
+#endif
+
+namespace {
+
+std::atomic<std::uint64_t> g_allocations{0};
+std::atomic<std::uint64_t> g_allocated_bytes{0};
+std::atomic<std::int64_t> g_live_bytes{0};
+
+// every block carry its size in front of it, so the live size is known on
+// delete even when the unsized operator is used
+constexpr std::size_t header_size{alignof(std::max_align_t)};
+
+// the over-aligned blocks (std::pmr::new_delete_resource use them) get a
+// header as large as their alignment
+void *counted_alloc(std::size_t size, std::size_t align = header_size) {
+  const auto header = std::max(align, header_size);
+  auto p = static_cast<char *>(
+      header == header_size
+          ? std::malloc(size + header)
+          : std::aligned_alloc(header, (size + 2 * header - 1) / header *
+                                           header));
+  if (!p)
+    throw std::bad_alloc{};
+  *reinterpret_cast<std::size_t *>(p) = size;
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  g_live_bytes.fetch_add(static_cast<std::int64_t>(size),
+                         std::memory_order_relaxed);
+  return p + header;
+}
+
+void counted_free(void *ptr, std::size_t align = header_size) noexcept {
+  if (!ptr)
+    return;
+  auto p = static_cast<char *>(ptr) - std::max(align, header_size);
+  g_live_bytes.fetch_sub(
+      static_cast<std::int64_t>(*reinterpret_cast<std::size_t *>(p)),
+      std::memory_order_relaxed);
+  std::free(p);
+}
+
+} // namespace
+
+void *operator new(std::size_t size) { return counted_alloc(size); }
+void *operator new[](std::size_t size) { return counted_alloc(size); }
+void operator delete(void *ptr) noexcept { counted_free(ptr); }
+void operator delete[](void *ptr) noexcept { counted_free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { counted_free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { counted_free(ptr); }
+void *operator new(std::size_t size, std::align_val_t al) {
+  return counted_alloc(size, static_cast<std::size_t>(al));
+}
+void *operator new[](std::size_t size, std::align_val_t al) {
+  return counted_alloc(size, static_cast<std::size_t>(al));
+}
+void operator delete(void *ptr, std::align_val_t al) noexcept {
+  counted_free(ptr, static_cast<std::size_t>(al));
+}
+void operator delete[](void *ptr, std::align_val_t al) noexcept {
+  counted_free(ptr, static_cast<std::size_t>(al));
+}
+void operator delete(void *ptr, std::size_t, std::align_val_t al) noexcept {
+  counted_free(ptr, static_cast<std::size_t>(al));
+}
+void operator delete[](void *ptr, std::size_t, std::align_val_t al) noexcept {
+  counted_free(ptr, static_cast<std::size_t>(al));
+}
+
+namespace {
+
+template <typename T> inline void do_not_optimize(T const &value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const void *sink;
+  sink = &value;
+#endif
+}
+
+struct BenchResult {
+  std::string name;
+  std::uint64_t iterations;
+  double ns_per_op;
+  double allocs_per_op;
+  double bytes_per_op;
+};
+
+std::vector<BenchResult> g_results;
+
+/**
+ * @brief Run the function until it took at least the given time and record
+ * the time and allocations per call
+ */
+template <typename F>
+void run(const std::string &name, F &&f,
+         std::chrono::milliseconds min_time = std::chrono::milliseconds{200}) {
+  for (int i = 0; i < 16; ++i)
+    f();
+
+  std::uint64_t iterations{0};
+  std::uint64_t batch{1};
+  auto allocs = g_allocations.load();
+  auto bytes = g_allocated_bytes.load();
+  auto start = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::steady_clock::duration{};
+  do {
+    for (std::uint64_t i = 0; i < batch; ++i)
+      f();
+    iterations += batch;
+    batch *= 2;
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed < min_time);
+
+  auto ns = std::chrono::duration<double, std::nano>(elapsed).count();
+  BenchResult r{name, iterations, ns / iterations,
+                double(g_allocations.load() - allocs) / iterations,
+                double(g_allocated_bytes.load() - bytes) / iterations};
+  g_results.emplace_back(std::move(r));
+}
+
+void print_results() {
+  for (auto &r : g_results)
+    std::cout << std::setfill(' ') << std::left << std::setw(32) << r.name
+              << std::right << std::setw(12) << std::fixed
+              << std::setprecision(1) << r.ns_per_op << " ns/op"
+              << std::setw(10) << r.allocs_per_op << " allocs/op"
+              << std::setw(12) << r.bytes_per_op << " B/op\n";
+}
+
+/**
+ * @brief Build a configuration file looking like the one of the bot
+ */
+std::string make_config(std::size_t guilds) {
+  std::ostringstream oss;
+  for (std::size_t i = 0; i < guilds; ++i) {
+    auto id = 100000000000000000ULL + i * 7919;
+    oss << '[' << id << "]\n"
+        << "goodbye_channel = " << id + 1 << '\n'
+        << "charte_channel = " << id + 2 << '\n'
+        << "charte_message = " << id + 3 << '\n'
+        << "charte_reaction_valider = ✅\n"
+        << "charte_role = " << id + 4 << "\n\n";
+  }
+  return oss.str();
+}
+
+/**
+ * @brief Build a GUILD_CREATE payload of a mid sized guild, the emojis and
+ * the members other than the bot are what the directory skips
+ */
+std::string make_guild_create(Snowflake id) {
+  std::ostringstream oss;
+  oss << R"({"t":"GUILD_CREATE","s":1,"op":0,"d":{"id":")" << id
+      << R"(","name":"Guild","members":[)";
+  for (int i = 0; i < 200; ++i)
+    oss << (i ? "," : "") << R"({"user":{"id":")" << id + 1000 + i
+        << R"(","username":"membre )" << i
+        << R"(","avatar":null},"roles":[")" << id + 1
+        << R"("],"joined_at":"2024-01-01T00:00:00.000000+00:00"})";
+  oss << R"(],"emojis":[)";
+  for (int i = 0; i < 20; ++i)
+    oss << (i ? "," : "") << R"({"id":")" << id + 500 + i
+        << R"(","name":"emoji_)" << i << R"(","animated":false})";
+  oss << R"(],"channels":[)";
+  for (int i = 0; i < 40; ++i)
+    oss << (i ? "," : "") << R"({"id":")" << id + 100 + i << R"(","type":)"
+        << (i % 4 == 3 ? 2 : 0) << R"(,"name":"salon-)" << i
+        << R"(","position":)" << i
+        << R"(,"topic":"Le sujet du salon écrit ici","nsfw":false})";
+  oss << R"(],"roles":[)";
+  for (int i = 0; i < 15; ++i)
+    oss << (i ? "," : "") << R"({"id":")" << id + i << R"(","name":"Rôle )"
+        << i << R"(","permissions":"0","position":)" << i << "}";
+  oss << R"(],"unavailable":false}})";
+  return oss.str();
+}
+
+class NullBackend : public LogBackend {
+public:
+  std::uint64_t count{0};
+  void write(LogLevel, std::string_view sv) override { count += sv.size(); }
+};
+
+class NullBuffer : public std::streambuf {
+protected:
+  int_type overflow(int_type c) override { return c; }
+  std::streamsize xsputn(const char_type *, std::streamsize n) override {
+    return n;
+  }
+};
+
+struct BenchCommand {
+  std::string_view help;
+  void (*handle)(int &);
+
+  void operator()(int &i) { handle(i); }
+};
+
+void write_json(const std::string &path, std::size_t guilds,
+                double bytes_per_guild, double lazy_bytes_per_guild) {
+  std::ofstream os{path};
+  if (!os.is_open()) {
+    LogError{} << "Impossible d'écrire " << path;
+    return;
+  }
+  os << "{\n  \"build_type\": \"" << BENCH_BUILD_TYPE << "\",\n"
+     << "  \"guilds\": " << guilds << ",\n"
+     << "  \"config_bytes_per_guild\": " << bytes_per_guild << ",\n"
+     << "  \"lazy_config_bytes_per_guild\": " << lazy_bytes_per_guild << ",\n"
+     << "  \"benchmarks\": [";
+  for (bool first = true; auto &r : g_results) {
+    os << (first ? "\n" : ",\n") << "    {\"name\": \"" << r.name
+       << "\", \"iterations\": " << r.iterations
+       << ", \"ns_per_op\": " << r.ns_per_op
+       << ", \"allocs_per_op\": " << r.allocs_per_op
+       << ", \"bytes_per_op\": " << r.bytes_per_op << '}';
+    first = false;
+  }
+  os << "\n  ]\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char *const argv[]) {
+  std::string json_file{"bench.json"};
+  std::size_t guilds{1000};
+
+  if (argc > 1)
+    json_file = argv[1];
+  if (argc > 2)
+    ConfigurationSection::convert_to_num(argv[2], guilds, guilds);
+
+  const auto text = make_config(guilds);
+  const auto guild = std::to_string(100000000000000000ULL + guilds / 2 * 7919);
+  const auto guild_id = std::stoull(guild);
+
+  // memory kept by a parsed configuration, the stream copy of the text is
+  // not part of it
+  std::istringstream input{text};
+  auto live_before = g_live_bytes.load();
+  Configuration config{input};
+  double bytes_per_guild =
+      double(g_live_bytes.load() - live_before) / double(guilds);
+  live_before = g_live_bytes.load();
+  auto lazy_config = Configuration::from_string_lazy(text);
+  double lazy_bytes_per_guild =
+      double(g_live_bytes.load() - live_before) / double(guilds);
+  std::cout << "Configuration: " << guilds << " guilds, " << std::fixed
+            << std::setprecision(1) << bytes_per_guild << " B/guild ("
+            << double(config.memory_usage()) / double(guilds)
+            << " estimated), " << lazy_bytes_per_guild
+            << " B/guild indexed ("
+            << double(lazy_config.memory_usage()) / double(guilds)
+            << " estimated)\n";
+
+  run("configuration_parse", [&] {
+    std::istringstream is{text};
+    Configuration c{is};
+    do_not_optimize(c);
+  });
+
+  run("configuration_index", [&] {
+    auto c = Configuration::from_string_lazy(text);
+    do_not_optimize(c);
+  });
+
+  run("configuration_index_first_access", [&] {
+    auto c = Configuration::from_string_lazy(text);
+    const Configuration &cc = c;
+    do_not_optimize(cc[guild].get<std::string>("charte_role"));
+  });
+
+  run("configuration_write", [&] {
+    std::ostringstream os;
+    config.serialize(os);
+    do_not_optimize(os);
+  });
+
+  const Configuration &const_config = config;
+  const auto &section = const_config[guild];
+
+  run("configuration_section_lookup",
+      [&] { do_not_optimize(const_config[guild]); });
+
+  run("configuration_section_to_string",
+      [&] { do_not_optimize(const_config[std::to_string(guild_id)]); });
+
+  run("configuration_section_lookup_id",
+      [&] { do_not_optimize(const_config[guild_id]); });
+
+  run("section_get_string", [&] {
+    auto v = section.get<std::string>("charte_role", "");
+    do_not_optimize(v);
+  });
+
+  run("section_get_num", [&] {
+    auto v = section.get<std::uint64_t>("charte_role");
+    do_not_optimize(v);
+  });
+
+  // the segment name is unique so concurrent benches don't share it
+  const std::string shm_name{
+      "/louloute_bench_" +
+      std::to_string(
+          std::chrono::steady_clock::now().time_since_epoch().count())};
+  auto store = SharedGuildStore::open(
+      shm_name, 2 * guilds, [&](SharedGuildStore &s) {
+        config.for_each_id([&s](std::uint64_t id, const ConfigurationSection &c) {
+          GuildSettings settings;
+          settings.charte_role = c.get<std::uint64_t>("charte_role");
+          settings.charte_reaction_valider =
+              c.get<std::string>("charte_reaction_valider", "");
+          s.store(id, settings);
+        });
+      });
+  SharedGuildStore::unlink(shm_name);
+  if (store) {
+    run("shared_store_load", [&] {
+      GuildSettings settings;
+      store->load(guild_id, settings);
+      do_not_optimize(settings);
+    });
+
+    GuildSettings settings;
+    store->load(guild_id, settings);
+    run("shared_store_store", [&] {
+      SharedGuildStore::WriterLock lk{*store};
+      store->store(guild_id, settings);
+    });
+  }
+
+  GuildDirectory directory;
+  // the bot is the first member, its roles are kept
+  directory.ingest(GuildDirectory::Event::ready,
+                   R"({"user":{"id":")" + std::to_string(guild_id + 1000) +
+                       R"("}})");
+  const auto guild_create = make_guild_create(guild_id);
+  directory.ingest(GuildDirectory::Event::guild_create, guild_create);
+  std::cout << "GUILD_CREATE: " << guild_create.size() << " B payload, "
+            << directory.memory_usage() << " B in the directory\n";
+
+  run("guild_directory_ingest_guild_create", [&] {
+    do_not_optimize(
+        directory.ingest(GuildDirectory::Event::guild_create, guild_create));
+  });
+
+  run("guild_directory_channels", [&] {
+    std::vector<ApiChannel> channels;
+    do_not_optimize(directory.channels(guild_id, channels));
+  });
+
+  run("guild_directory_can_send", [&] {
+    bool allowed{false};
+    do_not_optimize(directory.can_send(guild_id, guild_id + 138, allowed));
+  });
+
+  run("guild_directory_role", [&] {
+    ApiRole role;
+    do_not_optimize(directory.role(guild_id, "Rôle 12", role));
+  });
+
+  run("guild_directory_roles_with_prefix", [&] {
+    std::vector<ApiRole> roles;
+    do_not_optimize(directory.roles_with_prefix(
+        guild_id, "rôle 1", max_autocomplete_choices, roles));
+  });
+
+  // a nickname change, the screening state of the member is unchanged
+  auto member_update = [guild_id](bool pending) {
+    return R"({"t":"GUILD_MEMBER_UPDATE","s":2,"op":0,"d":{"guild_id":")" +
+           std::to_string(guild_id) + R"(","user":{"id":")" +
+           std::to_string(guild_id + 1042) +
+           R"(","username":"louloute","avatar":null},"nick":"Loulou",)" +
+           R"("roles":[],"joined_at":"2024-01-01T00:00:00.000000+00:00",)" +
+           R"("pending":)" + (pending ? "true" : "false") + "}}";
+  };
+  ScreeningTracker screening;
+  const auto accepted_update = member_update(false);
+  const auto pending_update = member_update(true);
+  screening.ingest(ScreeningTracker::Event::guild_create, guild_create);
+  run("screening_ingest_unchanged", [&] {
+    do_not_optimize(screening.ingest(ScreeningTracker::Event::member_update,
+                                     accepted_update));
+  });
+
+  // the member joins pending then accepts the rules
+  run("screening_ingest_accepted", [&] {
+    screening.ingest(ScreeningTracker::Event::member_update, pending_update);
+    do_not_optimize(screening.ingest(ScreeningTracker::Event::member_update,
+                                     accepted_update));
+  });
+
+  ConfigurationSection list_section{"list"};
+  list_section.setVector("values", std::vector<std::string>{
+                                       "alpha", "beta,gamma", "delta", "epsilon",
+                                       "zeta", "eta", "theta", "iota"});
+  run("section_getVector", [&] {
+    auto v = list_section.getVector<std::string>("values");
+    do_not_optimize(v);
+  });
+
+  const std::string number{"1234567890123456789"};
+  run("convert_to_num", [&] {
+    std::uint64_t v{0};
+    ConfigurationSection::convert_to_num(number, v);
+    do_not_optimize(v);
+  });
+
+  NullBackend null_backend;
+  LogBase::setBackend(&null_backend);
+
+  LogBase::setLevel(LogLevel::Notice);
+  run("log_frontend_filtered", [&] {
+    LogInformational{} << "Global command " << guild << " is set";
+  });
+
+  LogBase::setLevel(LogLevel::Debugging);
+  run("log_frontend", [&] {
+    LogInformational{} << "Global command " << guild << " is set";
+  });
+
+  run("log_frontend_event_scope", [&] {
+    EventScope scope;
+    LogInformational{} << "Global command " << guild << " is set";
+  });
+
+  NullBuffer null_buffer;
+  auto cout_buffer = std::cout.rdbuf(&null_buffer);
+  run("stdlog_backend", [&] {
+    StdlogBackend::instance().write(LogLevel::Informational,
+                                    "Global command help is set");
+  });
+  std::cout.rdbuf(cout_buffer);
+  LogBase::setBackend(&StdlogBackend::instance());
+  LogBase::setLevel(LogLevel::Notice);
+
+  int counter{0};
+  std::unordered_map<std::string, BenchCommand> commands{
+      {"help", {"Au secours!", [](int &i) { ++i; }}},
+      {"test", {"Test une action", [](int &i) { i += 2; }}},
+      {"setup", {"Configuration (Admin)", [](int &i) { i += 3; }}},
+  };
+  const std::string setup{"setup"};
+  run("command_dispatch", [&] {
+    do_not_optimize(dispatch_command(commands, setup, counter));
+  });
+
+  run("charte_reaction_accepted", [&] {
+    do_not_optimize(match_charte_reaction(const_config[guild_id], guild_id + 2,
+                                          guild_id + 3, "✅"));
+  });
+
+  run("charte_reaction_wrong_message", [&] {
+    do_not_optimize(match_charte_reaction(const_config[guild_id], guild_id + 2,
+                                          guild_id, "✅"));
+  });
+
+  // 20 reaction roles in each guild, 5 on each of 4 messages
+  ReactionRoleIndex reaction_roles;
+  const std::string_view emojis[] = {"✅", "❤️", "🎮", "📚", "🎵"};
+  for (std::size_t i = 0; i < guilds; ++i) {
+    const auto id = 100000000000000000ULL + i * 7919;
+    std::vector<ReactionRole> rules;
+    for (Snowflake r = 0; r < 20; ++r)
+      rules.push_back({id + 2, id + 10 + r % 4,
+                       r % 2 ? std::to_string(id + 100 + r)
+                             : std::string{emojis[r / 4]},
+                       id + 200 + r});
+    reaction_roles.assign(id, rules);
+  }
+  std::pmr::vector<Snowflake> matched_roles;
+  matched_roles.reserve(4);
+  run("reaction_roles_custom_emoji", [&] {
+    matched_roles.clear();
+    do_not_optimize(reaction_roles.roles(guild_id, guild_id + 11,
+                                         guild_id + 101, "", matched_roles));
+  });
+  run("reaction_roles_unicode_emoji", [&] {
+    matched_roles.clear();
+    do_not_optimize(reaction_roles.roles(guild_id, guild_id + 10, 0, "🎮",
+                                         matched_roles));
+  });
+  run("reaction_roles_no_rule", [&] {
+    matched_roles.clear();
+    do_not_optimize(reaction_roles.roles(guild_id, guild_id + 3, 0, "✅",
+                                         matched_roles));
+  });
+
+  // whole handlers, with the REST calls completed in memory
+  std::istringstream handlers_input{text};
+  g_guild_configs = Configuration{handlers_input};
+  LogBase::setBackend(&null_backend);
+
+  FakeBotApi api;
+  api.guild(guild_id).roles.push_back({guild_id + 4, "membre"});
+
+  ReactionAddEvent reaction{guild_id, guild_id + 2, guild_id + 3, 42,
+                            "louloute", 0, "✅"};
+  run("handler_reaction_accepted",
+      [&] { on_message_reaction_add(api, reaction); });
+
+  ReactionAddEvent other_reaction{reaction};
+  other_reaction.message_id = guild_id;
+  run("handler_reaction_ignored",
+      [&] { on_message_reaction_add(api, other_reaction); });
+
+  // a reaction as sent by the gateway, the member takes most of it
+  auto reaction_add = [guild_id](Snowflake message, std::uint64_t seq) {
+    return R"({"t":"MESSAGE_REACTION_ADD","s":)" + std::to_string(seq) +
+           R"(,"op":0,"d":{"user_id":"42","channel_id":")" +
+           std::to_string(guild_id + 2) + R"(","message_id":")" +
+           std::to_string(message) + R"(","guild_id":")" +
+           std::to_string(guild_id) +
+           R"(","member":{"user":{"id":"42","username":"louloute_du_serveur",)"
+           R"("global_name":"Louloute","avatar":null},"roles":[],)"
+           R"("joined_at":"2024-01-01T00:00:00.000000+00:00","deaf":false,)"
+           R"("mute":false},"emoji":{"id":null,"name":"✅"},)"
+           R"("message_author_id":"1","burst":false,"type":0}})";
+  };
+  const auto watched_reaction = reaction_add(guild_id + 3, 3);
+  run("reaction_watched", [&] {
+    do_not_optimize(g_guild_configs.watches_reaction(
+        guild_id, guild_id + 2, guild_id + 3, 0, "✅"));
+  });
+  run("reaction_not_watched", [&] {
+    do_not_optimize(g_guild_configs.watches_reaction(
+        guild_id, guild_id + 2, guild_id + 5, 0, "✅"));
+  });
+
+  DispatchDeduplicator dispatches;
+  dispatches.replayed(DispatchDeduplicator::Event::reaction_add,
+                      watched_reaction);
+  run("dispatch_dedupe_replayed", [&] {
+    do_not_optimize(dispatches.replayed(
+        DispatchDeduplicator::Event::reaction_add, watched_reaction));
+  });
+
+  // each payload is forgotten before it comes again
+  std::vector<std::string> sequenced;
+  for (int i = 1; i <= 4096; ++i)
+    sequenced.push_back(reaction_add(guild_id + 3, i));
+  DispatchDeduplicator small_dispatches{1024};
+  std::size_t sequence{0};
+  run("dispatch_dedupe_new", [&] {
+    do_not_optimize(small_dispatches.replayed(
+        DispatchDeduplicator::Event::reaction_add,
+        sequenced[sequence++ % sequenced.size()]));
+  });
+
+  Interaction click{1, "token", guild_id, guild_id + 2, 42, "louloute",
+                    "charte_valider"};
+  run("handler_button_click", [&] { on_button_click(api, click); });
+
+  MemberRemoveEvent removed{guild_id, 42, "louloute"};
+  run("handler_goodbye", [&] { send_goodbye(api, removed); });
+
+  Interaction help{1, "token", guild_id, guild_id + 1, 42, "louloute",
+                   "help", {}};
+  run("handler_slashcommand_help", [&] { on_slashcommand(api, help); });
+
+  api.guild(guild_id).channels.push_back({guild_id + 1, true, "general"});
+  CachingBotApi cached{api};
+  cached.channels_get(guild_id, {});
+  run("api_cache_hit", [&] {
+    cached.channels_get(guild_id,
+                        [](const ApiResult<std::vector<ApiChannel>> &r) {
+                          do_not_optimize(r.get().size());
+                        });
+  });
+
+  LogBase::setBackend(&StdlogBackend::instance());
+
+  print_results();
+  write_json(json_file, guilds, bytes_per_guild, lazy_bytes_per_guild);
+  return 0;
+}
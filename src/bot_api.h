@@ -0,0 +1,435 @@
+#ifndef BOT_API_H
+#define BOT_API_H
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+/**
+ * @brief Discord identifier, kept as a plain integer outside of DPP
+ */
+using Snowflake = std::uint64_t;
+
+/**
+ * @brief Discord permission bits used by the commands and checked before
+ * the calls
+ */
+inline constexpr std::uint64_t perm_administrator{1ULL << 3};
+inline constexpr std::uint64_t perm_view_channel{1ULL << 10};
+inline constexpr std::uint64_t perm_send_messages{1ULL << 11};
+inline constexpr std::uint64_t perm_manage_roles{1ULL << 28};
+inline constexpr std::uint64_t perm_use_application_commands{1ULL << 31};
+inline constexpr std::uint64_t perm_all{~0ULL};
+
+/**
+ * @brief The REST calls done through BotApi
+ */
+enum class ApiRoute {
+  channels_get,
+  roles_get,
+  message_get,
+  message_create,
+  guild_member_add_role,
+  guild_member_remove_role,
+  global_commands_get,
+  global_command_delete,
+  global_command_create,
+  interaction_reply,
+  interaction_thinking,
+  interaction_edit_response,
+  interaction_autocomplete,
+  message_reactions_get,
+  guild_members_get,
+  count
+};
+
+inline constexpr std::size_t api_route_count{
+    static_cast<std::size_t>(ApiRoute::count)};
+
+inline std::string_view to_string(ApiRoute r) {
+  switch (r) {
+  case ApiRoute::channels_get:
+    return "channels_get";
+  case ApiRoute::roles_get:
+    return "roles_get";
+  case ApiRoute::message_get:
+    return "message_get";
+  case ApiRoute::message_create:
+    return "message_create";
+  case ApiRoute::guild_member_add_role:
+    return "guild_member_add_role";
+  case ApiRoute::guild_member_remove_role:
+    return "guild_member_remove_role";
+  case ApiRoute::global_commands_get:
+    return "global_commands_get";
+  case ApiRoute::global_command_delete:
+    return "global_command_delete";
+  case ApiRoute::global_command_create:
+    return "global_command_create";
+  case ApiRoute::interaction_reply:
+    return "interaction_reply";
+  case ApiRoute::interaction_thinking:
+    return "interaction_thinking";
+  case ApiRoute::interaction_edit_response:
+    return "interaction_edit_response";
+  case ApiRoute::interaction_autocomplete:
+    return "interaction_autocomplete";
+  case ApiRoute::message_reactions_get:
+    return "message_reactions_get";
+  case ApiRoute::guild_members_get:
+    return "guild_members_get";
+  default:
+    return "unknown";
+  }
+}
+
+struct ApiError {
+  /** The Discord error code, or one of the api_error_ ones */
+  int code{0};
+  std::string message;
+  /** The HTTP status of the answer, 0 when none came */
+  int status{0};
+};
+
+/** Code of the calls not sent because they failed too often lately */
+inline constexpr int api_error_circuit_open{-1};
+/** Code of the calls not sent because the bot lacks the permissions */
+inline constexpr int api_error_missing_permissions{-2};
+
+/** Discord error codes of a guild the calls can't work on until fixed */
+inline constexpr int discord_unknown_channel{10003};
+inline constexpr int discord_unknown_role{10011};
+inline constexpr int discord_missing_access{50001};
+inline constexpr int discord_missing_permissions{50013};
+
+/**
+ * @brief The call failed for every call of its route in the guild, not for
+ * its member or message: no answer, a rate limit, a server error, or the
+ * guild misconfigured (missing permissions or access, unknown role or
+ * channel)
+ */
+[[nodiscard]] inline bool guild_failure(const ApiError &e) {
+  switch (e.code) {
+  case discord_unknown_channel:
+  case discord_unknown_role:
+  case discord_missing_access:
+  case discord_missing_permissions:
+  case api_error_missing_permissions:
+    return true;
+  default:
+    return e.status == 0 || e.status == 429 || e.status >= 500;
+  }
+}
+
+/**
+ * @brief Result of a REST call, either the value or the error
+ */
+template <typename T = std::monostate> class ApiResult {
+  std::variant<T, ApiError> content;
+
+public:
+  ApiResult(T value) : content{std::move(value)} {}
+  ApiResult(ApiError error) : content{std::move(error)} {}
+
+  [[nodiscard]] bool is_error() const {
+    return std::holds_alternative<ApiError>(content);
+  }
+  [[nodiscard]] const T &get() const { return std::get<T>(content); }
+  [[nodiscard]] const ApiError &get_error() const {
+    return std::get<ApiError>(content);
+  }
+};
+
+template <typename T = std::monostate>
+using ApiCallback = std::function<void(const ApiResult<T> &)>;
+
+struct ApiChannel {
+  Snowflake id{0};
+  bool is_text{false};
+  std::string name;
+  /** The bot may send messages there, true when it is not known */
+  bool writable{true};
+};
+
+struct ApiRole {
+  Snowflake id{0};
+  std::string name;
+};
+
+struct ApiMember {
+  Snowflake id{0};
+  std::vector<Snowflake> roles;
+};
+
+/** Most users answered by a page of message_reactions_get */
+inline constexpr std::size_t reactions_page_size{100};
+/** Most members answered by a page of guild_members_get */
+inline constexpr std::size_t members_page_size{1000};
+
+/**
+ * @brief ASCII case insensitive order, used by the name completions
+ */
+inline bool less_folded(std::string_view l, std::string_view r) {
+  return std::ranges::lexicographical_compare(
+      l, r, {}, [](unsigned char c) { return std::tolower(c); },
+      [](unsigned char c) { return std::tolower(c); });
+}
+
+inline bool starts_with_folded(std::string_view s, std::string_view prefix) {
+  return s.size() >= prefix.size() &&
+         std::ranges::equal(
+             s.substr(0, prefix.size()), prefix, {},
+             [](unsigned char c) { return std::tolower(c); },
+             [](unsigned char c) { return std::tolower(c); });
+}
+
+struct ApiReaction {
+  Snowflake emoji_id{0};
+  std::string emoji_name;
+};
+
+struct ApiMessage {
+  Snowflake id{0};
+  Snowflake channel_id{0};
+  std::vector<ApiReaction> reactions;
+};
+
+/**
+ * @brief A button below a message, its clicks are interactions whose
+ * command is the custom id
+ */
+struct ApiButton {
+  std::string custom_id;
+  std::string label;
+};
+
+enum class OptionType { string };
+
+struct CommandChoice {
+  std::string name;
+  std::string value;
+};
+
+struct CommandOption {
+  OptionType type{OptionType::string};
+  std::string name;
+  std::string description;
+  bool required{false};
+  std::vector<CommandChoice> choices{};
+  /** The values are proposed by the bot while the user types */
+  bool autocomplete{false};
+};
+
+/** Discord shows at most this many autocomplete choices */
+inline constexpr std::size_t max_autocomplete_choices{25};
+
+struct CommandDefinition {
+  Snowflake id{0};
+  std::string name;
+  std::string description;
+  std::uint64_t permissions{0};
+  std::vector<CommandOption> options;
+};
+
+/**
+ * @brief A slash command invocation, or the click of a button
+ */
+struct Interaction {
+  Snowflake id{0};
+  std::string token;
+  Snowflake guild_id{0};
+  Snowflake channel_id{0};
+  Snowflake user_id{0};
+  std::string username;
+  std::string command;
+  std::map<std::string, std::string, std::less<>> parameters{};
+  /** For an autocomplete request, the option being typed */
+  std::string focused{};
+
+  /**
+   * @brief Get a string parameter of the command
+   *
+   * @return the value, nullptr if not given
+   */
+  [[nodiscard]] const std::string *parameter(std::string_view name) const {
+    auto itr = parameters.find(name);
+    if (itr == std::end(parameters))
+      return nullptr;
+    return &itr->second;
+  }
+};
+
+struct MemberRemoveEvent {
+  Snowflake guild_id{0};
+  Snowflake user_id{0};
+  std::string username;
+};
+
+struct ReactionAddEvent {
+  Snowflake guild_id{0};
+  Snowflake channel_id{0};
+  Snowflake message_id{0};
+  Snowflake user_id{0};
+  std::string username;
+  Snowflake emoji_id{0};
+  std::string emoji_name;
+};
+
+/** A member accepted the rules of the guild screening */
+struct MemberScreenedEvent {
+  Snowflake guild_id{0};
+  Snowflake user_id{0};
+};
+
+struct ReactionRemoveEvent {
+  Snowflake guild_id{0};
+  Snowflake channel_id{0};
+  Snowflake message_id{0};
+  Snowflake user_id{0};
+  Snowflake emoji_id{0};
+  std::string emoji_name;
+};
+
+/**
+ * @brief The Discord calls done by the handlers
+ * The callbacks may be called from any thread, or before the call returns
+ */
+class BotApi {
+protected:
+  BotApi() = default;
+  BotApi(const BotApi &) = delete;
+  BotApi(BotApi &&) = delete;
+  BotApi &operator=(const BotApi &) = delete;
+  BotApi &operator=(BotApi &&) = delete;
+
+public:
+  virtual ~BotApi() noexcept = default;
+
+  virtual void channels_get(Snowflake guild,
+                            ApiCallback<std::vector<ApiChannel>> callback) = 0;
+  virtual void roles_get(Snowflake guild,
+                         ApiCallback<std::vector<ApiRole>> callback) = 0;
+  virtual void message_get(Snowflake channel, Snowflake message,
+                           ApiCallback<ApiMessage> callback) = 0;
+  virtual void message_create(Snowflake guild, Snowflake channel,
+                              std::string content,
+                              ApiCallback<> callback = {}) = 0;
+  virtual void message_create_button(Snowflake guild, Snowflake channel,
+                                     std::string content, ApiButton button,
+                                     ApiCallback<> callback = {}) = 0;
+  virtual void guild_member_add_role(Snowflake guild, Snowflake user,
+                                     Snowflake role,
+                                     ApiCallback<> callback = {}) = 0;
+  virtual void guild_member_remove_role(Snowflake guild, Snowflake user,
+                                        Snowflake role,
+                                        ApiCallback<> callback = {}) = 0;
+
+  virtual void global_commands_get(
+      ApiCallback<std::vector<CommandDefinition>> callback) = 0;
+  virtual void global_command_delete(Snowflake command,
+                                     ApiCallback<> callback = {}) = 0;
+  virtual void global_command_create(const CommandDefinition &command,
+                                     ApiCallback<> callback = {}) = 0;
+
+  virtual void interaction_reply(const Interaction &interaction,
+                                 std::string content,
+                                 ApiCallback<> callback = {}) = 0;
+  virtual void interaction_thinking(const Interaction &interaction,
+                                    bool ephemeral,
+                                    ApiCallback<> callback = {}) = 0;
+  virtual void interaction_edit_response(const Interaction &interaction,
+                                         std::string content,
+                                         ApiCallback<> callback = {}) = 0;
+  virtual void
+  interaction_autocomplete(const Interaction &interaction,
+                           std::vector<CommandChoice> choices,
+                           ApiCallback<> callback = {}) = 0;
+
+  /**
+   * @brief The users who reacted with the emoji, ordered by id: at most
+   * reactions_page_size of them, after the id given
+   */
+  virtual void
+  message_reactions_get(Snowflake channel, Snowflake message,
+                        std::string emoji, Snowflake after,
+                        ApiCallback<std::vector<Snowflake>> callback) = 0;
+
+  /**
+   * @brief The members of the guild, ordered by id: at most
+   * members_page_size of them, after the id given
+   */
+  virtual void
+  guild_members_get(Snowflake guild, Snowflake after,
+                    ApiCallback<std::vector<ApiMember>> callback) = 0;
+
+  /**
+   * @brief The time of the calls, steady
+   */
+  [[nodiscard]] virtual std::chrono::nanoseconds now() const = 0;
+
+  /**
+   * @brief Call f once the delay is over, from any thread
+   */
+  virtual void after(std::chrono::nanoseconds delay,
+                     std::function<void()> f) = 0;
+
+  /**
+   * @brief Make a callback of the handlers safe to keep by the process
+   * after the handler returned, it is called later without going through
+   * a call of this api
+   */
+  virtual ApiCallback<> keep(ApiCallback<> callback) { return callback; }
+
+  /**
+   * @brief The api for the timers and calls of the process itself, those
+   * outliving the handler: they don't keep its module loaded
+   */
+  virtual BotApi &process_api() { return *this; }
+
+  /**
+   * @brief Find the role of the guild with this exact name, its id is 0 if
+   * there is none. Fetch every role unless the implementation has an index
+   */
+  virtual void role_find(Snowflake guild, std::string name,
+                         ApiCallback<ApiRole> callback) {
+    roles_get(guild, [name = std::move(name), callback = std::move(callback)](
+                         const ApiResult<std::vector<ApiRole>> &r) {
+      if (r.is_error())
+        return callback(r.get_error());
+      auto itr = std::ranges::find(r.get(), name, &ApiRole::name);
+      callback(itr == std::end(r.get()) ? ApiRole{} : *itr);
+    });
+  }
+
+  /**
+   * @brief The roles of the guild whose name starts with the prefix, case
+   * insensitive, ordered by name
+   */
+  virtual void roles_complete(Snowflake guild, std::string prefix,
+                              std::size_t limit,
+                              ApiCallback<std::vector<ApiRole>> callback) {
+    roles_get(guild, [prefix = std::move(prefix), limit,
+                      callback = std::move(callback)](
+                         const ApiResult<std::vector<ApiRole>> &r) {
+      if (r.is_error())
+        return callback(r.get_error());
+      std::vector<ApiRole> res;
+      for (auto &i : r.get())
+        if (starts_with_folded(i.name, prefix))
+          res.push_back(i);
+      std::ranges::sort(res, less_folded, &ApiRole::name);
+      if (res.size() > limit)
+        res.resize(limit);
+      callback(std::move(res));
+    });
+  }
+};
+
+#endif // BOT_API_H
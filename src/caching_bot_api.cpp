@@ -0,0 +1,421 @@
+#include "caching_bot_api.h"
+#include "configuration.h"
+#include "json_scanner.h"
+
+#include <mutex>
+#include <optional>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// heap bytes of a string, 0 when it is in the small string buffer
+std::size_t string_heap(const std::string &s) {
+  return s.capacity() > std::string{}.capacity() ? s.capacity() + 1 : 0;
+}
+
+std::size_t value_heap(const std::vector<ApiChannel> &v) {
+  std::size_t bytes{v.capacity() * sizeof(ApiChannel)};
+  for (auto &c : v)
+    bytes += string_heap(c.name);
+  return bytes;
+}
+
+std::size_t value_heap(const std::vector<ApiRole> &v) {
+  std::size_t bytes{v.capacity() * sizeof(ApiRole)};
+  for (auto &r : v)
+    bytes += string_heap(r.name);
+  return bytes;
+}
+
+std::size_t value_heap(const ApiMessage &m) {
+  std::size_t bytes{m.reactions.capacity() * sizeof(ApiReaction)};
+  for (auto &r : m.reactions)
+    bytes += string_heap(r.emoji_name);
+  return bytes;
+}
+
+} // namespace
+
+CachingBotApi::CachingBotApi(BotApi &b, std::size_t c)
+    : inner{b}, capacity{c} {
+  // the gateway events drop the changed answers, the time to live only
+  // bounds what a missed event costs
+  set_ttl(ApiRoute::channels_get, 5min);
+  set_ttl(ApiRoute::roles_get, 5min);
+  set_ttl(ApiRoute::message_get, 1min);
+}
+
+void CachingBotApi::set_ttl(ApiRoute route, std::chrono::nanoseconds t) {
+  ttl[static_cast<std::size_t>(route)] = t;
+}
+
+template <typename T>
+bool CachingBotApi::lookup(const Key &key, ApiCallback<T> &callback) {
+  if (ttl[static_cast<std::size_t>(key.route)] <= 0ns)
+    return false;
+
+  std::optional<T> value;
+  {
+    std::lock_guard lk{mutex};
+    auto itr = entries.find(key);
+    if (itr != std::end(entries) && itr->second.expiry > inner.now())
+      value = std::get<T>(itr->second.value);
+  }
+  if (!value) {
+    miss_count.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  hit_count.fetch_add(1, std::memory_order_relaxed);
+  if (callback)
+    callback(std::move(*value));
+  return true;
+}
+
+template <typename T>
+ApiCallback<T> CachingBotApi::join(const Key &key, ApiCallback<T> callback) {
+  std::shared_ptr<InFlight> flight;
+  {
+    std::lock_guard lk{mutex};
+    auto &current = in_flight[key];
+    if (!current)
+      ++route_reads[static_cast<std::size_t>(key.route)];
+    else if (!current->stale) {
+      std::get<std::vector<ApiCallback<T>>>(current->waiters)
+          .push_back(std::move(callback));
+      coalesced_count.fetch_add(1, std::memory_order_relaxed);
+      return {};
+    }
+    current = std::make_shared<InFlight>();
+    current->waiters.template emplace<std::vector<ApiCallback<T>>>();
+    flight = current;
+  }
+  return [this, key, flight, callback = std::move(callback)](
+             const ApiResult<T> &r) { complete(key, flight, callback, r); };
+}
+
+template <typename T>
+void CachingBotApi::complete(const Key &key,
+                             const std::shared_ptr<InFlight> &flight,
+                             const ApiCallback<T> &callback,
+                             const ApiResult<T> &r) {
+  std::vector<ApiCallback<T>> waiters;
+  {
+    std::lock_guard lk{mutex};
+    waiters =
+        std::move(std::get<std::vector<ApiCallback<T>>>(flight->waiters));
+    if (auto itr = in_flight.find(key);
+        itr != std::end(in_flight) && itr->second == flight) {
+      in_flight.erase(itr);
+      --route_reads[static_cast<std::size_t>(key.route)];
+    }
+    if (!r.is_error() && !flight->stale &&
+        ttl[static_cast<std::size_t>(key.route)] > 0ns)
+      store(key, r.get());
+  }
+  if (callback)
+    callback(r);
+  for (auto &w : waiters)
+    if (w)
+      w(r);
+}
+
+template <typename T, typename Send>
+void CachingBotApi::read(const Key &key, ApiCallback<T> callback,
+                         Send &&send) {
+  if (lookup(key, callback))
+    return;
+  if (auto c = join(key, std::move(callback)))
+    send(std::move(c));
+}
+
+void CachingBotApi::store(const Key &key, Value value) {
+  const auto now = inner.now();
+  erase(key);
+  while (!expiries.empty() && (expiries.begin()->first <= now ||
+                               entries.size() >= capacity))
+    erase(expiries.begin()->second);
+
+  const auto expiry = now + ttl[static_cast<std::size_t>(key.route)];
+  entries.emplace(key, Entry{std::move(value), expiry});
+  expiries.emplace(expiry, key);
+  ++route_reads[static_cast<std::size_t>(key.route)];
+}
+
+bool CachingBotApi::cached(const Key &key) const {
+  std::lock_guard lk{mutex};
+  auto itr = entries.find(key);
+  return itr != std::end(entries) && itr->second.expiry > inner.now();
+}
+
+void CachingBotApi::erase(const Key &key) {
+  auto itr = entries.find(key);
+  if (itr == std::end(entries))
+    return;
+  expiries.erase({itr->second.expiry, key});
+  entries.erase(itr);
+  --route_reads[static_cast<std::size_t>(key.route)];
+}
+
+void CachingBotApi::invalidate(ApiRoute route, Snowflake a, Snowflake b) {
+  const Key key{route, a, b};
+  std::lock_guard lk{mutex};
+  erase(key);
+  if (auto itr = in_flight.find(key); itr != std::end(in_flight))
+    itr->second->stale = true;
+}
+
+bool CachingBotApi::invalidate(CacheEvent event, std::string_view raw) {
+  {
+    // most reactions and member updates come while none of the reads they
+    // change is cached
+    std::lock_guard lk{mutex};
+    auto reads = [this](ApiRoute route) {
+      return route_reads[static_cast<std::size_t>(route)] != 0;
+    };
+    bool changed{false};
+    switch (event) {
+    case CacheEvent::ready:
+      changed = true;
+      break;
+    case CacheEvent::guild:
+    case CacheEvent::role:
+      changed = reads(ApiRoute::roles_get);
+      [[fallthrough]];
+    case CacheEvent::channel:
+    case CacheEvent::member:
+      changed = changed || reads(ApiRoute::channels_get);
+      break;
+    case CacheEvent::message:
+    case CacheEvent::message_bulk:
+    case CacheEvent::reaction:
+      changed = reads(ApiRoute::message_get);
+      break;
+    }
+    if (!changed)
+      return true;
+  }
+
+  Snowflake id{0};
+  Snowflake user_id{0};
+  Snowflake guild_id{0};
+  Snowflake channel_id{0};
+  Snowflake message_id{0};
+  std::vector<Snowflake> ids;
+
+  auto read_user = [&](std::string_view key, JsonScanner &v) {
+    if (key == "id")
+      return v.snowflake(user_id);
+    return false;
+  };
+  auto read_member = [&](std::string_view key, JsonScanner &v) {
+    if (key == "id")
+      return v.snowflake(id);
+    if (key == "user")
+      return v.object(read_user);
+    if (key == "guild_id")
+      return v.snowflake(guild_id);
+    if (key == "channel_id")
+      return v.snowflake(channel_id);
+    if (key == "message_id")
+      return v.snowflake(message_id);
+    if (key == "ids" && event == CacheEvent::message_bulk)
+      return v.array([&ids](JsonScanner &e) {
+        Snowflake i{0};
+        if (e.snowflake(i))
+          ids.push_back(i);
+      });
+    return false;
+  };
+
+  JsonScanner s{raw};
+  s.object([&](std::string_view key, JsonScanner &v) {
+    if (key == "d")
+      return v.object(read_member);
+    return read_member(key, v);
+  });
+  if (!s.ok()) {
+    LogWarning{} << "Événement illisible pour le cache";
+    return false;
+  }
+
+  switch (event) {
+  case CacheEvent::ready:
+    self.store(user_id, std::memory_order_relaxed);
+    break;
+  case CacheEvent::guild:
+    invalidate(ApiRoute::channels_get, id);
+    invalidate(ApiRoute::roles_get, id);
+    break;
+  case CacheEvent::channel:
+    invalidate(ApiRoute::channels_get, guild_id);
+    break;
+  case CacheEvent::role:
+    // the channels the bot may write in follow its roles
+    invalidate(ApiRoute::roles_get, guild_id);
+    invalidate(ApiRoute::channels_get, guild_id);
+    break;
+  case CacheEvent::member:
+    // the channels the bot may write in follow its roles
+    if (user_id && user_id == self.load(std::memory_order_relaxed))
+      invalidate(ApiRoute::channels_get, guild_id);
+    break;
+  case CacheEvent::message:
+    invalidate(ApiRoute::message_get, channel_id, id);
+    break;
+  case CacheEvent::message_bulk:
+    for (auto i : ids)
+      invalidate(ApiRoute::message_get, channel_id, i);
+    break;
+  case CacheEvent::reaction:
+    invalidate(ApiRoute::message_get, channel_id, message_id);
+    break;
+  }
+  return true;
+}
+
+std::size_t CachingBotApi::size() const {
+  std::lock_guard lk{mutex};
+  return entries.size();
+}
+
+std::size_t CachingBotApi::memory_usage() const {
+  std::lock_guard lk{mutex};
+  std::size_t bytes{
+      entries.size() *
+          (sizeof(decltype(entries)::value_type) + sizeof(void *)) +
+      entries.bucket_count() * sizeof(void *) +
+      expiries.size() *
+          (sizeof(decltype(expiries)::value_type) + 4 * sizeof(void *)) +
+      in_flight.size() *
+          (sizeof(decltype(in_flight)::value_type) + sizeof(InFlight) +
+           sizeof(void *)) +
+      in_flight.bucket_count() * sizeof(void *)};
+  for (auto &[key, e] : entries)
+    bytes += std::visit([](const auto &v) { return value_heap(v); }, e.value);
+  return bytes;
+}
+
+void CachingBotApi::channels_get(
+    Snowflake guild, ApiCallback<std::vector<ApiChannel>> callback) {
+  read({ApiRoute::channels_get, guild, 0}, std::move(callback),
+       [&](auto c) { inner.channels_get(guild, std::move(c)); });
+}
+
+void CachingBotApi::roles_get(Snowflake guild,
+                              ApiCallback<std::vector<ApiRole>> callback) {
+  read({ApiRoute::roles_get, guild, 0}, std::move(callback),
+       [&](auto c) { inner.roles_get(guild, std::move(c)); });
+}
+
+void CachingBotApi::message_get(Snowflake channel, Snowflake message,
+                                ApiCallback<ApiMessage> callback) {
+  read({ApiRoute::message_get, channel, message}, std::move(callback),
+       [&](auto c) { inner.message_get(channel, message, std::move(c)); });
+}
+
+void CachingBotApi::message_create(Snowflake guild, Snowflake channel,
+                                   std::string content,
+                                   ApiCallback<> callback) {
+  inner.message_create(guild, channel, std::move(content),
+                       std::move(callback));
+}
+
+void CachingBotApi::message_create_button(Snowflake guild, Snowflake channel,
+                                          std::string content,
+                                          ApiButton button,
+                                          ApiCallback<> callback) {
+  inner.message_create_button(guild, channel, std::move(content),
+                              std::move(button), std::move(callback));
+}
+
+void CachingBotApi::guild_member_add_role(Snowflake guild, Snowflake user,
+                                          Snowflake role,
+                                          ApiCallback<> callback) {
+  inner.guild_member_add_role(guild, user, role, std::move(callback));
+}
+
+void CachingBotApi::guild_member_remove_role(Snowflake guild, Snowflake user,
+                                             Snowflake role,
+                                             ApiCallback<> callback) {
+  inner.guild_member_remove_role(guild, user, role, std::move(callback));
+}
+
+void CachingBotApi::global_commands_get(
+    ApiCallback<std::vector<CommandDefinition>> callback) {
+  inner.global_commands_get(std::move(callback));
+}
+
+void CachingBotApi::global_command_delete(Snowflake command,
+                                          ApiCallback<> callback) {
+  inner.global_command_delete(command, std::move(callback));
+}
+
+void CachingBotApi::global_command_create(const CommandDefinition &command,
+                                          ApiCallback<> callback) {
+  inner.global_command_create(command, std::move(callback));
+}
+
+void CachingBotApi::interaction_reply(const Interaction &interaction,
+                                      std::string content,
+                                      ApiCallback<> callback) {
+  inner.interaction_reply(interaction, std::move(content),
+                          std::move(callback));
+}
+
+void CachingBotApi::interaction_thinking(const Interaction &interaction,
+                                         bool ephemeral,
+                                         ApiCallback<> callback) {
+  inner.interaction_thinking(interaction, ephemeral, std::move(callback));
+}
+
+void CachingBotApi::interaction_edit_response(const Interaction &interaction,
+                                              std::string content,
+                                              ApiCallback<> callback) {
+  inner.interaction_edit_response(interaction, std::move(content),
+                                  std::move(callback));
+}
+
+void CachingBotApi::interaction_autocomplete(
+    const Interaction &interaction, std::vector<CommandChoice> choices,
+    ApiCallback<> callback) {
+  inner.interaction_autocomplete(interaction, std::move(choices),
+                                 std::move(callback));
+}
+
+void CachingBotApi::message_reactions_get(
+    Snowflake channel, Snowflake message, std::string emoji, Snowflake after,
+    ApiCallback<std::vector<Snowflake>> callback) {
+  inner.message_reactions_get(channel, message, std::move(emoji), after,
+                              std::move(callback));
+}
+
+void CachingBotApi::guild_members_get(
+    Snowflake guild, Snowflake after,
+    ApiCallback<std::vector<ApiMember>> callback) {
+  inner.guild_members_get(guild, after, std::move(callback));
+}
+
+std::chrono::nanoseconds CachingBotApi::now() const { return inner.now(); }
+
+void CachingBotApi::after(std::chrono::nanoseconds delay,
+                          std::function<void()> f) {
+  inner.after(delay, std::move(f));
+}
+
+void CachingBotApi::role_find(Snowflake guild, std::string name,
+                              ApiCallback<ApiRole> callback) {
+  // the inner BotApi may have an index, the cached roles are filtered here
+  if (cached({ApiRoute::roles_get, guild, 0}))
+    return BotApi::role_find(guild, std::move(name), std::move(callback));
+  inner.role_find(guild, std::move(name), std::move(callback));
+}
+
+void CachingBotApi::roles_complete(
+    Snowflake guild, std::string prefix, std::size_t limit,
+    ApiCallback<std::vector<ApiRole>> callback) {
+  if (cached({ApiRoute::roles_get, guild, 0}))
+    return BotApi::roles_complete(guild, std::move(prefix), limit,
+                                  std::move(callback));
+  inner.roles_complete(guild, std::move(prefix), limit, std::move(callback));
+}
@@ -0,0 +1,224 @@
+#ifndef CACHING_BOT_API_H
+#define CACHING_BOT_API_H
+
+#include "bot_api.h"
+#include "profiling.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+
+/**
+ * @brief The gateway events changing what the read-only calls answer
+ */
+enum class CacheEvent {
+  ready,        /** READY, gives the id of the bot */
+  guild,        /** GUILD_CREATE, GUILD_UPDATE and GUILD_DELETE */
+  channel,      /** CHANNEL_CREATE, CHANNEL_UPDATE and CHANNEL_DELETE */
+  role,         /** GUILD_ROLE_CREATE, GUILD_ROLE_UPDATE and ..._DELETE */
+  member,       /** GUILD_MEMBER_UPDATE, only the bot's change the cache */
+  message,      /** MESSAGE_UPDATE and MESSAGE_DELETE */
+  message_bulk, /** MESSAGE_DELETE_BULK */
+  reaction      /** MESSAGE_REACTION_ADD, MESSAGE_REACTION_REMOVE... */
+};
+
+/**
+ * @brief BotApi keeping the answers of the read-only calls for a while
+ * An entry is dropped when the time to live of its route is over, when a
+ * gateway event changes it, or when the cache is full and it expires
+ * first. A read made while the same one is in flight waits for its answer
+ * instead of being sent again. The other calls go to the inner BotApi
+ * unchanged
+ */
+class CachingBotApi : public BotApi {
+public:
+  explicit CachingBotApi(BotApi &b, std::size_t capacity = 4096);
+
+  /**
+   * @brief Set how long the answers of the route are kept, 0 to not cache
+   * it
+   */
+  void set_ttl(ApiRoute route, std::chrono::nanoseconds ttl);
+
+  /**
+   * @brief Drop the answer of a call, the ones in flight are not kept
+   *
+   * @param a The guild, or the channel for message_get
+   * @param b The message for message_get
+   */
+  void invalidate(ApiRoute route, Snowflake a, Snowflake b = 0);
+
+  /**
+   * @brief Drop the answers changed by a gateway event, given as the raw
+   * payload or its "d" object
+   *
+   * @return false if the payload could not be read
+   */
+  bool invalidate(CacheEvent event, std::string_view raw);
+
+  [[nodiscard]] std::uint64_t hits() const {
+    return hit_count.load(std::memory_order_relaxed);
+  }
+  [[nodiscard]] std::uint64_t misses() const {
+    return miss_count.load(std::memory_order_relaxed);
+  }
+  /** The reads answered by a call already in flight */
+  [[nodiscard]] std::uint64_t coalesced() const {
+    return coalesced_count.load(std::memory_order_relaxed);
+  }
+  [[nodiscard]] std::size_t size() const;
+
+  /**
+   * @brief Estimated heap memory of the cache
+   */
+  [[nodiscard]] std::size_t memory_usage() const;
+
+  void channels_get(Snowflake guild,
+                    ApiCallback<std::vector<ApiChannel>> callback) override;
+  void roles_get(Snowflake guild,
+                 ApiCallback<std::vector<ApiRole>> callback) override;
+  void message_get(Snowflake channel, Snowflake message,
+                   ApiCallback<ApiMessage> callback) override;
+  void message_create(Snowflake guild, Snowflake channel, std::string content,
+                      ApiCallback<> callback) override;
+  void message_create_button(Snowflake guild, Snowflake channel,
+                             std::string content, ApiButton button,
+                             ApiCallback<> callback) override;
+  void guild_member_add_role(Snowflake guild, Snowflake user, Snowflake role,
+                             ApiCallback<> callback) override;
+  void guild_member_remove_role(Snowflake guild, Snowflake user,
+                                Snowflake role,
+                                ApiCallback<> callback) override;
+
+  void global_commands_get(
+      ApiCallback<std::vector<CommandDefinition>> callback) override;
+  void global_command_delete(Snowflake command,
+                             ApiCallback<> callback) override;
+  void global_command_create(const CommandDefinition &command,
+                             ApiCallback<> callback) override;
+
+  void interaction_reply(const Interaction &interaction, std::string content,
+                         ApiCallback<> callback) override;
+  void interaction_thinking(const Interaction &interaction, bool ephemeral,
+                            ApiCallback<> callback) override;
+  void interaction_edit_response(const Interaction &interaction,
+                                 std::string content,
+                                 ApiCallback<> callback) override;
+  void interaction_autocomplete(const Interaction &interaction,
+                                std::vector<CommandChoice> choices,
+                                ApiCallback<> callback) override;
+
+  void message_reactions_get(
+      Snowflake channel, Snowflake message, std::string emoji, Snowflake after,
+      ApiCallback<std::vector<Snowflake>> callback) override;
+  void guild_members_get(Snowflake guild, Snowflake after,
+                         ApiCallback<std::vector<ApiMember>> callback) override;
+
+  [[nodiscard]] std::chrono::nanoseconds now() const override;
+  void after(std::chrono::nanoseconds delay, std::function<void()> f) override;
+
+  void role_find(Snowflake guild, std::string name,
+                 ApiCallback<ApiRole> callback) override;
+  void roles_complete(Snowflake guild, std::string prefix, std::size_t limit,
+                      ApiCallback<std::vector<ApiRole>> callback) override;
+
+private:
+  struct Key {
+    ApiRoute route;
+    Snowflake a;
+    Snowflake b;
+
+    auto operator<=>(const Key &) const = default;
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key &k) const {
+      return std::hash<Snowflake>{}(k.a * 31 + k.b) ^
+             static_cast<std::size_t>(k.route);
+    }
+  };
+
+  using Value =
+      std::variant<std::vector<ApiChannel>, std::vector<ApiRole>, ApiMessage>;
+
+  struct Entry {
+    Value value;
+    /** On the clock of the inner BotApi */
+    std::chrono::nanoseconds expiry;
+  };
+
+  /** A read sent, and the callbacks of the same reads made since */
+  struct InFlight {
+    std::variant<std::vector<ApiCallback<std::vector<ApiChannel>>>,
+                 std::vector<ApiCallback<std::vector<ApiRole>>>,
+                 std::vector<ApiCallback<ApiMessage>>>
+        waiters;
+    /** Invalidated meanwhile, the answer may be older than the event */
+    bool stale{false};
+  };
+
+  /**
+   * @brief Answer the call from the cache
+   *
+   * @return false if the answer is not cached, callback is unchanged
+   */
+  template <typename T> bool lookup(const Key &key, ApiCallback<T> &callback);
+
+  /**
+   * @brief Make the callback wait for the same read if it is in flight
+   *
+   * @return the callback to send the read with, empty when it waits
+   */
+  template <typename T>
+  ApiCallback<T> join(const Key &key, ApiCallback<T> callback);
+
+  /**
+   * @brief Answer a read and its waiters, and keep the answer
+   */
+  template <typename T>
+  void complete(const Key &key, const std::shared_ptr<InFlight> &flight,
+                const ApiCallback<T> &callback, const ApiResult<T> &r);
+
+  /**
+   * @brief Look for the answer in the cache, else send the read or wait
+   * for the one in flight
+   */
+  template <typename T, typename Send>
+  void read(const Key &key, ApiCallback<T> callback, Send &&send);
+
+  /** mutex is held */
+  void store(const Key &key, Value value);
+  [[nodiscard]] bool cached(const Key &key) const;
+  /** mutex is held */
+  void erase(const Key &key);
+
+  BotApi &inner;
+  const std::size_t capacity;
+  std::array<std::chrono::nanoseconds, api_route_count> ttl{};
+
+  mutable ProfiledMutex mutex{"api_cache"};
+  std::unordered_map<Key, Entry, KeyHash> entries;
+  /** Ordered by expiry, the front goes first when the cache is full */
+  std::set<std::pair<std::chrono::nanoseconds, Key>> expiries;
+  /** A stale read is replaced, its waiters stay with it */
+  std::unordered_map<Key, std::shared_ptr<InFlight>, KeyHash> in_flight;
+  /** The entries and the reads in flight of each route */
+  std::array<std::size_t, api_route_count> route_reads{};
+  /** The id of the bot, from READY */
+  std::atomic<Snowflake> self{0};
+
+  std::atomic<std::uint64_t> hit_count{0};
+  std::atomic<std::uint64_t> miss_count{0};
+  std::atomic<std::uint64_t> coalesced_count{0};
+};
+
+#endif // CACHING_BOT_API_H
@@ -0,0 +1,171 @@
+#include "charte_backfill.h"
+#include "configuration.h"
+#include "guild_config.h"
+
+#include <algorithm>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <vector>
+
+CharteBackfill g_charte_backfill;
+
+struct CharteBackfill::Job {
+  CharteBackfill &owner;
+  BotApi &bot;
+  Snowflake guild{0};
+  Snowflake channel{0};
+  Snowflake message{0};
+  Snowflake role{0};
+  std::string emoji;
+
+  /** The page of reactors being merged, and the next one to look at */
+  std::vector<Snowflake> reactors;
+  std::size_t reactor{0};
+  Snowflake reactors_after{0};
+  bool reactors_done{false};
+
+  std::vector<ApiMember> members;
+  std::size_t member{0};
+  Snowflake members_after{0};
+  bool members_done{false};
+
+  /** Stopped by an error the next calls would get too */
+  bool aborted{false};
+  std::uint64_t granted{0};
+  /** Answers not handled yet, the thread moving it from 0 handles them */
+  std::atomic<std::uint32_t> pending{0};
+
+  Job(CharteBackfill &o, BotApi &b) : owner{o}, bot{b} {}
+  Job(const Job &) = delete;
+  Job &operator=(const Job &) = delete;
+  // the last answer, or the call dropped, ends the job
+  ~Job() { owner.finished(*this); }
+};
+
+bool CharteBackfill::start(BotApi &bot, Snowflake guild) {
+  auto job = std::make_shared<Job>(*this, bot);
+  job->guild = guild;
+  auto [channel, message] = g_guild_configs.get_guild_charte_message(guild);
+  if (!Configuration::to_id(channel, job->channel) ||
+      !Configuration::to_id(message, job->message))
+    job->channel = job->message = 0;
+  job->role = g_guild_configs.get_guild_charte_role(guild);
+  job->emoji = g_guild_configs.get_guild_charte_reaction_valider(
+      guild, std::pmr::new_delete_resource());
+  if (!job->channel || !job->message || !job->role || job->emoji.empty()) {
+    // the destructor must not count it as finished
+    job->guild = 0;
+    return false;
+  }
+
+  {
+    std::lock_guard lk{mutex};
+    if (!guilds.insert(guild).second) {
+      job->guild = 0;
+      return false;
+    }
+  }
+  LogNotice{} << "Rattrapage de la charte de " << guild;
+  run(job);
+  return true;
+}
+
+void CharteBackfill::run(const std::shared_ptr<Job> &job) {
+  if (job->pending.fetch_add(1, std::memory_order_acq_rel) != 0)
+    return;
+  do
+    step(job);
+  while (job->pending.fetch_sub(1, std::memory_order_acq_rel) != 1);
+}
+
+void CharteBackfill::step(const std::shared_ptr<Job> &job) {
+  auto &j = *job;
+  while (!j.aborted) {
+    if (j.reactor == j.reactors.size()) {
+      if (j.reactors_done)
+        return;
+      return j.bot.message_reactions_get(
+          j.channel, j.message, j.emoji, j.reactors_after,
+          [this, job](const ApiResult<std::vector<Snowflake>> &r) {
+            if (r.is_error()) {
+              LogError{} << "Réactions de la charte de " << job->guild
+                         << " illisibles: " << r.get_error().message;
+              job->aborted = true;
+            } else {
+              job->reactors = r.get();
+              job->reactor = 0;
+              job->reactors_done = job->reactors.size() < reactions_page_size;
+              if (!job->reactors.empty())
+                job->reactors_after = job->reactors.back();
+              reaction_count.fetch_add(job->reactors.size(),
+                                       std::memory_order_relaxed);
+            }
+            run(job);
+          });
+    }
+
+    const auto user = j.reactors[j.reactor];
+    while (j.member < j.members.size() && j.members[j.member].id < user)
+      ++j.member;
+    if (j.member == j.members.size()) {
+      // the reactors left are not members anymore
+      if (j.members_done)
+        return;
+      return j.bot.guild_members_get(
+          j.guild, j.members_after,
+          [this, job](const ApiResult<std::vector<ApiMember>> &r) {
+            if (r.is_error()) {
+              LogError{} << "Membres de " << job->guild
+                         << " illisibles: " << r.get_error().message;
+              job->aborted = true;
+            } else {
+              job->members = r.get();
+              job->member = 0;
+              job->members_done = job->members.size() < members_page_size;
+              if (!job->members.empty())
+                job->members_after = job->members.back().id;
+              member_count.fetch_add(job->members.size(),
+                                     std::memory_order_relaxed);
+            }
+            run(job);
+          });
+    }
+
+    ++j.reactor;
+    const auto &m = j.members[j.member];
+    if (m.id != user || std::ranges::find(m.roles, j.role) != std::end(m.roles))
+      continue;
+    return j.bot.guild_member_add_role(
+        j.guild, user, j.role, [this, job](const ApiResult<> &r) {
+          if (!r.is_error()) {
+            ++job->granted;
+            grant_count.fetch_add(1, std::memory_order_relaxed);
+          } else {
+            failure_count.fetch_add(1, std::memory_order_relaxed);
+            LogError{} << r.get_error().message;
+            const auto code = r.get_error().code;
+            job->aborted = code == api_error_missing_permissions ||
+                           code == api_error_circuit_open;
+          }
+          run(job);
+        });
+  }
+}
+
+void CharteBackfill::finished(const Job &job) {
+  if (!job.guild)
+    return;
+  {
+    std::lock_guard lk{mutex};
+    guilds.erase(job.guild);
+  }
+  LogNotice{} << "Rattrapage de la charte de " << job.guild
+              << (job.aborted ? " interrompu, " : " terminé, ") << job.granted
+              << " rôles donnés";
+}
+
+std::size_t CharteBackfill::running() const {
+  std::lock_guard lk{mutex};
+  return guilds.size();
+}
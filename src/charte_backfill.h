@@ -0,0 +1,76 @@
+#ifndef CHARTE_BACKFILL_H
+#define CHARTE_BACKFILL_H
+
+#include "bot_api.h"
+#include "profiling.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+
+/**
+ * @brief Give the charte role to the members who validated the charte
+ * while the bot did not see it
+ * The users who reacted with the validation emoji and the members of the
+ * guild are both read by pages ordered by id, and merged: the members who
+ * reacted without having the role get it. The grants are sent one at a
+ * time, so the live reactions keep their share of the rate limit. Only a
+ * page of each is kept, whatever the size of the guild
+ */
+class CharteBackfill {
+public:
+  /**
+   * @brief Start the backfill of the guild, with the charte configured now
+   *
+   * @return false if the charte of the guild is not configured, or if its
+   * backfill is already running
+   */
+  bool start(BotApi &bot, Snowflake guild);
+
+  /** The guilds whose backfill is running */
+  [[nodiscard]] std::size_t running() const;
+
+  /** The reactions read since the start */
+  [[nodiscard]] std::uint64_t reactions() const {
+    return reaction_count.load(std::memory_order_relaxed);
+  }
+  /** The members read since the start */
+  [[nodiscard]] std::uint64_t members() const {
+    return member_count.load(std::memory_order_relaxed);
+  }
+  [[nodiscard]] std::uint64_t granted() const {
+    return grant_count.load(std::memory_order_relaxed);
+  }
+  [[nodiscard]] std::uint64_t failed() const {
+    return failure_count.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Job;
+
+  /**
+   * @brief Handle an answer of the job. The answers given before their
+   * call returns are looped on here instead of recursing
+   */
+  void run(const std::shared_ptr<Job> &job);
+  /** Send the next call of the job, if it is not over */
+  void step(const std::shared_ptr<Job> &job);
+  void finished(const Job &job);
+
+  mutable ProfiledMutex mutex{"charte_backfill"};
+  std::unordered_set<Snowflake> guilds;
+
+  std::atomic<std::uint64_t> reaction_count{0};
+  std::atomic<std::uint64_t> member_count{0};
+  std::atomic<std::uint64_t> grant_count{0};
+  std::atomic<std::uint64_t> failure_count{0};
+};
+
+/**
+ * @brief The backfills of the process, started by the handler modules too
+ */
+extern CharteBackfill g_charte_backfill;
+
+#endif // CHARTE_BACKFILL_H
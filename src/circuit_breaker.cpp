@@ -0,0 +1,244 @@
+#include "circuit_breaker.h"
+#include "configuration.h"
+
+#include <algorithm>
+#include <mutex>
+
+CircuitBreaker::CircuitBreaker(Settings s, Clock c, std::uint64_t seed)
+    : settings{s}, clock{c ? std::move(c) : Clock{[] {
+                      return std::chrono::steady_clock::now()
+                          .time_since_epoch();
+                    }}},
+      rng{seed} {}
+
+void CircuitBreaker::open(Circuit &c, std::chrono::nanoseconds now) {
+  auto duration = settings.open;
+  for (std::uint32_t i = 0; i < c.backoff && duration < settings.max_open;
+       ++i)
+    duration *= 2;
+  duration = std::min(duration, settings.max_open);
+  // uniform in [1 - jitter, 1 + jitter] times the duration
+  const double draw = static_cast<double>(rng() >> 11) * 0x1.0p-53;
+  const double factor = 1.0 + settings.jitter * (2.0 * draw - 1.0);
+  c.until = now + std::chrono::nanoseconds{static_cast<std::int64_t>(
+                      static_cast<double>(duration.count()) * factor)};
+  c.retrying = false;
+  c.since = tickets;
+  LogWarning{} << "Circuit ouvert pour "
+               << std::chrono::duration_cast<std::chrono::seconds>(c.until -
+                                                                   now)
+                      .count()
+               << "s";
+}
+
+CircuitBreaker::Admission CircuitBreaker::allow(ApiRoute route,
+                                                Snowflake bucket) {
+  std::lock_guard lk{mutex};
+  auto itr = circuits.find({route, bucket});
+  if (itr == std::end(circuits) || itr->second.failures < settings.failures)
+    return {true, false, tickets++};
+  auto &c = itr->second;
+  // one call at a time checks if the failure is over
+  if (!c.retrying && clock() >= c.until) {
+    c.retrying = true;
+    return {true, true, tickets++};
+  }
+  refused_count.fetch_add(1, std::memory_order_relaxed);
+  return {};
+}
+
+void CircuitBreaker::record(ApiRoute route, Snowflake bucket,
+                            Admission admission, bool failed) {
+  std::lock_guard lk{mutex};
+  if (!failed) {
+    if (!admission.probe) {
+      circuits.erase({route, bucket});
+      return;
+    }
+    // kept until another success, the calls waiting since before it
+    // opened may still fail
+    if (auto itr = circuits.find({route, bucket}); itr != std::end(circuits))
+      itr->second = {.since = tickets};
+    return;
+  }
+  auto &c = circuits[{route, bucket}];
+  if (admission.probe) {
+    ++c.backoff;
+    open(c, clock());
+  } else if (admission.ticket >= c.since &&
+             c.failures < settings.failures &&
+             ++c.failures == settings.failures) {
+    LogWarning{} << "Échecs répétés de " << to_string(route) << " pour "
+                 << bucket;
+    open(c, clock());
+  }
+}
+
+std::size_t CircuitBreaker::open_count() const {
+  std::lock_guard lk{mutex};
+  return std::ranges::count_if(circuits, [this](const auto &c) {
+    return c.second.failures >= settings.failures;
+  });
+}
+
+template <typename T, typename Send>
+void CircuitBreakerBotApi::guarded(ApiRoute route, Snowflake bucket,
+                                   ApiCallback<T> callback, Send &&send) {
+  const auto admission = breaker.allow(route, bucket);
+  if (!admission.allowed) {
+    if (callback)
+      callback(ApiError{api_error_circuit_open, "Circuit ouvert", 0});
+    return;
+  }
+  send([this, route, bucket, admission,
+        callback = std::move(callback)](const ApiResult<T> &r) {
+    // an unknown member or message is not a failure of the route
+    breaker.record(route, bucket, admission,
+                   r.is_error() && guild_failure(r.get_error()));
+    if (callback)
+      callback(r);
+  });
+}
+
+void CircuitBreakerBotApi::channels_get(
+    Snowflake guild, ApiCallback<std::vector<ApiChannel>> callback) {
+  guarded(ApiRoute::channels_get, guild, std::move(callback),
+          [&](auto c) { inner.channels_get(guild, std::move(c)); });
+}
+
+void CircuitBreakerBotApi::roles_get(
+    Snowflake guild, ApiCallback<std::vector<ApiRole>> callback) {
+  guarded(ApiRoute::roles_get, guild, std::move(callback),
+          [&](auto c) { inner.roles_get(guild, std::move(c)); });
+}
+
+void CircuitBreakerBotApi::message_get(Snowflake channel, Snowflake message,
+                                       ApiCallback<ApiMessage> callback) {
+  guarded(ApiRoute::message_get, channel, std::move(callback), [&](auto c) {
+    inner.message_get(channel, message, std::move(c));
+  });
+}
+
+void CircuitBreakerBotApi::message_create(Snowflake guild, Snowflake channel,
+                                          std::string content,
+                                          ApiCallback<> callback) {
+  guarded(ApiRoute::message_create, guild, std::move(callback), [&](auto c) {
+    inner.message_create(guild, channel, std::move(content), std::move(c));
+  });
+}
+
+void CircuitBreakerBotApi::message_create_button(Snowflake guild,
+                                                 Snowflake channel,
+                                                 std::string content,
+                                                 ApiButton button,
+                                                 ApiCallback<> callback) {
+  // the same Discord route as message_create
+  guarded(ApiRoute::message_create, guild, std::move(callback), [&](auto c) {
+    inner.message_create_button(guild, channel, std::move(content),
+                                std::move(button), std::move(c));
+  });
+}
+
+void CircuitBreakerBotApi::guild_member_add_role(Snowflake guild,
+                                                 Snowflake user,
+                                                 Snowflake role,
+                                                 ApiCallback<> callback) {
+  guarded(ApiRoute::guild_member_add_role, guild, std::move(callback),
+          [&](auto c) {
+            inner.guild_member_add_role(guild, user, role, std::move(c));
+          });
+}
+
+void CircuitBreakerBotApi::guild_member_remove_role(Snowflake guild,
+                                                    Snowflake user,
+                                                    Snowflake role,
+                                                    ApiCallback<> callback) {
+  guarded(ApiRoute::guild_member_remove_role, guild, std::move(callback),
+          [&](auto c) {
+            inner.guild_member_remove_role(guild, user, role, std::move(c));
+          });
+}
+
+void CircuitBreakerBotApi::global_commands_get(
+    ApiCallback<std::vector<CommandDefinition>> callback) {
+  inner.global_commands_get(std::move(callback));
+}
+
+void CircuitBreakerBotApi::global_command_delete(Snowflake command,
+                                                 ApiCallback<> callback) {
+  inner.global_command_delete(command, std::move(callback));
+}
+
+void CircuitBreakerBotApi::global_command_create(
+    const CommandDefinition &command, ApiCallback<> callback) {
+  inner.global_command_create(command, std::move(callback));
+}
+
+void CircuitBreakerBotApi::interaction_reply(const Interaction &interaction,
+                                             std::string content,
+                                             ApiCallback<> callback) {
+  inner.interaction_reply(interaction, std::move(content),
+                          std::move(callback));
+}
+
+void CircuitBreakerBotApi::interaction_thinking(
+    const Interaction &interaction, bool ephemeral, ApiCallback<> callback) {
+  inner.interaction_thinking(interaction, ephemeral, std::move(callback));
+}
+
+void CircuitBreakerBotApi::interaction_edit_response(
+    const Interaction &interaction, std::string content,
+    ApiCallback<> callback) {
+  inner.interaction_edit_response(interaction, std::move(content),
+                                  std::move(callback));
+}
+
+void CircuitBreakerBotApi::interaction_autocomplete(
+    const Interaction &interaction, std::vector<CommandChoice> choices,
+    ApiCallback<> callback) {
+  inner.interaction_autocomplete(interaction, std::move(choices),
+                                 std::move(callback));
+}
+
+void CircuitBreakerBotApi::message_reactions_get(
+    Snowflake channel, Snowflake message, std::string emoji, Snowflake after,
+    ApiCallback<std::vector<Snowflake>> callback) {
+  guarded(ApiRoute::message_reactions_get, channel, std::move(callback),
+          [&](auto c) {
+            inner.message_reactions_get(channel, message, std::move(emoji),
+                                        after, std::move(c));
+          });
+}
+
+void CircuitBreakerBotApi::guild_members_get(
+    Snowflake guild, Snowflake after,
+    ApiCallback<std::vector<ApiMember>> callback) {
+  guarded(ApiRoute::guild_members_get, guild, std::move(callback),
+          [&](auto c) { inner.guild_members_get(guild, after, std::move(c)); });
+}
+
+std::chrono::nanoseconds CircuitBreakerBotApi::now() const {
+  return inner.now();
+}
+
+void CircuitBreakerBotApi::after(std::chrono::nanoseconds delay,
+                                 std::function<void()> f) {
+  inner.after(delay, std::move(f));
+}
+
+void CircuitBreakerBotApi::role_find(Snowflake guild, std::string name,
+                                     ApiCallback<ApiRole> callback) {
+  // the inner BotApi may answer from its index, the roles_get circuit
+  // guards its fallback
+  guarded(ApiRoute::roles_get, guild, std::move(callback), [&](auto c) {
+    inner.role_find(guild, std::move(name), std::move(c));
+  });
+}
+
+void CircuitBreakerBotApi::roles_complete(
+    Snowflake guild, std::string prefix, std::size_t limit,
+    ApiCallback<std::vector<ApiRole>> callback) {
+  guarded(ApiRoute::roles_get, guild, std::move(callback), [&](auto c) {
+    inner.roles_complete(guild, std::move(prefix), limit, std::move(c));
+  });
+}
@@ -0,0 +1,188 @@
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include "bot_api.h"
+#include "profiling.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * @brief The failures of each REST route of each guild, to stop calling
+ * the ones failing every time
+ * A circuit opens after consecutive failures. While it is open the calls
+ * are refused, then one call is let through: a success closes it, a
+ * failure opens it again for twice as long. The open durations are
+ * jittered so the circuits opened together don't retry together. Only the
+ * failures of the whole guild count, see guild_failure()
+ */
+class CircuitBreaker {
+public:
+  using Clock = std::function<std::chrono::nanoseconds()>;
+
+  /** How a call was let through, given back to record() */
+  struct Admission {
+    bool allowed{false};
+    /** The one call checking if the failure is over */
+    bool probe{false};
+    /** The order of the call, to tell the ones sent before the circuit
+     * opened or closed */
+    std::uint64_t ticket{0};
+  };
+
+  struct Settings {
+    /** Consecutive failures opening the circuit */
+    std::uint32_t failures{5};
+    /** First open duration, doubled at each failed retry */
+    std::chrono::nanoseconds open{std::chrono::seconds{30}};
+    std::chrono::nanoseconds max_open{std::chrono::minutes{30}};
+    /** Part of the open duration drawn at random, added or removed */
+    double jitter{0.2};
+  };
+
+  /**
+   * @param clock The time, the steady clock if empty
+   * @param seed The seed of the jitter
+   */
+  explicit CircuitBreaker(Settings s, Clock clock = {},
+                          std::uint64_t seed = std::random_device{}());
+  CircuitBreaker() : CircuitBreaker(Settings{}) {}
+
+  /**
+   * @brief Check if a call may be sent, it must be followed by record()
+   * if allowed
+   *
+   * @param bucket The guild, or the channel for the routes without guild
+   */
+  Admission allow(ApiRoute route, Snowflake bucket);
+
+  /**
+   * @brief Record the end of an allowed call
+   *
+   * @param admission What allow() answered for the call, the failures of
+   * the calls sent before the circuit last opened or closed are ignored
+   * @param failed The route failed for the guild, see guild_failure(). An
+   * error of a single member or message counts like a success
+   */
+  void record(ApiRoute route, Snowflake bucket, Admission admission,
+              bool failed);
+
+  /** The circuits open or retrying now */
+  [[nodiscard]] std::size_t open_count() const;
+  /** The calls refused since the start */
+  [[nodiscard]] std::uint64_t refused() const {
+    return refused_count.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Circuit {
+    std::uint32_t failures{0};
+    /** Count of failed retries, the open duration is doubled by each */
+    std::uint32_t backoff{0};
+    std::chrono::nanoseconds until{0};
+    bool retrying{false};
+    /** The ticket of the first call sent after the last change */
+    std::uint64_t since{0};
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const std::pair<ApiRoute, Snowflake> &k) const {
+      return std::hash<Snowflake>{}(k.second) ^
+             static_cast<std::size_t>(k.first);
+    }
+  };
+
+  /** mutex is held */
+  void open(Circuit &c, std::chrono::nanoseconds now);
+
+  const Settings settings;
+  const Clock clock;
+
+  mutable ProfiledMutex mutex{"circuit_breaker"};
+  std::mt19937_64 rng;
+  std::uint64_t tickets{0};
+  /**
+   * Only the circuits with failures, or closed by their probe: a success
+   * of another call erases its circuit
+   */
+  std::unordered_map<std::pair<ApiRoute, Snowflake>, Circuit, KeyHash>
+      circuits;
+  std::atomic<std::uint64_t> refused_count{0};
+};
+
+/**
+ * @brief BotApi refusing the calls of the open circuits of the breaker
+ * The refused calls complete at once with an api_error_circuit_open
+ * error. The commands and interactions are always sent
+ */
+class CircuitBreakerBotApi : public BotApi {
+public:
+  CircuitBreakerBotApi(BotApi &b, CircuitBreaker &c) : inner{b}, breaker{c} {}
+
+  void channels_get(Snowflake guild,
+                    ApiCallback<std::vector<ApiChannel>> callback) override;
+  void roles_get(Snowflake guild,
+                 ApiCallback<std::vector<ApiRole>> callback) override;
+  void message_get(Snowflake channel, Snowflake message,
+                   ApiCallback<ApiMessage> callback) override;
+  void message_create(Snowflake guild, Snowflake channel, std::string content,
+                      ApiCallback<> callback) override;
+  void message_create_button(Snowflake guild, Snowflake channel,
+                             std::string content, ApiButton button,
+                             ApiCallback<> callback) override;
+  void guild_member_add_role(Snowflake guild, Snowflake user, Snowflake role,
+                             ApiCallback<> callback) override;
+  void guild_member_remove_role(Snowflake guild, Snowflake user,
+                                Snowflake role,
+                                ApiCallback<> callback) override;
+
+  void global_commands_get(
+      ApiCallback<std::vector<CommandDefinition>> callback) override;
+  void global_command_delete(Snowflake command,
+                             ApiCallback<> callback) override;
+  void global_command_create(const CommandDefinition &command,
+                             ApiCallback<> callback) override;
+
+  void interaction_reply(const Interaction &interaction, std::string content,
+                         ApiCallback<> callback) override;
+  void interaction_thinking(const Interaction &interaction, bool ephemeral,
+                            ApiCallback<> callback) override;
+  void interaction_edit_response(const Interaction &interaction,
+                                 std::string content,
+                                 ApiCallback<> callback) override;
+  void interaction_autocomplete(const Interaction &interaction,
+                                std::vector<CommandChoice> choices,
+                                ApiCallback<> callback) override;
+
+  void message_reactions_get(
+      Snowflake channel, Snowflake message, std::string emoji, Snowflake after,
+      ApiCallback<std::vector<Snowflake>> callback) override;
+  void guild_members_get(Snowflake guild, Snowflake after,
+                         ApiCallback<std::vector<ApiMember>> callback) override;
+
+  [[nodiscard]] std::chrono::nanoseconds now() const override;
+  void after(std::chrono::nanoseconds delay, std::function<void()> f) override;
+
+  void role_find(Snowflake guild, std::string name,
+                 ApiCallback<ApiRole> callback) override;
+  void roles_complete(Snowflake guild, std::string prefix, std::size_t limit,
+                      ApiCallback<std::vector<ApiRole>> callback) override;
+
+private:
+  /**
+   * @brief Send the call if its circuit is closed, and record its result
+   */
+  template <typename T, typename Send>
+  void guarded(ApiRoute route, Snowflake bucket, ApiCallback<T> callback,
+               Send &&send);
+
+  BotApi &inner;
+  CircuitBreaker &breaker;
+};
+
+#endif // CIRCUIT_BREAKER_H
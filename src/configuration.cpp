@@ -14,32 +14,189 @@ using namespace std;
 
 const Configuration::mapped_type Configuration::noconf{""};
 
+namespace
+{
+// heap bytes of a string, 0 when it is in the small string buffer
+std::size_t string_heap(const std::string &s)
+{
+  return s.capacity() > std::string{}.capacity() ? s.capacity() + 1 : 0;
+}
+
+// a tree node is the value, 3 pointers and the color
+template <typename Map>
+constexpr std::size_t map_node_size{sizeof(typename Map::value_type) + 4 * sizeof(void *)};
+
+// a hash node is the value and the next pointer, plus the bucket array
+template <typename Map>
+std::size_t hash_size(const Map &m)
+{
+  return m.size() * (sizeof(typename Map::value_type) + sizeof(void *)) +
+         m.bucket_count() * sizeof(void *);
+}
+} // namespace
+
+std::size_t ConfigurationSection::memory_usage() const
+{
+  std::size_t bytes{string_heap(name)};
+  for (auto &i : store)
+  {
+    bytes += map_node_size<Storage> + string_heap(i.first) + string_heap(i.second);
+  }
+  return bytes;
+}
+
+std::size_t Configuration::memory_usage() const
+{
+  std::size_t bytes{sizeof(*this) + no_section.memory_usage()};
+  for (auto *store : {&local_store, &global_store})
+  {
+    for (auto &i : *store)
+    {
+      bytes += map_node_size<Storage> + string_heap(i.first) + i.second.memory_usage();
+    }
+  }
+  bytes += hash_size(id_index);
+  if (lazy)
+  {
+    std::lock_guard lk{lazy->mutex};
+    bytes += sizeof(LazySource) + lazy->content.capacity() + hash_size(lazy->pending);
+    for (auto &i : lazy->pending)
+    {
+      bytes += i.second.capacity() * sizeof(LazySource::Range);
+    }
+  }
+  return bytes;
+}
+
 Configuration::Configuration(std::istream &localFile, std::istream &globalFile)
 {
   parse(&no_section, global_store, globalFile);
   parse(&no_section, local_store, localFile);
+  index_ids();
 }
 
 Configuration::Configuration(std::istream &localFile)
 {
   parse(&no_section, local_store, localFile);
+  index_ids();
+}
+
+void Configuration::index_ids()
+{
+  id_index.reserve(local_store.size());
+  for (auto &i : local_store)
+  {
+    id_type id;
+    if (to_id(i.first, id))
+    {
+      id_index.emplace(id, &i.second);
+    }
+  }
 }
 
 void Configuration::serialize(std::ostream &localFile)
 {
+  materialize_all();
   write(local_store, localFile);
 }
 
 void Configuration::serialize(std::ostream &localFile, std::ostream &globalFile)
 {
+  materialize_all();
   write(global_store, globalFile);
   write(local_store, localFile);
 }
 
+void Configuration::index()
+{
+  PROFILE_SCOPE("configuration/index");
+  const std::string_view content{lazy->content};
+  const ConfigurationSection *current_section{nullptr};
+  std::size_t section_start{0};
+  std::size_t pos{0};
+
+  auto close_section = [&](std::size_t end) {
+    if (current_section && end > section_start)
+    {
+      lazy->pending[current_section].emplace_back(section_start, end);
+    }
+  };
+
+  while (pos < content.size())
+  {
+    auto eol = content.find('\n', pos);
+    if (eol == std::string_view::npos)
+    {
+      eol = content.size();
+    }
+    auto line = content.substr(pos, eol - pos);
+    auto first = line.find_first_not_of(" \t\r\f\v");
+    auto last = line.find_last_not_of(" \t\r\f\v");
+
+    if (first != std::string_view::npos && line[first] == '[' && line[last] == ']' && last > first)
+    {
+      close_section(pos);
+      std::string name{line.substr(first + 1, last - first - 1)};
+      auto l = local_store.find(name);
+      if (l == std::end(local_store))
+      {
+        l = add_local(name);
+      }
+      current_section = &l->second;
+      section_start = eol + 1;
+    }
+    else if (!current_section && first != std::string_view::npos)
+    {
+      // keys before the first section are parsed right away
+      std::istringstream stream{std::string{line}};
+      parse(&no_section, local_store, stream);
+    }
+    pos = eol + 1;
+  }
+  close_section(content.size());
+
+  lazy->remaining.store(lazy->pending.size(), std::memory_order_release);
+}
+
+void Configuration::parse_pending(const ConfigurationSection &section) const
+{
+  std::lock_guard lk{lazy->mutex};
+  auto itr = lazy->pending.find(&section);
+  if (itr == std::end(lazy->pending))
+  {
+    return;
+  }
+
+  // the section belongs to local_store, only its content was not parsed yet
+  auto &target = const_cast<ConfigurationSection &>(section);
+  Storage unused;
+  for (auto &[start, end] : itr->second)
+  {
+    std::istringstream stream{lazy->content.substr(start, end - start)};
+    parse(&target, unused, stream);
+  }
+  lazy->pending.erase(itr);
+  lazy->remaining.store(lazy->pending.size(), std::memory_order_release);
+}
+
+void Configuration::materialize_all() const
+{
+  if (!lazy || !lazy->remaining.load(std::memory_order_acquire))
+  {
+    return;
+  }
+
+  for (auto &i : local_store)
+  {
+    parse_pending(i.second);
+  }
+}
+
 void Configuration::parse(ConfigurationSection *no_section,
                                Storage &store,
                                std::istream &stream)
 {
+  PROFILE_SCOPE("configuration/parse");
   auto current_section = no_section;
   while (!stream.eof())
   {
@@ -96,6 +253,7 @@ void Configuration::parse(ConfigurationSection *no_section,
 
 void Configuration::write(const Storage &store, std::ostream &stream)
 {
+  PROFILE_SCOPE("configuration/write");
   for (auto &i : store)
   {
     bool first_line{false};
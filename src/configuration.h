@@ -8,8 +8,13 @@
 #ifndef CONFIGURATION_H
 #define CONFIGURATION_H
 
+#include "event_arena.h"
+#include "profiling.h"
+
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <charconv>
 #include <cstdint>
 #include <filesystem>
 #include <fstream>
@@ -17,10 +22,14 @@
 #include <istream>
 #include <iterator>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 /**
@@ -192,7 +201,8 @@ public:
 
 template <LogLevel L> class Log : public std::ostream, protected LogBase {
 protected:
-  std::basic_stringbuf<std::ostream::char_type> buffer;
+  /** The line is built in the arena of the event being handled */
+  ScratchStringBuf buffer{ScratchAllocator{EventArena::resource()}};
 
   Log(const Log &) = delete;
   Log(Log &&) = delete;
@@ -386,11 +396,27 @@ public:
   ConfigurationSection copy() const { return *this; }
   const std::string getName() const { return name; }
 
+  /**
+   * @brief Estimate the heap memory owned by the section
+   */
+  [[nodiscard]] std::size_t memory_usage() const;
+
   template <typename V, typename T,
             typename = std::enable_if_t<std::is_convertible_v<V, std::string> &&
                                         std::is_arithmetic_v<T>>>
   static bool convert_to_num(const V &value, T &val, T default_value = T{0},
                              int base = 10) {
+    if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+      // plain decimal integers (the snowflakes) do not depend on the locale
+      if (base == 10) {
+        const std::string_view sv{value};
+        auto [ptr, ec] =
+            std::from_chars(sv.data(), sv.data() + sv.size(), val);
+        if (ec == std::errc{} && ptr == sv.data() + sv.size())
+          return false;
+      }
+    }
+
     SwitchCLocale locale_keep;
 
     if constexpr (std::is_same_v<T, bool>) {
@@ -860,6 +886,8 @@ private:
  * @brief Hold a copy of a local and a global configuration file
  * The file is an "ini" file
  * No comments are allowed
+ * A local file can be loaded lazily: only the section names are read, and a
+ * section is parsed the first time it is accessed
  */
 class Configuration {
   using Storage = std::map<std::string, ConfigurationSection>;
@@ -870,9 +898,54 @@ class Configuration {
     }
   };
 
+  /**
+   * @brief Content of a lazily loaded file, with the byte ranges of the
+   * sections not parsed yet
+   */
+  struct LazySource {
+    using Range = std::pair<std::size_t, std::size_t>;
+
+    std::string content;
+    ProfiledMutex mutex{"configuration_lazy"};
+    std::unordered_map<const ConfigurationSection *, std::vector<Range>>
+        pending;
+    std::atomic<std::size_t> remaining{0};
+  };
+
   std::set<const Storage::key_type *, Compare> get_key_list() const;
 
+  void index();
+  void parse_pending(const ConfigurationSection &section) const;
+  void materialize_all() const;
+
+  /**
+   * @brief Parse the section if it was only indexed
+   */
+  void materialize(const ConfigurationSection &section) const {
+    if (lazy && lazy->remaining.load(std::memory_order_acquire))
+      parse_pending(section);
+  }
+
+  template <typename S> S &materialized(S &section) const {
+    materialize(section);
+    return section;
+  }
+
+  /**
+   * @brief Find or create a local section, and index it if named by an id
+   */
+  Storage::iterator add_local(const Storage::key_type &key) {
+    auto itr = local_store.emplace(key, key).first;
+    std::uint64_t id;
+    if (to_id(key, id))
+      id_index.emplace(id, &itr->second);
+    return itr;
+  }
+
+  void index_ids();
+
   ConfigurationSection no_section{""};
+  std::unique_ptr<LazySource> lazy;
 
 public:
   using iterator = Storage::iterator;
@@ -880,8 +953,26 @@ public:
   using size_type = Storage::size_type;
   using key_type = Storage::key_type;
   using mapped_type = Storage::mapped_type;
+  using id_type = std::uint64_t;
   enum class destination { local, global };
 
+  /**
+   * @brief Read a section name written as a decimal id
+   * Only the canonical writing is accepted (no sign, no leading zero), so
+   * the id converts back to the same name
+   *
+   * @param name The section name
+   * @param id Set to the id if the name is one
+   * @return true if the name is an id
+   */
+  [[nodiscard]] static bool to_id(std::string_view name, id_type &id) {
+    if (name.empty() || (name.size() > 1 && name.front() == '0'))
+      return false;
+    auto [ptr, ec] =
+        std::from_chars(name.data(), name.data() + name.size(), id);
+    return ec == std::errc{} && ptr == name.data() + name.size();
+  }
+
   /**
    * @brief empty configuration
    */
@@ -943,6 +1034,25 @@ public:
    */
   [[nodiscard]] std::set<std::string> names() const;
 
+  /**
+   * @brief Get the count of local sections named by an id
+   */
+  [[nodiscard]] size_type id_size() const { return id_index.size(); }
+
+  /**
+   * @brief Call f(id, section) for every local section named by an id
+   */
+  template <typename F> void for_each_id(F &&f) const {
+    for (auto &[id, section] : id_index)
+      f(id, materialized(*section));
+  }
+
+  /**
+   * @brief Estimate the memory used by the configuration: sections, keys,
+   * values, id index and the content of a lazy file
+   */
+  [[nodiscard]] std::size_t memory_usage() const;
+
   /**
    * @brief Access to the given section. Create it if not found
    *
@@ -955,12 +1065,50 @@ public:
     key_type key{std::forward<T>(k)};
     auto local_item = local_store.find(key);
     if (local_item != std::end(local_store))
-      return local_item->second;
+      return materialized(local_item->second);
     auto global_item = global_store.find(key);
     if (global_item != std::end(global_store))
       return global_item->second;
     // create it
-    return local_store.emplace(key, key).first->second;
+    return add_local(key)->second;
+  }
+
+  /**
+   * @brief Access to the section named by the id. Create it if not found
+   * The id is only written in decimal when the section is created
+   *
+   * @param id The id (guild snowflake) to access
+   * @return The section as ConfigurationSection
+   */
+  [[nodiscard]] mapped_type &operator[](id_type id) {
+    auto local_item = id_index.find(id);
+    if (local_item != std::end(id_index))
+      return materialized(*local_item->second);
+    const auto key = std::to_string(id);
+    if (!global_store.empty()) {
+      auto global_item = global_store.find(key);
+      if (global_item != std::end(global_store))
+        return global_item->second;
+    }
+    return add_local(key)->second;
+  }
+
+  /**
+   * @brief Access to the section named by the id
+   *
+   * @param id The id (guild snowflake) to access
+   * @return The section as ConfigurationSection
+   */
+  [[nodiscard]] const mapped_type &operator[](id_type id) const {
+    auto local_item = id_index.find(id);
+    if (local_item != std::end(id_index))
+      return materialized(*local_item->second);
+    if (!global_store.empty()) {
+      auto global_item = global_store.find(std::to_string(id));
+      if (global_item != std::end(global_store))
+        return global_item->second;
+    }
+    return noconf;
   }
 
   /**
@@ -975,7 +1123,7 @@ public:
     key_type key{std::forward<T>(k)};
     auto local_item = local_store.find(key);
     if (local_item != std::end(local_store))
-      return local_item->second;
+      return materialized(local_item->second);
     auto global_item = global_store.find(key);
     if (global_item != std::end(global_store))
       return global_item->second;
@@ -994,7 +1142,7 @@ public:
     key_type key{std::forward<T>(k)};
     auto local_item = local_store.find(key);
     if (local_item != std::end(local_store))
-      return local_item->second;
+      return materialized(local_item->second);
     auto global_item = global_store.find(key);
     if (global_item != std::end(global_store))
       return global_item->second;
@@ -1013,7 +1161,7 @@ public:
     key_type key{std::forward<T>(k)};
     auto local_item = local_store.find(key);
     if (local_item != std::end(local_store))
-      return local_item->second;
+      return materialized(local_item->second);
     auto global_item = global_store.find(key);
     if (global_item != std::end(global_store))
       return global_item->second;
@@ -1031,7 +1179,9 @@ public:
   [[nodiscard]] iterator emplace(T &&k, destination d = destination::local) {
     key_type key{std::forward<T>(k)};
     if (d == destination::local) {
-      return local_store.emplace(key, key).first;
+      auto itr = add_local(key);
+      materialize(itr->second);
+      return itr;
     } else if (d == destination::global) {
       return global_store.emplace(key, key).first;
     }
@@ -1048,8 +1198,10 @@ public:
   [[nodiscard]] iterator find(T &&k) {
     key_type key{std::forward<T>(k)};
     auto local_item = local_store.find(key);
-    if (local_item != std::end(local_store))
+    if (local_item != std::end(local_store)) {
+      materialize(local_item->second);
       return local_item;
+    }
     auto global_item = global_store.find(key);
     if (global_item != std::end(global_store))
       return global_item;
@@ -1067,8 +1219,10 @@ public:
   [[nodiscard]] const_iterator find(T &&k) const {
     key_type key{std::forward<T>(k)};
     auto local_item = local_store.find(key);
-    if (local_item != std::end(local_store))
+    if (local_item != std::end(local_store)) {
+      materialize(local_item->second);
       return local_item;
+    }
     auto global_item = global_store.find(key);
     if (global_item != std::end(global_store))
       return global_item;
@@ -1099,6 +1253,51 @@ public:
     return Configuration{local_stream};
   }
 
+  /**
+   * @brief Index the given content as local configuration, the sections are
+   * parsed on first access
+   *
+   * @param content The content of the file
+   * @return The indexed configuration
+   */
+  [[nodiscard]] static Configuration from_string_lazy(std::string content) {
+    Configuration c;
+    c.lazy = std::make_unique<LazySource>();
+    c.lazy->content = std::move(content);
+    c.index();
+    return c;
+  }
+
+  /**
+   * @brief Helper function to load a file and index it as local configuration
+   *
+   * @param localFile The local file name
+   * @return The indexed file
+   */
+  template <typename T, typename = std::enable_if_t<
+                            std::is_convertible_v<T, std::filesystem::path>>>
+  [[nodiscard]] static Configuration from_file_lazy(T &&localFile,
+                                                    bool *no_file = nullptr) {
+    std::filesystem::path local_file_path{std::forward<T>(localFile)};
+    std::ifstream local_stream{local_file_path, std::ios::binary};
+    if (!local_stream.is_open()) {
+      LogWarning{} << "Unable to open configuration file " << local_file_path;
+      if (no_file)
+        *no_file = true;
+      return Configuration{};
+    }
+    if (no_file)
+      *no_file = false;
+
+    std::string content;
+    local_stream.seekg(0, std::ios::end);
+    content.resize(static_cast<std::size_t>(local_stream.tellg()));
+    local_stream.seekg(0, std::ios::beg);
+    local_stream.read(content.data(),
+                      static_cast<std::streamsize>(content.size()));
+    return from_string_lazy(std::move(content));
+  }
+
   /**
    * @brief Helper function to load two files and parse it as local and global
    * configuration
@@ -1136,6 +1335,7 @@ public:
     if (!local_stream.is_open() || !local_stream.good()) {
       return false;
     }
+    c.materialize_all();
     write(c.local_store, local_stream);
     return true;
   }
@@ -1160,6 +1360,7 @@ public:
       return false;
     }
     write(c.global_store, global_stream);
+    c.materialize_all();
     write(c.local_store, local_stream);
     return true;
   }
@@ -1178,7 +1379,7 @@ public:
                       Args &&...args) const {
     auto local_item = local_store.find(section);
     if (local_item != std::end(local_store))
-      return local_item->second.get<T>(key);
+      return materialized(local_item->second).get<T>(key);
     auto global_item = global_store.find(section);
     if (global_item != std::end(global_store))
       return global_item->second.get<T>(key);
@@ -1200,7 +1401,7 @@ public:
                       Args &&...args) const {
     auto local_item = local_store.find(section);
     if (local_item != std::end(local_store))
-      return local_item->second.get<T>(key, std::forward<Func>(f));
+      return materialized(local_item->second).get<T>(key, std::forward<Func>(f));
     auto global_item = global_store.find(section);
     if (global_item != std::end(global_store))
       return global_item->second.get<T>(key, std::forward<Func>(f));
@@ -1221,7 +1422,7 @@ public:
                       T default_value = T{0}, int base = 10) const {
     auto local_item = local_store.find(section);
     if (local_item != std::end(local_store))
-      return local_item->second.get<T>(key, default_value, base);
+      return materialized(local_item->second).get<T>(key, default_value, base);
     auto global_item = global_store.find(section);
     if (global_item != std::end(global_store))
       return global_item->second.get<T>(key, default_value, base);
@@ -1241,7 +1442,7 @@ public:
                                          const key_type &key) const {
     auto local_item = local_store.find(section);
     if (local_item != std::end(local_store))
-      return local_item->second.getVector<T>(key);
+      return materialized(local_item->second).getVector<T>(key);
     auto global_item = global_store.find(section);
     if (global_item != std::end(global_store))
       return global_item->second.getVector<T>(key);
@@ -1263,7 +1464,7 @@ public:
                                          const key_type &key, Func &&f) const {
     auto local_item = local_store.find(section);
     if (local_item != std::end(local_store))
-      return local_item->second.getVector<T>(key, std::forward<Func>(f));
+      return materialized(local_item->second).getVector<T>(key, std::forward<Func>(f));
     auto global_item = global_store.find(section);
     if (global_item != std::end(global_store))
       return global_item->second.getVector<T>(key, std::forward<Func>(f));
@@ -1284,7 +1485,7 @@ public:
   getVector(const key_type &section, const key_type &key, int base = 10) const {
     auto local_item = local_store.find(section);
     if (local_item != std::end(local_store))
-      return local_item->second.getVector<T>(key, base);
+      return materialized(local_item->second).getVector<T>(key, base);
     auto global_item = global_store.find(section);
     if (global_item != std::end(global_store))
       return global_item->second.getVector<T>(key, base);
@@ -1309,14 +1510,14 @@ public:
     if (d == destination::local) {
       auto s = local_store.find(section);
       if (s == std::end(local_store))
-        s = local_store.emplace(section, section).first;
-      auto &sec = s->second;
+        s = add_local(section);
+      auto &sec = materialized(s->second);
       return sec.set(key, data);
     } else if (d == destination::global) {
       auto s = global_store.find(section);
       if (s == std::end(global_store))
         s = global_store.emplace(section, section).first;
-      auto &sec = s->second;
+      auto &sec = materialized(s->second);
       return sec.set(key, data);
     }
     throw_exception<std::runtime_error>(
@@ -1341,14 +1542,14 @@ public:
     if (d == destination::local) {
       auto s = local_store.find(section);
       if (s == std::end(local_store))
-        s = local_store.emplace(section, section).first;
-      auto &sec = s->second;
+        s = add_local(section);
+      auto &sec = materialized(s->second);
       return sec.set(key, data);
     } else if (d == destination::global) {
       auto s = global_store.find(section);
       if (s == std::end(global_store))
         s = global_store.emplace(section, section).first;
-      auto &sec = s->second;
+      auto &sec = materialized(s->second);
       return sec.set(key, data);
     } else
       throw_exception<std::runtime_error>(
@@ -1373,14 +1574,14 @@ public:
     if (d == destination::local) {
       auto s = local_store.find(section);
       if (s == std::end(local_store))
-        s = local_store.emplace(section, section).first;
-      auto &sec = s->second;
+        s = add_local(section);
+      auto &sec = materialized(s->second);
       return sec.set(key, data);
     } else if (d == destination::global) {
       auto s = global_store.find(section);
       if (s == std::end(global_store))
         s = global_store.emplace(section, section).first;
-      auto &sec = s->second;
+      auto &sec = materialized(s->second);
       return sec.set(key, data);
     } else
       throw_exception<std::runtime_error>(
@@ -1404,14 +1605,14 @@ public:
     if (d == destination::local) {
       auto s = local_store.find(section);
       if (s == std::end(local_store))
-        s = local_store.emplace(section, section).first;
-      auto &sec = s->second;
+        s = add_local(section);
+      auto &sec = materialized(s->second);
       return sec.set(key, data, base);
     } else if (d == destination::global) {
       auto s = global_store.find(section);
       if (s == std::end(global_store))
         s = global_store.emplace(section, section).first;
-      auto &sec = s->second;
+      auto &sec = materialized(s->second);
       return sec.set(key, data, base);
     } else
       throw_exception<std::runtime_error>(
@@ -1435,14 +1636,14 @@ public:
     if (d == destination::local) {
       auto s = local_store.find(section);
       if (s == std::end(local_store))
-        s = local_store.emplace(section, section).first;
-      auto &sec = s->second;
+        s = add_local(section);
+      auto &sec = materialized(s->second);
       return sec.set(key, std::forward<T>(data), base);
     } else if (d == destination::global) {
       auto s = global_store.find(section);
       if (s == std::end(global_store))
         s = global_store.emplace(section, section).first;
-      auto &sec = s->second;
+      auto &sec = materialized(s->second);
       return sec.set(key, std::forward<T>(data), base);
     } else
       throw_exception<std::runtime_error>(
@@ -1467,14 +1668,14 @@ public:
     if (d == destination::local) {
       auto s = local_store.find(section);
       if (s == std::end(local_store))
-        s = local_store.emplace(section, section).first;
-      auto &sec = s->second;
+        s = add_local(section);
+      auto &sec = materialized(s->second);
       return sec.setVector(key, data);
     } else if (d == destination::global) {
       auto s = global_store.find(section);
       if (s == std::end(global_store))
         s = global_store.emplace(section, section).first;
-      auto &sec = s->second;
+      auto &sec = materialized(s->second);
       return sec.setVector(key, data);
     }
     throw_exception<std::runtime_error>(
@@ -1499,14 +1700,14 @@ public:
     if (d == destination::local) {
       auto s = local_store.find(section);
       if (s == std::end(local_store))
-        s = local_store.emplace(section, section).first;
-      auto &sec = s->second;
+        s = add_local(section);
+      auto &sec = materialized(s->second);
       return sec.setVector(key, data);
     } else if (d == destination::global) {
       auto s = global_store.find(section);
       if (s == std::end(global_store))
         s = global_store.emplace(section, section).first;
-      auto &sec = s->second;
+      auto &sec = materialized(s->second);
       return sec.setVector(key, data);
     } else
       throw_exception<std::runtime_error>(
@@ -1531,14 +1732,14 @@ public:
     if (d == destination::local) {
       auto s = local_store.find(section);
       if (s == std::end(local_store))
-        s = local_store.emplace(section, section).first;
-      auto &sec = s->second;
+        s = add_local(section);
+      auto &sec = materialized(s->second);
       return sec.setVector(key, data);
     } else if (d == destination::global) {
       auto s = global_store.find(section);
       if (s == std::end(global_store))
         s = global_store.emplace(section, section).first;
-      auto &sec = s->second;
+      auto &sec = materialized(s->second);
       return sec.setVector(key, data);
     } else
       throw_exception<std::runtime_error>(
@@ -1563,14 +1764,14 @@ public:
     if (d == destination::local) {
       auto s = local_store.find(section);
       if (s == std::end(local_store))
-        s = local_store.emplace(section, section).first;
-      auto &sec = s->second;
+        s = add_local(section);
+      auto &sec = materialized(s->second);
       return sec.setVector(key, data, base);
     } else if (d == destination::global) {
       auto s = global_store.find(section);
       if (s == std::end(global_store))
         s = global_store.emplace(section, section).first;
-      auto &sec = s->second;
+      auto &sec = materialized(s->second);
       return sec.setVector(key, data, base);
     } else
       throw_exception<std::runtime_error>(
@@ -1584,6 +1785,8 @@ protected:
 
   Storage local_store;
   Storage global_store;
+  /** The local sections named by an id, pointing into local_store */
+  std::unordered_map<id_type, ConfigurationSection *> id_index;
   static const mapped_type noconf;
 };
 
@@ -0,0 +1,117 @@
+#include "dispatch_dedupe.h"
+#include "json_scanner.h"
+
+#include <functional>
+#include <mutex>
+#include <string>
+
+namespace {
+
+// boost::hash_combine, on 64 bits
+void mix(std::uint64_t &h, std::uint64_t v) {
+  h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+}
+
+} // namespace
+
+std::optional<std::uint64_t>
+DispatchDeduplicator::fingerprint(Event event, std::string_view raw) {
+  std::uint64_t sequence{0};
+  Snowflake guild_id{0};
+  Snowflake channel_id{0};
+  Snowflake message_id{0};
+  Snowflake user_id{0};
+  Snowflake emoji_id{0};
+  std::string emoji_name;
+
+  auto read_user = [&](std::string_view key, JsonScanner &v) {
+    return key == "id" && v.snowflake(user_id);
+  };
+  auto read_emoji = [&](std::string_view key, JsonScanner &v) {
+    if (key == "id")
+      return v.snowflake(emoji_id);
+    if (key == "name")
+      return v.string(emoji_name);
+    return false;
+  };
+  auto read_member = [&](std::string_view key, JsonScanner &v) {
+    if (key == "guild_id")
+      return v.snowflake(guild_id);
+    switch (event) {
+    case Event::member_remove:
+      return key == "user" && v.object(read_user);
+    case Event::reaction_add:
+    case Event::reaction_remove:
+      if (key == "channel_id")
+        return v.snowflake(channel_id);
+      if (key == "message_id")
+        return v.snowflake(message_id);
+      if (key == "user_id")
+        return v.snowflake(user_id);
+      return key == "emoji" && v.object(read_emoji);
+    }
+    return false;
+  };
+
+  JsonScanner s{raw};
+  s.object([&](std::string_view key, JsonScanner &v) {
+    if (key == "s")
+      return v.integer(sequence);
+    return key == "d" && v.object(read_member);
+  });
+  if (!s.ok() || !sequence)
+    return std::nullopt;
+
+  std::uint64_t h{static_cast<std::uint64_t>(event)};
+  mix(h, sequence);
+  mix(h, guild_id);
+  mix(h, channel_id);
+  mix(h, message_id);
+  mix(h, user_id);
+  mix(h, emoji_id);
+  mix(h, std::hash<std::string>{}(emoji_name));
+  return h;
+}
+
+bool DispatchDeduplicator::replayed(Event event, std::string_view raw) {
+  const auto f = fingerprint(event, raw);
+  std::lock_guard lk{mutex};
+  ++check_count;
+  if (!f)
+    return false;
+  if (!fingerprints.insert(*f).second) {
+    ++hit_count;
+    return true;
+  }
+  if (ring.size() < capacity) {
+    ring.push_back(*f);
+    return false;
+  }
+  fingerprints.erase(ring[next]);
+  ring[next] = *f;
+  next = (next + 1) % capacity;
+  return false;
+}
+
+std::uint64_t DispatchDeduplicator::checks() const {
+  std::lock_guard lk{mutex};
+  return check_count;
+}
+
+std::uint64_t DispatchDeduplicator::hits() const {
+  std::lock_guard lk{mutex};
+  return hit_count;
+}
+
+std::size_t DispatchDeduplicator::size() const {
+  std::lock_guard lk{mutex};
+  return ring.size();
+}
+
+std::size_t DispatchDeduplicator::memory_usage() const {
+  std::lock_guard lk{mutex};
+  // a hash node is the value and the next pointer, plus the bucket array
+  return ring.capacity() * sizeof(std::uint64_t) +
+         fingerprints.size() * (sizeof(std::uint64_t) + sizeof(void *)) +
+         fingerprints.bucket_count() * sizeof(void *);
+}
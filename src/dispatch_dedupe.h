@@ -0,0 +1,68 @@
+#ifndef DISPATCH_DEDUPE_H
+#define DISPATCH_DEDUPE_H
+
+#include "bot_api.h"
+#include "profiling.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief The dispatches already handled, so the ones Discord sends again
+ * after a resumed session don't give a second goodbye or role call
+ * The sessions are only resumed by DPP within the process, a restarted
+ * process identifies and gets no replay, so nothing is kept on disk. A
+ * dispatch is known by its type, its ids and its sequence number: a
+ * replay keeps the sequence number, a member doing the same thing again
+ * gets a new one. The last capacity fingerprints are kept, the oldest one
+ * is forgotten first
+ */
+class DispatchDeduplicator {
+public:
+  enum class Event { member_remove, reaction_add, reaction_remove };
+
+  /**
+   * Far more than the events of a resume. About 800 kB once full: 128 kB
+   * of ring, 512 kB of hash nodes of 32 bytes with the allocator overhead
+   * and 160 kB of buckets
+   */
+  static constexpr std::size_t default_capacity{1 << 14};
+
+  explicit DispatchDeduplicator(std::size_t capacity = default_capacity)
+      : capacity{capacity} {}
+
+  /**
+   * @brief Remember the dispatch, given as the raw payload. A payload
+   * without its sequence number can't be told from a new event, it is
+   * never a replay
+   *
+   * @return true if it was handled already
+   */
+  bool replayed(Event event, std::string_view raw);
+
+  /** The dispatches checked and the replays among them */
+  [[nodiscard]] std::uint64_t checks() const;
+  [[nodiscard]] std::uint64_t hits() const;
+
+  [[nodiscard]] std::size_t size() const;
+  [[nodiscard]] std::size_t memory_usage() const;
+
+private:
+  static std::optional<std::uint64_t> fingerprint(Event event,
+                                                  std::string_view raw);
+
+  const std::size_t capacity;
+  mutable ProfiledMutex mutex{"dispatch_dedupe"};
+  std::unordered_set<std::uint64_t> fingerprints;
+  /** The fingerprints by age, the oldest at next once it is full */
+  std::vector<std::uint64_t> ring;
+  std::size_t next{0};
+  std::uint64_t check_count{0};
+  std::uint64_t hit_count{0};
+};
+
+#endif // DISPATCH_DEDUPE_H
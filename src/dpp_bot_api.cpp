@@ -0,0 +1,429 @@
+#include "dpp_bot_api.h"
+#include "profiling.h"
+
+namespace {
+
+ApiError to_error(const dpp::confirmation_callback_t &ccb) {
+  auto e = ccb.get_error();
+  return {static_cast<int>(e.code), e.message,
+          static_cast<int>(ccb.http_info.status)};
+}
+
+/**
+ * @brief Build the DPP completion calling the BotApi callback with the
+ * converted result. Without callback, the errors are logged like DPP does
+ */
+template <typename T, typename F>
+dpp::command_completion_event_t wrap(ApiCallback<T> callback, F &&convert) {
+  if (!callback)
+    return dpp::utility::log_error();
+  return [callback = std::move(callback), convert = std::forward<F>(convert)](
+             const dpp::confirmation_callback_t &ccb) {
+    PROFILE_SCOPE("rest_callback");
+    if (ccb.is_error())
+      return callback(to_error(ccb));
+    callback(convert(ccb));
+  };
+}
+
+dpp::command_completion_event_t wrap(ApiCallback<> callback) {
+  return wrap(std::move(callback),
+              [](const dpp::confirmation_callback_t &) {
+                return std::monostate{};
+              });
+}
+
+CommandOption to_option(const dpp::command_option &o) {
+  CommandOption res{OptionType::string, o.name, o.description, o.required,
+                    {},                  o.autocomplete};
+  res.choices.reserve(o.choices.size());
+  for (auto &c : o.choices) {
+    auto value = std::get_if<std::string>(&c.value);
+    res.choices.push_back({c.name, value ? *value : std::string{}});
+  }
+  return res;
+}
+
+dpp::command_option to_option(const CommandOption &o) {
+  dpp::command_option res{dpp::co_string, o.name, o.description, o.required};
+  res.set_auto_complete(o.autocomplete);
+  for (auto &c : o.choices)
+    res.add_choice(dpp::command_option_choice{c.name, c.value});
+  return res;
+}
+
+} // namespace
+
+DppBotApi::DppBotApi(dpp::cluster &b, const GuildDirectory *d)
+    : bot{b}, directory{d}, timer_thread{[this] { run_timers(); }} {}
+
+DppBotApi::~DppBotApi() noexcept {
+  {
+    std::lock_guard lk{timers_mutex};
+    timers_stop = true;
+  }
+  timers_wake.notify_all();
+  timer_thread.join();
+}
+
+void DppBotApi::channels_get(Snowflake guild,
+                             ApiCallback<std::vector<ApiChannel>> callback) {
+  if (std::vector<ApiChannel> res;
+      directory && directory->channels(guild, res))
+    return callback(std::move(res));
+  bot.channels_get(guild, wrap(std::move(callback),
+                               [](const dpp::confirmation_callback_t &ccb) {
+                                 const auto &m = ccb.get<dpp::channel_map>();
+                                 std::vector<ApiChannel> res;
+                                 res.reserve(m.size());
+                                 for (auto &i : m)
+                                   res.push_back(
+                                       {i.first,
+                                        i.second.get_type() ==
+                                            dpp::CHANNEL_TEXT,
+                                        i.second.name});
+                                 return res;
+                               }));
+}
+
+void DppBotApi::roles_get(Snowflake guild,
+                          ApiCallback<std::vector<ApiRole>> callback) {
+  if (std::vector<ApiRole> res; directory && directory->roles(guild, res))
+    return callback(std::move(res));
+  bot.roles_get(guild, wrap(std::move(callback),
+                            [](const dpp::confirmation_callback_t &ccb) {
+                              const auto &m = ccb.get<dpp::role_map>();
+                              std::vector<ApiRole> res;
+                              res.reserve(m.size());
+                              for (auto &i : m)
+                                res.push_back({i.first, i.second.name});
+                              return res;
+                            }));
+}
+
+void DppBotApi::role_find(Snowflake guild, std::string name,
+                          ApiCallback<ApiRole> callback) {
+  if (ApiRole res; directory && directory->role(guild, name, res))
+    return callback(std::move(res));
+  BotApi::role_find(guild, std::move(name), std::move(callback));
+}
+
+void DppBotApi::roles_complete(Snowflake guild, std::string prefix,
+                               std::size_t limit,
+                               ApiCallback<std::vector<ApiRole>> callback) {
+  if (std::vector<ApiRole> res;
+      directory && directory->roles_with_prefix(guild, prefix, limit, res))
+    return callback(std::move(res));
+  BotApi::roles_complete(guild, std::move(prefix), limit, std::move(callback));
+}
+
+void DppBotApi::message_get(Snowflake channel, Snowflake message,
+                            ApiCallback<ApiMessage> callback) {
+  bot.message_get(message, channel,
+                  wrap(std::move(callback),
+                       [](const dpp::confirmation_callback_t &ccb) {
+                         const auto &m = ccb.get<dpp::message>();
+                         ApiMessage res{m.id, m.channel_id, {}};
+                         res.reactions.reserve(m.reactions.size());
+                         for (auto &r : m.reactions)
+                           res.reactions.push_back({r.emoji_id, r.emoji_name});
+                         return res;
+                       }));
+}
+
+void DppBotApi::message_create(Snowflake guild, Snowflake channel,
+                               std::string content, ApiCallback<> callback) {
+  // a call bound to fail is not sent, it would use the rate limit
+  if (bool allowed{true};
+      directory && directory->can_send(guild, channel, allowed) && !allowed) {
+    if (callback)
+      callback(ApiError{api_error_missing_permissions,
+                        "Pas la permission d'écrire dans le salon", 403});
+    return;
+  }
+  bot.message_create(
+      dpp::message(content).set_guild_id(guild).set_channel_id(channel),
+      wrap(std::move(callback)));
+}
+
+void DppBotApi::message_create_button(Snowflake guild, Snowflake channel,
+                                      std::string content, ApiButton button,
+                                      ApiCallback<> callback) {
+  if (bool allowed{true};
+      directory && directory->can_send(guild, channel, allowed) && !allowed) {
+    if (callback)
+      callback(ApiError{api_error_missing_permissions,
+                        "Pas la permission d'écrire dans le salon", 403});
+    return;
+  }
+  // a button is in an action row
+  bot.message_create(
+      dpp::message(content)
+          .set_guild_id(guild)
+          .set_channel_id(channel)
+          .add_component(dpp::component().add_component(
+              dpp::component()
+                  .set_type(dpp::cot_button)
+                  .set_style(dpp::cos_primary)
+                  .set_label(button.label)
+                  .set_id(button.custom_id))),
+      wrap(std::move(callback)));
+}
+
+void DppBotApi::guild_member_add_role(Snowflake guild, Snowflake user,
+                                      Snowflake role,
+                                      ApiCallback<> callback) {
+  if (bool allowed{true};
+      directory && directory->can_grant(guild, role, allowed) && !allowed) {
+    if (callback)
+      callback(ApiError{api_error_missing_permissions,
+                        "Pas la permission de donner le rôle", 403});
+    return;
+  }
+  bot.guild_member_add_role(guild, user, role, wrap(std::move(callback)));
+}
+
+void DppBotApi::guild_member_remove_role(Snowflake guild, Snowflake user,
+                                         Snowflake role,
+                                         ApiCallback<> callback) {
+  if (bool allowed{true};
+      directory && directory->can_grant(guild, role, allowed) && !allowed) {
+    if (callback)
+      callback(ApiError{api_error_missing_permissions,
+                        "Pas la permission de retirer le rôle", 403});
+    return;
+  }
+  bot.guild_member_delete_role(guild, user, role, wrap(std::move(callback)));
+}
+
+void DppBotApi::global_commands_get(
+    ApiCallback<std::vector<CommandDefinition>> callback) {
+  bot.global_commands_get(
+      wrap(std::move(callback), [](const dpp::confirmation_callback_t &ccb) {
+        const auto &m = ccb.get<dpp::slashcommand_map>();
+        std::vector<CommandDefinition> res;
+        res.reserve(m.size());
+        for (auto &i : m) {
+          CommandDefinition c{i.first, i.second.name, i.second.description,
+                              static_cast<std::uint64_t>(
+                                  i.second.default_member_permissions),
+                              {}};
+          c.options.reserve(i.second.options.size());
+          for (auto &o : i.second.options)
+            c.options.push_back(to_option(o));
+          res.push_back(std::move(c));
+        }
+        return res;
+      }));
+}
+
+void DppBotApi::global_command_delete(Snowflake command,
+                                      ApiCallback<> callback) {
+  bot.global_command_delete(command, wrap(std::move(callback)));
+}
+
+void DppBotApi::global_command_create(const CommandDefinition &command,
+                                      ApiCallback<> callback) {
+  auto c = dpp::slashcommand{command.name, command.description, bot.me.id};
+  c.set_default_permissions(command.permissions);
+  for (const auto &o : command.options)
+    c.add_option(to_option(o));
+  bot.global_command_create(c, wrap(std::move(callback)));
+}
+
+void DppBotApi::interaction_reply(const Interaction &interaction,
+                                  std::string content,
+                                  ApiCallback<> callback) {
+  bot.interaction_response_create(
+      interaction.id, interaction.token,
+      dpp::interaction_response(dpp::ir_channel_message_with_source,
+                                dpp::message(content)),
+      wrap(std::move(callback)));
+}
+
+void DppBotApi::interaction_thinking(const Interaction &interaction,
+                                     bool ephemeral, ApiCallback<> callback) {
+  auto msg = dpp::message("*")
+                 .set_guild_id(interaction.guild_id)
+                 .set_channel_id(interaction.channel_id);
+  if (ephemeral)
+    msg.set_flags(dpp::m_ephemeral);
+  bot.interaction_response_create(
+      interaction.id, interaction.token,
+      dpp::interaction_response(dpp::ir_deferred_channel_message_with_source,
+                                msg),
+      wrap(std::move(callback)));
+}
+
+void DppBotApi::interaction_edit_response(const Interaction &interaction,
+                                          std::string content,
+                                          ApiCallback<> callback) {
+  bot.interaction_response_edit(interaction.token, dpp::message(content),
+                                wrap(std::move(callback)));
+}
+
+void DppBotApi::interaction_autocomplete(const Interaction &interaction,
+                                         std::vector<CommandChoice> choices,
+                                         ApiCallback<> callback) {
+  dpp::interaction_response r{dpp::ir_autocomplete_reply};
+  for (auto &c : choices)
+    r.add_autocomplete_choice(dpp::command_option_choice{c.name, c.value});
+  bot.interaction_response_create(interaction.id, interaction.token, r,
+                                  wrap(std::move(callback)));
+}
+
+void DppBotApi::message_reactions_get(
+    Snowflake channel, Snowflake message, std::string emoji, Snowflake after,
+    ApiCallback<std::vector<Snowflake>> callback) {
+  bot.message_get_reactions(
+      message, channel, emoji, 0, after, reactions_page_size,
+      wrap(std::move(callback), [](const dpp::confirmation_callback_t &ccb) {
+        const auto &m = ccb.get<dpp::user_map>();
+        std::vector<Snowflake> res;
+        res.reserve(m.size());
+        for (auto &i : m)
+          res.push_back(i.first);
+        // the map is not ordered, the pages are
+        std::ranges::sort(res);
+        return res;
+      }));
+}
+
+void DppBotApi::guild_members_get(
+    Snowflake guild, Snowflake after,
+    ApiCallback<std::vector<ApiMember>> callback) {
+  bot.guild_get_members(
+      guild, members_page_size, after,
+      wrap(std::move(callback), [](const dpp::confirmation_callback_t &ccb) {
+        const auto &m = ccb.get<dpp::guild_member_map>();
+        std::vector<ApiMember> res;
+        res.reserve(m.size());
+        for (auto &i : m) {
+          const auto &roles = i.second.get_roles();
+          res.push_back({i.first, {std::begin(roles), std::end(roles)}});
+        }
+        std::ranges::sort(res, {}, &ApiMember::id);
+        return res;
+      }));
+}
+
+std::chrono::nanoseconds DppBotApi::now() const {
+  return std::chrono::steady_clock::now().time_since_epoch();
+}
+
+void DppBotApi::after(std::chrono::nanoseconds delay,
+                      std::function<void()> f) {
+  bool first{false};
+  {
+    std::lock_guard lk{timers_mutex};
+    first = timers.emplace(now() + delay, std::move(f)) == std::begin(timers);
+  }
+  // the thread waits for the first deadline, only an earlier one changes it
+  if (first)
+    timers_wake.notify_one();
+}
+
+void DppBotApi::run_timers() {
+  std::unique_lock lk{timers_mutex};
+  while (!timers_stop) {
+    if (timers.empty()) {
+      timers_wake.wait(lk);
+      continue;
+    }
+    const auto deadline = timers.begin()->first;
+    if (now() < deadline) {
+      timers_wake.wait_until(
+          lk, std::chrono::steady_clock::time_point{
+                  std::chrono::duration_cast<
+                      std::chrono::steady_clock::duration>(deadline)});
+      continue;
+    }
+    auto f = std::move(timers.begin()->second);
+    timers.erase(timers.begin());
+    lk.unlock();
+    {
+      PROFILE_SCOPE("timer");
+      f();
+      // a callback of a module may release it, not while holding the lock
+      f = nullptr;
+    }
+    lk.lock();
+  }
+}
+
+Interaction to_interaction(const dpp::slashcommand_t &event) {
+  const auto &user = event.command.get_issuing_user();
+  Interaction res{event.command.id,
+                  event.command.token,
+                  event.command.guild_id,
+                  event.command.channel_id,
+                  user.id,
+                  user.username,
+                  event.command.get_command_name(),
+                  {},
+                  {}};
+  auto cmd = event.command.get_command_interaction();
+  for (auto &o : cmd.options) {
+    if (auto s = std::get_if<std::string>(&o.value))
+      res.parameters.emplace(o.name, *s);
+  }
+  return res;
+}
+
+Interaction to_interaction(const dpp::button_click_t &event) {
+  const auto &user = event.command.get_issuing_user();
+  return {event.command.id,
+          event.command.token,
+          event.command.guild_id,
+          event.command.channel_id,
+          user.id,
+          user.username,
+          event.custom_id,
+          {},
+          {}};
+}
+
+Interaction to_interaction(const dpp::autocomplete_t &event) {
+  const auto &user = event.command.get_issuing_user();
+  Interaction res{event.command.id,
+                  event.command.token,
+                  event.command.guild_id,
+                  event.command.channel_id,
+                  user.id,
+                  user.username,
+                  event.name,
+                  {},
+                  {}};
+  for (auto &o : event.options) {
+    if (auto s = std::get_if<std::string>(&o.value))
+      res.parameters.emplace(o.name, *s);
+    if (o.focused)
+      res.focused = o.name;
+  }
+  return res;
+}
+
+MemberRemoveEvent to_event(const dpp::guild_member_remove_t &event) {
+  return {event.guild_id, event.removed.id, event.removed.username};
+}
+
+ReactionAddEvent to_event(const dpp::message_reaction_add_t &event) {
+  return {event.reacting_guild ? Snowflake{event.reacting_guild->id}
+                               : Snowflake{0},
+          event.channel_id,
+          event.message_id,
+          event.reacting_user.id,
+          event.reacting_user.username,
+          event.reacting_emoji.id,
+          event.reacting_emoji.name};
+}
+
+ReactionRemoveEvent to_event(const dpp::message_reaction_remove_t &event) {
+  return {event.reacting_guild ? Snowflake{event.reacting_guild->id}
+                               : Snowflake{0},
+          event.channel_id,
+          event.message_id,
+          event.reacting_user_id,
+          event.reacting_emoji.id,
+          event.reacting_emoji.name};
+}
@@ -0,0 +1,109 @@
+#ifndef DPP_BOT_API_H
+#define DPP_BOT_API_H
+
+#include "bot_api.h"
+#include "guild_directory.h"
+
+#include <dpp/dpp.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief BotApi doing the calls with a DPP cluster
+ * The channels and roles of the guilds in the directory are answered
+ * without a REST call, and the messages and role grants the directory
+ * knows the bot is not allowed to do fail without one
+ */
+class DppBotApi : public BotApi {
+  dpp::cluster &bot;
+  const GuildDirectory *directory;
+
+public:
+  explicit DppBotApi(dpp::cluster &b, const GuildDirectory *d = nullptr);
+  ~DppBotApi() noexcept override;
+
+  void channels_get(Snowflake guild,
+                    ApiCallback<std::vector<ApiChannel>> callback) override;
+  void roles_get(Snowflake guild,
+                 ApiCallback<std::vector<ApiRole>> callback) override;
+  void message_get(Snowflake channel, Snowflake message,
+                   ApiCallback<ApiMessage> callback) override;
+  void message_create(Snowflake guild, Snowflake channel, std::string content,
+                      ApiCallback<> callback) override;
+  void message_create_button(Snowflake guild, Snowflake channel,
+                             std::string content, ApiButton button,
+                             ApiCallback<> callback) override;
+  void guild_member_add_role(Snowflake guild, Snowflake user, Snowflake role,
+                             ApiCallback<> callback) override;
+  void guild_member_remove_role(Snowflake guild, Snowflake user,
+                                Snowflake role,
+                                ApiCallback<> callback) override;
+
+  void global_commands_get(
+      ApiCallback<std::vector<CommandDefinition>> callback) override;
+  void global_command_delete(Snowflake command,
+                             ApiCallback<> callback) override;
+  void global_command_create(const CommandDefinition &command,
+                             ApiCallback<> callback) override;
+
+  void interaction_reply(const Interaction &interaction, std::string content,
+                         ApiCallback<> callback) override;
+  void interaction_thinking(const Interaction &interaction, bool ephemeral,
+                            ApiCallback<> callback) override;
+  void interaction_edit_response(const Interaction &interaction,
+                                 std::string content,
+                                 ApiCallback<> callback) override;
+  void interaction_autocomplete(const Interaction &interaction,
+                                std::vector<CommandChoice> choices,
+                                ApiCallback<> callback) override;
+
+  void message_reactions_get(
+      Snowflake channel, Snowflake message, std::string emoji, Snowflake after,
+      ApiCallback<std::vector<Snowflake>> callback) override;
+  void guild_members_get(Snowflake guild, Snowflake after,
+                         ApiCallback<std::vector<ApiMember>> callback) override;
+
+  [[nodiscard]] std::chrono::nanoseconds now() const override;
+  /**
+   * @brief Call f on the steady clock, from the thread of the timers
+   * The DPP timers tick in whole seconds, so the api waits for its
+   * deadlines itself: f is late by the wake up time of the thread, well
+   * under a millisecond. The callbacks run one at a time, in the order of
+   * their deadlines, they must not block
+   */
+  void after(std::chrono::nanoseconds delay, std::function<void()> f) override;
+
+  void role_find(Snowflake guild, std::string name,
+                 ApiCallback<ApiRole> callback) override;
+  void roles_complete(Snowflake guild, std::string prefix, std::size_t limit,
+                      ApiCallback<std::vector<ApiRole>> callback) override;
+
+private:
+  /**
+   * @brief Call the callbacks of after() once due, until the api is
+   * destroyed
+   */
+  void run_timers();
+
+  std::mutex timers_mutex;
+  std::condition_variable timers_wake;
+  /** The callbacks of after() by deadline, in the order given for one */
+  std::multimap<std::chrono::nanoseconds, std::function<void()>> timers;
+  bool timers_stop{false};
+  std::thread timer_thread;
+};
+
+Interaction to_interaction(const dpp::slashcommand_t &event);
+Interaction to_interaction(const dpp::autocomplete_t &event);
+/** The command of the interaction is the custom id of the button */
+Interaction to_interaction(const dpp::button_click_t &event);
+MemberRemoveEvent to_event(const dpp::guild_member_remove_t &event);
+ReactionAddEvent to_event(const dpp::message_reaction_add_t &event);
+ReactionRemoveEvent to_event(const dpp::message_reaction_remove_t &event);
+
+#endif // DPP_BOT_API_H
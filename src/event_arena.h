@@ -0,0 +1,120 @@
+#ifndef EVENT_ARENA_H
+#define EVENT_ARENA_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+#include <sstream>
+#include <string>
+
+/**
+ * @brief Scratch memory of the event handled by the current thread
+ * Inside an EventScope the short lived objects (log lines, message
+ * builders, parsed parameters) are taken from a monotonic arena, released
+ * in one go when the outermost scope ends. Outside of a scope the default
+ * resource is used, so nothing allocated there may outlive the event
+ */
+class EventArena {
+public:
+  static constexpr std::size_t initial_size{16 * 1024};
+
+  /**
+   * @brief The resource to use for the scratch objects of the event
+   */
+  [[nodiscard]] static std::pmr::memory_resource *resource() {
+    auto &a = current();
+    return a.depth ? &a.arena : std::pmr::get_default_resource();
+  }
+
+  /**
+   * @brief Bytes held by the arenas of every thread, initial buffers
+   * included
+   */
+  [[nodiscard]] static std::size_t memory_usage() {
+    return held().load(std::memory_order_relaxed);
+  }
+
+private:
+  friend class EventScope;
+
+  /**
+   * @brief Count the blocks the arenas take from the default resource
+   */
+  class Upstream : public std::pmr::memory_resource {
+    void *do_allocate(std::size_t bytes, std::size_t align) override {
+      auto p = std::pmr::get_default_resource()->allocate(bytes, align);
+      held().fetch_add(bytes, std::memory_order_relaxed);
+      return p;
+    }
+    void do_deallocate(void *p, std::size_t bytes,
+                       std::size_t align) override {
+      held().fetch_sub(bytes, std::memory_order_relaxed);
+      std::pmr::get_default_resource()->deallocate(p, bytes, align);
+    }
+    bool do_is_equal(const memory_resource &other) const noexcept override {
+      return this == &other;
+    }
+  };
+
+  EventArena() { held().fetch_add(initial_size, std::memory_order_relaxed); }
+  ~EventArena() { held().fetch_sub(initial_size, std::memory_order_relaxed); }
+  EventArena(const EventArena &) = delete;
+  EventArena &operator=(const EventArena &) = delete;
+
+  static std::atomic<std::size_t> &held() {
+    static std::atomic<std::size_t> bytes{0};
+    return bytes;
+  }
+
+  static EventArena &current() {
+    thread_local EventArena a;
+    return a;
+  }
+
+  alignas(std::max_align_t) std::array<std::byte, initial_size> buffer;
+  Upstream upstream;
+  std::pmr::monotonic_buffer_resource arena{buffer.data(), buffer.size(),
+                                            &upstream};
+  unsigned depth{0};
+};
+
+/**
+ * @brief Mark the handling of one event, the nested scopes share the arena
+ * of the outermost one
+ */
+class EventScope {
+public:
+  EventScope() { ++EventArena::current().depth; }
+  ~EventScope() {
+    auto &a = EventArena::current();
+    if (!--a.depth)
+      a.arena.release();
+  }
+  EventScope(const EventScope &) = delete;
+  EventScope &operator=(const EventScope &) = delete;
+};
+
+using ScratchAllocator = std::pmr::polymorphic_allocator<char>;
+using ScratchStringBuf =
+    std::basic_stringbuf<char, std::char_traits<char>, ScratchAllocator>;
+
+/**
+ * @brief ostringstream growing in the arena of the event
+ */
+class ScratchStream
+    : public std::basic_ostringstream<char, std::char_traits<char>,
+                                      ScratchAllocator> {
+public:
+  ScratchStream()
+      : std::basic_ostringstream<char, std::char_traits<char>,
+                                 ScratchAllocator>{
+            std::ios_base::out, ScratchAllocator{EventArena::resource()}} {}
+
+  /**
+   * @brief Copy the content out of the arena
+   */
+  [[nodiscard]] std::string str() const { return std::string{view()}; }
+};
+
+#endif // EVENT_ARENA_H
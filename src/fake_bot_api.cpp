@@ -0,0 +1,228 @@
+#include "fake_bot_api.h"
+
+#include <algorithm>
+
+namespace {
+
+ApiError not_found() { return {404, "Unknown", 404}; }
+
+ApiError unknown_role() { return {discord_unknown_role, "Unknown Role", 404}; }
+
+ApiError server_error(int status) {
+  return {0, "Internal Server Error", status};
+}
+
+} // namespace
+
+std::size_t FakeBotApi::advance(std::chrono::nanoseconds d) {
+  auto target = clock + d;
+  std::size_t count{0};
+  while (!queue.empty() && queue.begin()->first.first <= target) {
+    auto node = queue.extract(queue.begin());
+    clock = node.key().first;
+    node.mapped()();
+    ++count;
+  }
+  clock = target;
+  return count;
+}
+
+std::size_t FakeBotApi::run() {
+  std::size_t count{0};
+  while (!queue.empty()) {
+    auto node = queue.extract(queue.begin());
+    clock = node.key().first;
+    node.mapped()();
+    ++count;
+  }
+  return count;
+}
+
+void FakeBotApi::channels_get(Snowflake guild,
+                              ApiCallback<std::vector<ApiChannel>> callback) {
+  auto g = guilds.find(guild);
+  if (g == std::end(guilds))
+    return complete<std::vector<ApiChannel>>(ApiRoute::channels_get, guild,
+                                             std::move(callback), not_found());
+  complete<std::vector<ApiChannel>>(ApiRoute::channels_get, guild,
+                                    std::move(callback), g->second.channels);
+}
+
+void FakeBotApi::roles_get(Snowflake guild,
+                           ApiCallback<std::vector<ApiRole>> callback) {
+  auto g = guilds.find(guild);
+  if (g == std::end(guilds))
+    return complete<std::vector<ApiRole>>(ApiRoute::roles_get, guild,
+                                          std::move(callback), not_found());
+  complete<std::vector<ApiRole>>(ApiRoute::roles_get, guild,
+                                 std::move(callback), g->second.roles);
+}
+
+void FakeBotApi::message_get(Snowflake channel, Snowflake message,
+                             ApiCallback<ApiMessage> callback) {
+  for (auto &g : guilds) {
+    auto m = g.second.messages.find(message);
+    if (m != std::end(g.second.messages) && m->second.channel_id == channel)
+      return complete<ApiMessage>(ApiRoute::message_get, channel,
+                                  std::move(callback), m->second);
+  }
+  complete<ApiMessage>(ApiRoute::message_get, channel, std::move(callback),
+                       not_found());
+}
+
+void FakeBotApi::message_create(Snowflake, Snowflake channel,
+                                std::string content, ApiCallback<> callback) {
+  if (failing_channels.contains(channel))
+    return complete<>(ApiRoute::message_create, channel, std::move(callback),
+                      ApiError{discord_missing_access, "Missing Access", 403});
+  last_sent = std::move(content);
+  complete<>(ApiRoute::message_create, channel, std::move(callback),
+             std::monostate{});
+}
+
+void FakeBotApi::message_create_button(Snowflake guild, Snowflake channel,
+                                       std::string content, ApiButton,
+                                       ApiCallback<> callback) {
+  message_create(guild, channel, std::move(content), std::move(callback));
+}
+
+void FakeBotApi::guild_member_add_role(Snowflake guild, Snowflake user,
+                                       Snowflake role,
+                                       ApiCallback<> callback) {
+  if (auto f = failing_roles.find(guild); f != std::end(failing_roles))
+    return complete<>(ApiRoute::guild_member_add_role, guild,
+                      std::move(callback), server_error(f->second));
+  auto g = guilds.find(guild);
+  if (g == std::end(guilds) ||
+      std::ranges::find(g->second.roles, role, &ApiRole::id) ==
+          std::end(g->second.roles))
+    return complete<>(ApiRoute::guild_member_add_role, guild,
+                      std::move(callback), unknown_role());
+  member_roles.insert({guild, user, role});
+  complete<>(ApiRoute::guild_member_add_role, guild, std::move(callback),
+             std::monostate{});
+}
+
+void FakeBotApi::message_reactions_get(
+    Snowflake channel, Snowflake message, std::string emoji, Snowflake after,
+    ApiCallback<std::vector<Snowflake>> callback) {
+  for (auto &g : guilds) {
+    auto m = g.second.messages.find(message);
+    if (m == std::end(g.second.messages) || m->second.channel_id != channel)
+      continue;
+    std::vector<Snowflake> res;
+    auto r = g.second.reactors.find({message, emoji});
+    if (r != std::end(g.second.reactors))
+      for (auto i = r->second.upper_bound(after);
+           i != std::end(r->second) && res.size() < reactions_page_size; ++i)
+        res.push_back(*i);
+    return complete<std::vector<Snowflake>>(ApiRoute::message_reactions_get,
+                                            channel, std::move(callback),
+                                            std::move(res));
+  }
+  complete<std::vector<Snowflake>>(ApiRoute::message_reactions_get, channel,
+                                   std::move(callback), not_found());
+}
+
+void FakeBotApi::guild_members_get(
+    Snowflake guild, Snowflake after,
+    ApiCallback<std::vector<ApiMember>> callback) {
+  auto g = guilds.find(guild);
+  if (g == std::end(guilds))
+    return complete<std::vector<ApiMember>>(ApiRoute::guild_members_get, guild,
+                                            std::move(callback), not_found());
+  std::vector<ApiMember> res;
+  auto &members = g->second.members;
+  for (auto i = members.upper_bound(after);
+       i != std::end(members) && res.size() < members_page_size; ++i) {
+    ApiMember m{*i, {}};
+    for (auto r = member_roles.lower_bound({guild, *i, 0});
+         r != std::end(member_roles) && std::get<0>(*r) == guild &&
+         std::get<1>(*r) == *i;
+         ++r)
+      m.roles.push_back(std::get<2>(*r));
+    res.push_back(std::move(m));
+  }
+  complete<std::vector<ApiMember>>(ApiRoute::guild_members_get, guild,
+                                   std::move(callback), std::move(res));
+}
+
+void FakeBotApi::guild_member_remove_role(Snowflake guild, Snowflake user,
+                                          Snowflake role,
+                                          ApiCallback<> callback) {
+  if (auto f = failing_roles.find(guild); f != std::end(failing_roles))
+    return complete<>(ApiRoute::guild_member_remove_role, guild,
+                      std::move(callback), server_error(f->second));
+  member_roles.erase({guild, user, role});
+  complete<>(ApiRoute::guild_member_remove_role, guild, std::move(callback),
+             std::monostate{});
+}
+
+void FakeBotApi::after(std::chrono::nanoseconds delay,
+                       std::function<void()> f) {
+  queue.emplace(std::pair{clock + delay, sequence++}, std::move(f));
+}
+
+void FakeBotApi::global_commands_get(
+    ApiCallback<std::vector<CommandDefinition>> callback) {
+  std::vector<CommandDefinition> res;
+  res.reserve(commands.size());
+  for (auto &i : commands)
+    res.push_back(i.second);
+  complete<std::vector<CommandDefinition>>(
+      ApiRoute::global_commands_get, 0, std::move(callback), std::move(res));
+}
+
+void FakeBotApi::global_command_delete(Snowflake command,
+                                       ApiCallback<> callback) {
+  if (!commands.erase(command))
+    return complete<>(ApiRoute::global_command_delete, 0, std::move(callback),
+                      not_found());
+  complete<>(ApiRoute::global_command_delete, 0, std::move(callback),
+             std::monostate{});
+}
+
+void FakeBotApi::global_command_create(const CommandDefinition &command,
+                                       ApiCallback<> callback) {
+  auto id = next_id++;
+  auto &c = commands[id] = command;
+  c.id = id;
+  complete<>(ApiRoute::global_command_create, 0, std::move(callback),
+             std::monostate{});
+}
+
+void FakeBotApi::interaction_reply(const Interaction &interaction,
+                                   std::string content,
+                                   ApiCallback<> callback) {
+  ++interaction_responses[interaction.id];
+  last_sent = std::move(content);
+  complete<>(ApiRoute::interaction_reply, interaction.id,
+             std::move(callback),
+             std::monostate{});
+}
+
+void FakeBotApi::interaction_thinking(const Interaction &interaction, bool,
+                                      ApiCallback<> callback) {
+  ++interaction_responses[interaction.id];
+  complete<>(ApiRoute::interaction_thinking, interaction.id,
+             std::move(callback),
+             std::monostate{});
+}
+
+void FakeBotApi::interaction_edit_response(const Interaction &interaction,
+                                           std::string content,
+                                           ApiCallback<> callback) {
+  last_sent = std::move(content);
+  complete<>(ApiRoute::interaction_edit_response, interaction.id,
+             std::move(callback),
+             std::monostate{});
+}
+
+void FakeBotApi::interaction_autocomplete(const Interaction &interaction,
+                                          std::vector<CommandChoice> choices,
+                                          ApiCallback<> callback) {
+  ++interaction_responses[interaction.id];
+  last_completion = std::move(choices);
+  complete<>(ApiRoute::interaction_autocomplete, interaction.id,
+             std::move(callback), std::monostate{});
+}
@@ -0,0 +1,217 @@
+#ifndef FAKE_BOT_API_H
+#define FAKE_BOT_API_H
+
+#include "bot_api.h"
+
+#include <array>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+
+/**
+ * @brief In memory BotApi, used to run the handlers without Discord
+ * The calls are completed either before returning, or when the simulated
+ * clock reach the end of the latency
+ */
+class FakeBotApi : public BotApi {
+public:
+  enum class Completion { immediate, clock };
+
+  struct Guild {
+    std::vector<ApiChannel> channels;
+    std::vector<ApiRole> roles;
+    std::map<Snowflake, ApiMessage> messages;
+    std::set<Snowflake> members;
+    /** The users who reacted, by message and emoji name */
+    std::map<std::pair<Snowflake, std::string>, std::set<Snowflake>> reactors;
+  };
+
+  /**
+   * @brief Decide when the calls complete in clock mode
+   */
+  class Scheduler {
+  public:
+    virtual ~Scheduler() noexcept = default;
+
+    /**
+     * @brief Called for every call made in clock mode
+     *
+     * @param route The REST route called
+     * @param bucket The major parameter of the route (guild or channel)
+     * @param now The simulated time of the call
+     * @return the completion time and the key ordering the calls completing
+     * at the same time
+     */
+    virtual std::pair<std::chrono::nanoseconds, std::uint64_t>
+    schedule(ApiRoute route, Snowflake bucket, std::chrono::nanoseconds now) = 0;
+  };
+
+  explicit FakeBotApi(Completion mode = Completion::immediate)
+      : completion{mode} {}
+
+  /**
+   * @brief Use the scheduler instead of the fixed latency in clock mode
+   */
+  void set_scheduler(Scheduler *s) { scheduler = s; }
+
+  /**
+   * @brief Access to the guild data, create it if not found
+   */
+  Guild &guild(Snowflake id) { return guilds[id]; }
+
+  /**
+   * @brief Make every message sent in the channel fail
+   */
+  void fail_channel(Snowflake channel) { failing_channels.insert(channel); }
+
+  /**
+   * @brief Make the role grants and removals of the guild fail with the
+   * HTTP status, like Discord down, or work again with 0
+   */
+  void fail_roles(Snowflake guild, int status) {
+    if (status)
+      failing_roles[guild] = status;
+    else
+      failing_roles.erase(guild);
+  }
+
+  /**
+   * @brief Set the time taken by every call in clock mode
+   */
+  void set_latency(std::chrono::nanoseconds l) { latency = l; }
+
+  [[nodiscard]] std::chrono::nanoseconds now() const override {
+    return clock;
+  }
+
+  /**
+   * @brief Queue f at the simulated time, even in immediate mode
+   */
+  void after(std::chrono::nanoseconds delay, std::function<void()> f) override;
+
+  /**
+   * @brief Move the simulated clock and complete the calls due
+   *
+   * @return the count of completed calls
+   */
+  std::size_t advance(std::chrono::nanoseconds d);
+
+  /**
+   * @brief Complete every pending call, including the ones made by the
+   * callbacks
+   *
+   * @return the count of completed calls
+   */
+  std::size_t run();
+
+  [[nodiscard]] std::size_t pending() const { return queue.size(); }
+
+  [[nodiscard]] std::uint64_t calls(ApiRoute r) const {
+    return call_count[static_cast<std::size_t>(r)];
+  }
+
+  /**
+   * @brief Count of initial responses (reply or thinking) done for the
+   * interaction, more than one is an error on Discord
+   */
+  [[nodiscard]] std::uint32_t responses(Snowflake interaction) const {
+    auto itr = interaction_responses.find(interaction);
+    return itr == std::end(interaction_responses) ? 0 : itr->second;
+  }
+
+  [[nodiscard]] bool has_role(Snowflake guild, Snowflake user,
+                              Snowflake role) const {
+    return member_roles.contains({guild, user, role});
+  }
+
+  [[nodiscard]] const std::string &last_message() const { return last_sent; }
+
+  [[nodiscard]] const std::vector<CommandChoice> &last_choices() const {
+    return last_completion;
+  }
+
+  void channels_get(Snowflake guild,
+                    ApiCallback<std::vector<ApiChannel>> callback) override;
+  void roles_get(Snowflake guild,
+                 ApiCallback<std::vector<ApiRole>> callback) override;
+  void message_get(Snowflake channel, Snowflake message,
+                   ApiCallback<ApiMessage> callback) override;
+  void message_create(Snowflake guild, Snowflake channel, std::string content,
+                      ApiCallback<> callback) override;
+  void message_create_button(Snowflake guild, Snowflake channel,
+                             std::string content, ApiButton button,
+                             ApiCallback<> callback) override;
+  void guild_member_add_role(Snowflake guild, Snowflake user, Snowflake role,
+                             ApiCallback<> callback) override;
+  void guild_member_remove_role(Snowflake guild, Snowflake user,
+                                Snowflake role,
+                                ApiCallback<> callback) override;
+
+  void global_commands_get(
+      ApiCallback<std::vector<CommandDefinition>> callback) override;
+  void global_command_delete(Snowflake command,
+                             ApiCallback<> callback) override;
+  void global_command_create(const CommandDefinition &command,
+                             ApiCallback<> callback) override;
+
+  void interaction_reply(const Interaction &interaction, std::string content,
+                         ApiCallback<> callback) override;
+  void interaction_thinking(const Interaction &interaction, bool ephemeral,
+                            ApiCallback<> callback) override;
+  void interaction_edit_response(const Interaction &interaction,
+                                 std::string content,
+                                 ApiCallback<> callback) override;
+  void interaction_autocomplete(const Interaction &interaction,
+                                std::vector<CommandChoice> choices,
+                                ApiCallback<> callback) override;
+
+  void message_reactions_get(
+      Snowflake channel, Snowflake message, std::string emoji, Snowflake after,
+      ApiCallback<std::vector<Snowflake>> callback) override;
+  void guild_members_get(Snowflake guild, Snowflake after,
+                         ApiCallback<std::vector<ApiMember>> callback) override;
+
+private:
+  template <typename T = std::monostate>
+  void complete(ApiRoute route, Snowflake bucket, ApiCallback<T> &&callback,
+                std::type_identity_t<ApiResult<T>> &&result) {
+    ++call_count[static_cast<std::size_t>(route)];
+    if (completion == Completion::immediate) {
+      if (callback)
+        callback(result);
+      return;
+    }
+    auto key = scheduler ? scheduler->schedule(route, bucket, clock)
+                         : std::pair{clock + latency, sequence++};
+    if (!callback)
+      return;
+    queue.emplace(key, [callback = std::move(callback),
+                        result = std::move(result)] { callback(result); });
+  }
+
+  Completion completion;
+  Scheduler *scheduler{nullptr};
+  std::chrono::nanoseconds latency{std::chrono::milliseconds{50}};
+  std::chrono::nanoseconds clock{0};
+  std::uint64_t sequence{0};
+  std::map<std::pair<std::chrono::nanoseconds, std::uint64_t>,
+           std::function<void()>>
+      queue;
+
+  std::unordered_map<Snowflake, Guild> guilds;
+  std::set<Snowflake> failing_channels;
+  std::map<Snowflake, int> failing_roles;
+  std::set<std::tuple<Snowflake, Snowflake, Snowflake>> member_roles;
+  std::map<Snowflake, CommandDefinition> commands;
+  std::unordered_map<Snowflake, std::uint32_t> interaction_responses;
+  std::array<std::uint64_t, api_route_count> call_count{};
+  std::string last_sent;
+  std::vector<CommandChoice> last_completion;
+  Snowflake next_id{1};
+};
+
+#endif // FAKE_BOT_API_H
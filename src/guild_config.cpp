@@ -0,0 +1,260 @@
+#include "guild_config.h"
+#include "json_scanner.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+GuildConfig g_guild_configs;
+
+/** The key of the reaction roles in a guild section */
+static const std::string reaction_roles_key{"reaction_roles"};
+
+std::vector<ReactionRole>
+GuildConfig::to_reaction_roles(const ConfigurationSection &c) {
+  std::vector<ReactionRole> rules;
+  for (const auto &s : c.getVector<std::string>(reaction_roles_key)) {
+    if (auto r = ReactionRole::parse(s))
+      rules.push_back(std::move(*r));
+    else
+      LogWarning{} << "Rôle de réaction illisible: " << s;
+  }
+  return rules;
+}
+
+void GuildConfig::build_reaction_roles() {
+  if (reaction_roles_built.load(std::memory_order_acquire))
+    return;
+  std::lock_guard lk{reaction_roles_mutex};
+  if (reaction_roles_built.load(std::memory_order_relaxed))
+    return;
+  reaction_roles.clear();
+  config().for_each_id([this](Snowflake guild, const ConfigurationSection &c) {
+    if (c.find(reaction_roles_key) != std::end(c))
+      reaction_roles.assign(guild, to_reaction_roles(c));
+  });
+  reaction_roles_built.store(true, std::memory_order_release);
+}
+
+void GuildConfig::sync_reaction_roles() {
+  if (config_file.empty())
+    return;
+  auto disk = Configuration::from_file(config_file);
+  auto &local = config();
+
+  std::vector<Snowflake> guilds;
+  disk.for_each_id([&guilds](Snowflake guild, const ConfigurationSection &c) {
+    if (c.find(reaction_roles_key) != std::end(c))
+      guilds.push_back(guild);
+  });
+  local.for_each_id([&guilds](Snowflake guild, const ConfigurationSection &c) {
+    if (c.find(reaction_roles_key) != std::end(c))
+      guilds.push_back(guild);
+  });
+  std::ranges::sort(guilds);
+  guilds.erase(std::ranges::unique(guilds).begin(), std::end(guilds));
+
+  const bool built = reaction_roles_built.load(std::memory_order_acquire);
+  for (auto guild : guilds) {
+    const auto &from = std::as_const(disk)[guild];
+    auto &to = local[guild];
+    auto written = from.find(reaction_roles_key);
+    auto kept = to.find(reaction_roles_key);
+    if (written == std::end(from)) {
+      if (kept == std::end(to))
+        continue;
+      to.rem(reaction_roles_key);
+    } else if (kept == std::end(to) || kept->second != written->second) {
+      to[reaction_roles_key] = written->second;
+    } else {
+      continue;
+    }
+    if (built)
+      reaction_roles.assign(guild, to_reaction_roles(to));
+  }
+}
+
+void GuildConfig::store_reaction_roles(
+    Snowflake guild_id, const std::vector<ReactionRole> &rules) {
+  auto &c = config()[guild_id];
+  // an empty list is not written in the file
+  if (rules.empty())
+    c.rem(reaction_roles_key);
+  else
+    c.setVector(reaction_roles_key, rules);
+  reaction_roles.assign(guild_id, rules);
+  if (shared)
+    save_shared();
+  else
+    save();
+}
+
+bool GuildConfig::add_reaction_role(Snowflake guild_id,
+                                    const ReactionRole &rule) {
+  build_reaction_roles();
+  std::lock_guard lk{reaction_roles_mutex};
+  std::optional<SharedGuildStore::WriterLock> writer;
+  lock_reaction_roles(writer);
+  auto rules = to_reaction_roles(config()[guild_id]);
+  if (std::ranges::find(rules, rule) != std::end(rules))
+    return false;
+  rules.push_back(rule);
+  store_reaction_roles(guild_id, rules);
+  return true;
+}
+
+bool GuildConfig::remove_reaction_role(Snowflake guild_id,
+                                       const ReactionRole &rule) {
+  build_reaction_roles();
+  std::lock_guard lk{reaction_roles_mutex};
+  std::optional<SharedGuildStore::WriterLock> writer;
+  lock_reaction_roles(writer);
+  auto rules = to_reaction_roles(config()[guild_id]);
+  if (!std::erase(rules, rule))
+    return false;
+  store_reaction_roles(guild_id, rules);
+  return true;
+}
+
+std::vector<ReactionRole>
+GuildConfig::get_guild_reaction_roles(Snowflake guild_id) {
+  std::lock_guard lk{reaction_roles_mutex};
+  std::optional<SharedGuildStore::WriterLock> writer;
+  lock_reaction_roles(writer);
+  return to_reaction_roles(config()[guild_id]);
+}
+
+bool GuildConfig::forget_reaction_roles(Snowflake guild_id, Snowflake id) {
+  build_reaction_roles();
+  // most deletions reference no rule, the index answers without the section
+  if (reaction_roles.referencing(guild_id, id).empty())
+    return false;
+  std::lock_guard lk{reaction_roles_mutex};
+  std::optional<SharedGuildStore::WriterLock> writer;
+  lock_reaction_roles(writer);
+  auto rules = to_reaction_roles(config()[guild_id]);
+  // the messages are gone with their channel
+  const auto removed = std::erase_if(rules, [id](const ReactionRole &r) {
+    return r.channel == id || r.message == id || r.role == id;
+  });
+  if (!removed)
+    return false;
+  store_reaction_roles(guild_id, rules);
+  LogInformational{} << removed << " rôles de réaction de " << guild_id
+                     << " vers " << id << " supprimés";
+  return true;
+}
+
+bool GuildConfig::forget(Snowflake guild_id, Snowflake id) {
+  // 0 is an unset setting
+  if (!id)
+    return false;
+  const bool rules = forget_reaction_roles(guild_id, id);
+  auto clear = [id](GuildSettings &s) {
+    bool changed{false};
+    if (s.goodbye_channel == id) {
+      s.goodbye_channel = 0;
+      changed = true;
+    }
+    // the message is gone with its channel
+    if (s.charte_channel == id || s.charte_message == id) {
+      s.charte_channel = 0;
+      s.charte_message = 0;
+      changed = true;
+    }
+    if (s.charte_role == id) {
+      s.charte_role = 0;
+      changed = true;
+    }
+    return changed;
+  };
+
+  if (shared) {
+    // reading the slot is cheap, and the other processes change it
+    if (auto s = shared_settings(guild_id); !clear(s))
+      return rules;
+    update_shared(guild_id, clear);
+  } else {
+    std::lock_guard lk{references_mutex};
+    if (!references_built) {
+      config().for_each_id(
+          [this](Snowflake guild, const ConfigurationSection &c) {
+            index_references(guild, to_settings(c));
+          });
+      references_built = true;
+    }
+    auto itr = references.find(id);
+    if (itr == std::end(references) || itr->second != guild_id)
+      return rules;
+    auto &c = config()[guild_id];
+    auto s = to_settings(c);
+    if (!clear(s))
+      return rules;
+    from_settings(c, s);
+    index_references(guild_id, s);
+    save();
+  }
+  LogInformational{} << "Paramètre de " << guild_id << " vers " << id
+                     << " supprimé";
+  return true;
+}
+
+bool GuildConfig::forget_deleted(DeletedEvent event, std::string_view raw) {
+  Snowflake guild_id{0};
+  Snowflake id{0};
+  std::vector<Snowflake> ids;
+
+  auto read_member = [&](std::string_view key, JsonScanner &v) {
+    if (key == "guild_id")
+      return v.snowflake(guild_id);
+    switch (event) {
+    case DeletedEvent::channel_delete:
+    case DeletedEvent::message_delete:
+      return key == "id" && v.snowflake(id);
+    case DeletedEvent::role_delete:
+      return key == "role_id" && v.snowflake(id);
+    case DeletedEvent::message_delete_bulk:
+      return key == "ids" && v.array([&ids](JsonScanner &e) {
+               Snowflake i{0};
+               if (e.snowflake(i))
+                 ids.push_back(i);
+             });
+    }
+    return false;
+  };
+
+  JsonScanner s{raw};
+  s.object([&](std::string_view key, JsonScanner &v) {
+    if (key == "d")
+      return v.object(read_member);
+    return read_member(key, v);
+  });
+  if (!s.ok()) {
+    LogWarning{} << "Événement de suppression illisible";
+    return false;
+  }
+  // the messages deleted out of a guild reference nothing
+  if (!guild_id)
+    return false;
+
+  if (event != DeletedEvent::message_delete_bulk)
+    return forget(guild_id, id);
+  bool changed{false};
+  for (auto i : ids)
+    changed = forget(guild_id, i) || changed;
+  return changed;
+}
+
+void register_metrics() {
+  auto &metrics = Metrics::instance();
+  metrics.add_memory("configuration",
+                     [] { return g_guild_configs.memory_usage(); });
+  metrics.add_memory("event_arena", [] { return EventArena::memory_usage(); });
+  metrics.add_memory("shared_config",
+                     [] { return g_guild_configs.shared_memory_usage(); });
+  metrics.add_memory("reaction_roles", [] {
+    return g_guild_configs.reaction_roles_memory_usage();
+  });
+  metrics.set_guild_count([] { return g_guild_configs.guild_count(); });
+}
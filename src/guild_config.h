@@ -0,0 +1,578 @@
+#ifndef GUILD_CONFIG_H
+#define GUILD_CONFIG_H
+
+#include "bot_api.h"
+#include "configuration.h"
+#include "event_arena.h"
+#include "profiling.h"
+#include "reaction_roles.h"
+#include "shared_config.h"
+
+#include <atomic>
+#include <concepts>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/** Longer than the small string buffer, kept to not allocate on each event */
+inline const std::string charte_reaction_valider_key{
+    "charte_reaction_valider"};
+
+/**
+ * @brief Result of the check of a reaction against the guild charte
+ */
+enum class CharteMatch { accepted, wrong_message, wrong_emoji };
+
+/**
+ * @brief Check if a reaction validate the charte configured for the guild
+ *
+ * @param guild The guild configuration section
+ * @param channel The channel of the reacted message
+ * @param message The reacted message
+ * @param emoji The name of the emoji used
+ * @return accepted if the role must be given
+ */
+inline CharteMatch match_charte_reaction(const ConfigurationSection &guild,
+                                         Snowflake channel, Snowflake message,
+                                         std::string_view emoji) {
+  if (guild.get<Snowflake>("charte_message") != message ||
+      guild.get<Snowflake>("charte_channel") != channel)
+    return CharteMatch::wrong_message;
+
+  auto valider = guild.find(charte_reaction_valider_key);
+  std::string_view expected{};
+  if (valider != std::end(guild))
+    expected = valider->second;
+  if (expected != emoji)
+    return CharteMatch::wrong_emoji;
+
+  return CharteMatch::accepted;
+}
+
+/**
+ * @brief The gateway events deleting what the guild settings may reference
+ */
+enum class DeletedEvent {
+  channel_delete,
+  role_delete,
+  message_delete,
+  message_delete_bulk
+};
+
+/**
+ * @brief The per guild settings of the bot, saved in the configuration file
+ */
+class GuildConfig {
+  Configuration guilds_config;
+  std::filesystem::path config_file;
+
+  mutable std::future<Configuration> loading;
+  mutable ProfiledMutex loading_mutex{"guild_config_loading"};
+  mutable std::atomic<bool> loaded{true};
+
+  /** When set, the settings are read from and written to the segment */
+  std::unique_ptr<SharedGuildStore> shared;
+
+  /**
+   * @brief The channels, roles and messages referenced by the settings, to
+   * their guild, so the other deletions are dropped without reading the
+   * sections. Built on first use, unused when the settings are shared
+   */
+  std::unordered_map<Snowflake, Snowflake> references;
+  bool references_built{false};
+  mutable ProfiledMutex references_mutex{"guild_config_references"};
+
+  /**
+   * @brief The reaction roles of every guild, compiled from the sections
+   * on first use. They are kept in the file only, the shared segment has a
+   * fixed layout: the processes sharing the segment read them again from
+   * the file under its writer lock before changing them
+   */
+  ReactionRoleIndex reaction_roles;
+  std::atomic<bool> reaction_roles_built{false};
+  mutable ProfiledMutex reaction_roles_mutex{"guild_config_reaction_roles"};
+
+  /**
+   * @brief Compile the reaction roles of every guild if not done yet
+   */
+  void build_reaction_roles();
+
+  static std::vector<ReactionRole>
+  to_reaction_roles(const ConfigurationSection &c);
+
+  /**
+   * @brief Write the reaction roles of the guild and compile them,
+   * reaction_roles_mutex is held
+   */
+  void store_reaction_roles(Snowflake guild_id,
+                            const std::vector<ReactionRole> &rules);
+
+  /**
+   * @brief Copy the reaction roles written in the file by the other
+   * processes, the writer lock of the segment and reaction_roles_mutex are
+   * held
+   */
+  void sync_reaction_roles();
+
+  /**
+   * @brief Before changing the reaction roles, take the writer lock of the
+   * segment if the settings are shared, and read the file again
+   * reaction_roles_mutex is held
+   */
+  void lock_reaction_roles(std::optional<SharedGuildStore::WriterLock> &lk) {
+    if (!shared)
+      return;
+    lk.emplace(*shared);
+    sync_reaction_roles();
+  }
+
+  /**
+   * @brief Remove the reaction roles of the guild referencing the deleted
+   * id
+   *
+   * @return true if a reaction role was removed
+   */
+  bool forget_reaction_roles(Snowflake guild_id, Snowflake id);
+
+  /**
+   * @brief Replace the references of the guild, references_mutex is held
+   */
+  void index_references(Snowflake guild_id, const GuildSettings &s) {
+    std::erase_if(references,
+                  [guild_id](const auto &r) { return r.second == guild_id; });
+    for (auto id : {s.goodbye_channel, s.charte_channel, s.charte_message,
+                    s.charte_role})
+      if (id)
+        references[id] = guild_id;
+  }
+
+  /**
+   * @brief Update the references after a change of the local settings
+   */
+  void reindex(Snowflake guild_id) {
+    std::lock_guard lk{references_mutex};
+    if (references_built)
+      index_references(guild_id, to_settings(config()[guild_id]));
+  }
+
+  /**
+   * @brief Wait for the end of the indexing started by load()
+   */
+  void wait_loaded() const {
+    if (loaded.load(std::memory_order_acquire))
+      return;
+    std::lock_guard lk{loading_mutex};
+    if (loaded.load(std::memory_order_relaxed))
+      return;
+    // nothing could read the configuration before the end of the loading
+    const_cast<Configuration &>(guilds_config) = loading.get();
+    loaded.store(true, std::memory_order_release);
+  }
+
+  Configuration &config() {
+    wait_loaded();
+    return guilds_config;
+  }
+
+  const Configuration &config() const {
+    wait_loaded();
+    return guilds_config;
+  }
+
+  void save() {
+    if (!config_file.empty())
+      Configuration::to_file(config(), config_file);
+  }
+
+  static GuildSettings to_settings(const ConfigurationSection &c) {
+    GuildSettings s;
+    s.goodbye_channel = c.get<Snowflake>("goodbye_channel");
+    s.charte_channel = c.get<Snowflake>("charte_channel");
+    s.charte_message = c.get<Snowflake>("charte_message");
+    s.charte_role = c.get<Snowflake>("charte_role");
+    s.charte_reaction_valider =
+        c.get<std::string>(charte_reaction_valider_key, "");
+    s.charte_screening = c.get<std::string>("charte_screening") == "true";
+    return s;
+  }
+
+  static void from_settings(ConfigurationSection &c, const GuildSettings &s) {
+    // the empty values are not written in the file
+    auto id = [](Snowflake v) {
+      return v ? std::to_string(v) : std::string{};
+    };
+    c.set("goodbye_channel", id(s.goodbye_channel));
+    c.set("charte_channel", id(s.charte_channel));
+    c.set("charte_message", id(s.charte_message));
+    c.set("charte_role", id(s.charte_role));
+    c.set(charte_reaction_valider_key, s.charte_reaction_valider);
+    c.set("charte_screening", s.charte_screening ? "true" : "");
+  }
+
+  GuildSettings shared_settings(Snowflake guild_id) const {
+    GuildSettings s;
+    shared->load(guild_id, s);
+    return s;
+  }
+
+  /**
+   * @brief Write the file from the segment, so the settings changed by the
+   * other processes are kept, the writer lock of the segment is held
+   */
+  void save_shared() {
+    shared->for_each([this](Snowflake id, const GuildSettings &settings) {
+      from_settings(config()[id], settings);
+    });
+    save();
+  }
+
+  /**
+   * @brief Change the settings of the guild in the segment, and write the
+   * file from the segment and the reaction roles of the file
+   */
+  template <typename F> void update_shared(Snowflake guild_id, F &&f) {
+    // taken before the writer lock, as by the reaction roles changes
+    std::lock_guard rlk{reaction_roles_mutex};
+    SharedGuildStore::WriterLock lk{*shared};
+    sync_reaction_roles();
+    auto s = shared_settings(guild_id);
+    f(s);
+    shared->store(guild_id, s);
+    save_shared();
+  }
+
+public:
+  GuildConfig() = default;
+
+  Configuration &operator=(Configuration &&lhs) {
+    wait_loaded();
+    guilds_config = std::forward<Configuration>(lhs);
+    reaction_roles_built.store(false, std::memory_order_release);
+    std::lock_guard lk{references_mutex};
+    references_built = false;
+    return guilds_config;
+  }
+
+  /**
+   * @brief Set the file written on each change, empty to never write
+   */
+  void set_file(std::filesystem::path file) { config_file = std::move(file); }
+
+  /**
+   * @brief Index the file in the background and use it as configuration
+   * The sections are parsed on first access, the first access waits for the
+   * end of the indexing
+   */
+  void load(std::filesystem::path file) {
+    wait_loaded();
+    {
+      std::lock_guard lk{references_mutex};
+      references_built = false;
+    }
+    reaction_roles_built.store(false, std::memory_order_release);
+    loaded.store(false, std::memory_order_release);
+    loading = std::async(std::launch::async, [file = std::move(file)] {
+      return Configuration::from_file_lazy(file);
+    });
+  }
+
+  /**
+   * @brief Share the settings with the other bot processes of the host
+   * The first process creating the segment fills it with its configuration,
+   * the others use the segment content
+   *
+   * @param name The shm name, starting with '/'
+   * @param capacity The maximum count of guilds
+   * @return false if the segment can't be used, the local configuration is
+   * kept
+   */
+  bool share(const std::string &name, std::size_t capacity = 16384) {
+    wait_loaded();
+    shared = SharedGuildStore::open(
+        name, capacity, [this](SharedGuildStore &store) {
+          guilds_config.for_each_id(
+              [&store](Snowflake id, const ConfigurationSection &c) {
+                store.store(id, to_settings(c));
+              });
+        });
+    return shared != nullptr;
+  }
+
+  /**
+   * @brief Bytes mapped for the shared settings, 0 if not shared
+   */
+  [[nodiscard]] std::size_t shared_memory_usage() const {
+    return shared ? shared->memory_usage() : 0;
+  }
+
+  /**
+   * @brief Estimated memory of the configuration, 0 while it is loading
+   */
+  std::size_t memory_usage() const {
+    if (!loaded.load(std::memory_order_acquire))
+      return 0;
+    return guilds_config.memory_usage();
+  }
+
+  /**
+   * @brief Count of guilds with a section, 0 while it is loading
+   */
+  std::size_t guild_count() const {
+    if (!loaded.load(std::memory_order_acquire))
+      return 0;
+    return guilds_config.id_size();
+  }
+
+  template <class F>
+    requires std::invocable<F, Snowflake, Snowflake>
+  void get_guild_goodbye_channel(BotApi &bot, Snowflake guild_id,
+                                 F &&callback) {
+    auto channel_id =
+        shared ? shared_settings(guild_id).goodbye_channel
+               : config()[guild_id].get<Snowflake>("goodbye_channel");
+
+    if (channel_id != 0) {
+      return callback(guild_id, channel_id);
+    }
+
+    bot.channels_get(
+        guild_id, [this, guild_id, callback = std::forward<F>(callback)](
+                      const ApiResult<std::vector<ApiChannel>> &ccb) {
+          if (ccb.is_error()) {
+            LogError{} << ccb.get_error().message;
+            return;
+          }
+          const auto &channels = ccb.get();
+          // the channels where the bot may not write would fail the goodbye
+          for (auto &i : channels) {
+            if (i.is_text && i.writable) {
+              if (shared) {
+                update_shared(guild_id, [&i](GuildSettings &s) {
+                  s.goodbye_channel = i.id;
+                });
+                return callback(guild_id, i.id);
+              }
+              auto &new_guild_config = config()[guild_id];
+              new_guild_config.set("goodbye_channel", std::to_string(i.id));
+              reindex(guild_id);
+              save();
+              return callback(guild_id, i.id);
+            }
+          }
+        });
+  }
+
+  void clear_guild_goodbye_channel(Snowflake guild_id) {
+    if (shared)
+      return update_shared(guild_id,
+                           [](GuildSettings &s) { s.goodbye_channel = 0; });
+    config()[guild_id].set("goodbye_channel", "0");
+    reindex(guild_id);
+    save();
+  }
+
+  void set_guild_charte_message(Snowflake guild_id, Snowflake channel,
+                                Snowflake message) {
+    if (shared)
+      return update_shared(guild_id, [channel, message](GuildSettings &s) {
+        s.charte_channel = channel;
+        s.charte_message = message;
+      });
+    auto &c = config()[guild_id];
+    c.set("charte_channel", std::to_string(channel));
+    c.set("charte_message", std::to_string(message));
+    reindex(guild_id);
+
+    save();
+  }
+
+  void set_guild_charte_reaction_valider(Snowflake guild_id,
+                                         const std::string &reaction) {
+    if (shared)
+      return update_shared(guild_id, [&reaction](GuildSettings &s) {
+        s.charte_reaction_valider = reaction;
+      });
+    auto &c = config()[guild_id];
+    c.set(charte_reaction_valider_key, reaction);
+
+    save();
+  }
+
+  void set_guild_charte_role(Snowflake guild_id, const std::string &role) {
+    if (shared)
+      return update_shared(guild_id, [&role](GuildSettings &s) {
+        ConfigurationSection::convert_to_num(role, s.charte_role);
+      });
+    auto &c = config()[guild_id];
+    c.set("charte_role", role);
+    reindex(guild_id);
+
+    save();
+  }
+
+  /**
+   * @brief Give the charte role to the members passing the rules screening
+   * of the guild, next to the reactions and the button
+   */
+  void set_guild_charte_screening(Snowflake guild_id, bool screening) {
+    if (shared)
+      return update_shared(guild_id, [screening](GuildSettings &s) {
+        s.charte_screening = screening;
+      });
+    config()[guild_id].set("charte_screening", screening ? "true" : "");
+
+    save();
+  }
+
+  bool get_guild_charte_screening(Snowflake guild_id) const {
+    if (shared)
+      return shared_settings(guild_id).charte_screening;
+    return config()[guild_id].get<std::string>("charte_screening") == "true";
+  }
+
+  Snowflake get_guild_charte_role(Snowflake guild_id) const {
+    if (shared)
+      return shared_settings(guild_id).charte_role;
+    auto &c = config()[guild_id];
+    return c.get<Snowflake>("charte_role");
+  }
+
+  /**
+   * @brief Get the validation emoji, copied in the memory resource given
+   */
+  std::pmr::string get_guild_charte_reaction_valider(
+      Snowflake guild_id,
+      std::pmr::memory_resource *mr = EventArena::resource()) const {
+    if (shared)
+      return std::pmr::string{
+          shared_settings(guild_id).charte_reaction_valider, mr};
+    auto &c = config()[guild_id];
+    auto itr = c.find(charte_reaction_valider_key);
+    if (itr == std::end(c))
+      return std::pmr::string{mr};
+    return std::pmr::string{itr->second, mr};
+  }
+
+  std::pair<std::string, std::string>
+  get_guild_charte_message(Snowflake guild_id) const {
+    std::pair<std::string, std::string> res;
+    if (shared) {
+      auto s = shared_settings(guild_id);
+      res.first = std::to_string(s.charte_channel);
+      res.second = std::to_string(s.charte_message);
+      return res;
+    }
+    auto &c = config()[guild_id];
+    res.first = c.get<std::string>("charte_channel");
+    res.second = c.get<std::string>("charte_message");
+    return res;
+  }
+
+  /**
+   * @brief Add a reaction role to the guild
+   *
+   * @return false if the guild already has it
+   */
+  bool add_reaction_role(Snowflake guild_id, const ReactionRole &rule);
+
+  /**
+   * @brief Remove a reaction role of the guild
+   *
+   * @return false if the guild does not have it
+   */
+  bool remove_reaction_role(Snowflake guild_id, const ReactionRole &rule);
+
+  std::vector<ReactionRole> get_guild_reaction_roles(Snowflake guild_id);
+
+  /**
+   * @brief Append to out the roles the reaction gives, one lookup whatever
+   * the count of rules
+   *
+   * @return false if the reaction matches no reaction role of the guild
+   */
+  bool match_reaction_roles(Snowflake guild_id, Snowflake message,
+                            Snowflake emoji_id, std::string_view emoji_name,
+                            std::pmr::vector<Snowflake> &out) {
+    build_reaction_roles();
+    return reaction_roles.roles(guild_id, message, emoji_id, emoji_name, out);
+  }
+
+  /**
+   * @brief The reaction is on the charte message or matches a reaction
+   * role, the others are dropped before reaching the handlers
+   */
+  bool watches_reaction(Snowflake guild_id, Snowflake channel,
+                        Snowflake message, Snowflake emoji_id,
+                        std::string_view emoji_name) {
+    if (!guild_id)
+      return false;
+    // a wrong emoji on the charte message is still logged by the handler
+    if (match_charte_reaction(guild_id, channel, message, emoji_name) !=
+        CharteMatch::wrong_message)
+      return true;
+    build_reaction_roles();
+    return reaction_roles.contains(message, emoji_id, emoji_name);
+  }
+
+  /**
+   * @brief Count of reaction roles, 0 until they are first used
+   */
+  [[nodiscard]] std::size_t reaction_role_count() const {
+    return reaction_roles.size();
+  }
+
+  [[nodiscard]] std::size_t reaction_roles_memory_usage() const {
+    return reaction_roles.memory_usage();
+  }
+
+  /**
+   * @brief Clear the settings of the guild referencing the deleted id, the
+   * goodbye channel is found again on the next goodbye
+   *
+   * @return true if a setting was cleared
+   */
+  bool forget(Snowflake guild_id, Snowflake id);
+
+  /**
+   * @brief Clear the settings referencing what the gateway event deletes,
+   * given as the raw payload or its "d" object
+   *
+   * @return true if a setting was cleared
+   */
+  bool forget_deleted(DeletedEvent event, std::string_view raw);
+
+  CharteMatch match_charte_reaction(Snowflake guild_id, Snowflake channel,
+                                    Snowflake message,
+                                    std::string_view emoji) const {
+    if (shared) {
+      auto s = shared_settings(guild_id);
+      if (s.charte_channel != channel || s.charte_message != message)
+        return CharteMatch::wrong_message;
+      return s.charte_reaction_valider == emoji ? CharteMatch::accepted
+                                                : CharteMatch::wrong_emoji;
+    }
+    return ::match_charte_reaction(config()[guild_id], channel, message,
+                                   emoji);
+  }
+};
+
+/**
+ * @brief The configuration of every guild, owned by the process so it
+ * outlives the handler modules
+ */
+extern GuildConfig g_guild_configs;
+
+/**
+ * @brief Add the memory used by the guild configuration, the shared segment
+ * and the event arenas to the metrics
+ */
+void register_metrics();
+
+#endif // GUILD_CONFIG_H
@@ -0,0 +1,472 @@
+#include "guild_directory.h"
+#include "configuration.h"
+#include "json_scanner.h"
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <mutex>
+#include <tuple>
+
+namespace {
+
+// Discord channel type of a guild text channel
+constexpr std::int64_t guild_text_channel{0};
+
+constexpr std::uint64_t perm_send{perm_view_channel | perm_send_messages};
+
+// heap bytes of a string, 0 when it is in the small string buffer
+std::size_t string_heap(const std::string &s) {
+  return s.capacity() > std::string{}.capacity() ? s.capacity() + 1 : 0;
+}
+
+} // namespace
+
+void GuildDirectory::put(Guild &g, Channel c) {
+  auto itr = std::ranges::find(g.channels, c.id, &Channel::id);
+  if (itr != std::end(g.channels))
+    *itr = std::move(c);
+  else
+    g.channels.push_back(std::move(c));
+  std::ranges::sort(g.channels, [](const Channel &l, const Channel &r) {
+    return std::tie(l.position, l.id) < std::tie(r.position, r.id);
+  });
+}
+
+void GuildDirectory::put(Guild &g, Role r) {
+  auto itr = std::ranges::find(g.roles, r.id, &Role::id);
+  if (itr != std::end(g.roles))
+    *itr = std::move(r);
+  else
+    g.roles.push_back(std::move(r));
+  index_roles(g);
+}
+
+void GuildDirectory::index_roles(Guild &g) {
+  std::ranges::sort(g.roles, [](const Role &l, const Role &r) {
+    if (less_folded(l.name, r.name))
+      return true;
+    if (less_folded(r.name, l.name))
+      return false;
+    return l.id < r.id;
+  });
+
+  // half empty at most, the probes stay short
+  g.role_names.assign(
+      g.roles.empty() ? 0 : std::bit_ceil(g.roles.size() * 2), 0);
+  const auto mask = g.role_names.size() - 1;
+  for (std::uint32_t i = 0; i < g.roles.size(); ++i) {
+    auto slot = std::hash<std::string_view>{}(g.roles[i].name) & mask;
+    // the first of the roles with the same name is kept
+    while (g.role_names[slot] &&
+           g.roles[g.role_names[slot] - 1].name != g.roles[i].name)
+      slot = (slot + 1) & mask;
+    if (!g.role_names[slot])
+      g.role_names[slot] = i + 1;
+  }
+  index_self(g);
+}
+
+void GuildDirectory::index_self(Guild &g) {
+  g.self_permissions = 0;
+  g.self_position = 0;
+  for (auto &r : g.roles) {
+    // @everyone has the id of the guild and is at the bottom
+    if (r.id == g.id) {
+      g.self_permissions |= r.permissions;
+    } else if (std::ranges::find(g.self_roles, r.id) !=
+               std::end(g.self_roles)) {
+      g.self_permissions |= r.permissions;
+      g.self_position = std::max(g.self_position, r.position);
+    }
+  }
+}
+
+std::uint64_t GuildDirectory::permissions(const Guild &g,
+                                          const Channel &c) const {
+  const auto me = self.load(std::memory_order_relaxed);
+  if (g.owner == me || (g.self_permissions & perm_administrator))
+    return perm_all;
+
+  // the overwrite of @everyone, then the ones of the roles together, then
+  // the one of the member
+  auto res = g.self_permissions;
+  std::uint64_t allow{0};
+  std::uint64_t deny{0};
+  const Overwrite *member{nullptr};
+  for (auto &o : c.overwrites) {
+    if (o.id == g.id)
+      res = (res & ~o.deny) | o.allow;
+    else if (o.id == me)
+      member = &o;
+    else if (std::ranges::find(g.self_roles, o.id) != std::end(g.self_roles)) {
+      allow |= o.allow;
+      deny |= o.deny;
+    }
+  }
+  res = (res & ~deny) | allow;
+  if (member)
+    res = (res & ~member->deny) | member->allow;
+  return res;
+}
+
+const GuildDirectory::Role *GuildDirectory::find_role(const Guild &g,
+                                                      std::string_view name) {
+  if (g.role_names.empty())
+    return nullptr;
+  const auto mask = g.role_names.size() - 1;
+  for (auto slot = std::hash<std::string_view>{}(name) & mask;
+       g.role_names[slot]; slot = (slot + 1) & mask)
+    if (auto &r = g.roles[g.role_names[slot] - 1]; r.name == name)
+      return &r;
+  return nullptr;
+}
+
+bool GuildDirectory::ingest(Event event, std::string_view raw) {
+  const auto me = self.load(std::memory_order_relaxed);
+  Snowflake guild_id{0};
+  Snowflake id{0};
+  Snowflake owner{0};
+  bool unavailable{false};
+  Guild guild;
+  Channel channel;
+  std::int64_t channel_type{-1};
+  Role role;
+  Snowflake user_id{0};
+  std::vector<Snowflake> member_roles;
+
+  auto read_channel = [&](std::string_view key, JsonScanner &v) {
+    if (key == "id")
+      return v.snowflake(channel.id);
+    if (key == "guild_id")
+      return v.snowflake(guild_id);
+    if (key == "type")
+      return v.integer(channel_type);
+    if (key == "position")
+      return v.integer(channel.position);
+    if (key == "name")
+      return v.string(channel.name);
+    if (key == "permission_overwrites")
+      return v.array([&](JsonScanner &e) {
+        Overwrite o;
+        e.object([&o](std::string_view k, JsonScanner &w) {
+          if (k == "id")
+            return w.snowflake(o.id);
+          // the permissions are strings of digits too
+          if (k == "allow")
+            return w.snowflake(o.allow);
+          if (k == "deny")
+            return w.snowflake(o.deny);
+          return false;
+        });
+        channel.overwrites.push_back(o);
+      });
+    return false;
+  };
+  auto read_role = [&](std::string_view key, JsonScanner &v) {
+    if (key == "id")
+      return v.snowflake(role.id);
+    if (key == "name")
+      return v.string(role.name);
+    if (key == "position")
+      return v.integer(role.position);
+    if (key == "permissions")
+      return v.snowflake(role.permissions);
+    return false;
+  };
+  auto read_user = [&](std::string_view key, JsonScanner &v) {
+    if (key == "id")
+      return v.snowflake(user_id);
+    return false;
+  };
+  auto read_guild_member = [&](std::string_view key, JsonScanner &v) {
+    if (key == "user")
+      return v.object(read_user);
+    if (key == "roles") {
+      member_roles.clear();
+      return v.array([&](JsonScanner &e) {
+        Snowflake r{0};
+        if (e.snowflake(r))
+          member_roles.push_back(r);
+      });
+    }
+    return false;
+  };
+
+  auto read_member = [&](std::string_view key, JsonScanner &v) {
+    switch (event) {
+    case Event::ready:
+      if (key == "user")
+        return v.object(read_user);
+      return false;
+
+    case Event::guild_create:
+    case Event::guild_update:
+    case Event::guild_delete:
+      if (key == "id")
+        return v.snowflake(guild_id);
+      if (key == "unavailable")
+        return v.boolean(unavailable);
+      if (event == Event::guild_delete)
+        return false;
+      if (key == "owner_id")
+        return v.snowflake(owner);
+      if (event == Event::guild_update)
+        return false;
+      // only the member of the bot is kept, it is always sent
+      if (key == "members" && me)
+        return v.array([&](JsonScanner &e) {
+          user_id = 0;
+          e.object(read_guild_member);
+          if (user_id == me) {
+            guild.self_roles = member_roles;
+            guild.self_known = true;
+          }
+        });
+      if (key == "channels")
+        return v.array([&](JsonScanner &e) {
+          channel = {};
+          channel_type = -1;
+          e.object(read_channel);
+          if (channel_type == guild_text_channel)
+            guild.channels.push_back(std::move(channel));
+        });
+      if (key == "roles")
+        return v.array([&](JsonScanner &e) {
+          role = {};
+          e.object(read_role);
+          guild.roles.push_back(std::move(role));
+        });
+      return false;
+
+    case Event::channel_create:
+    case Event::channel_update:
+    case Event::channel_delete:
+      return read_channel(key, v);
+
+    case Event::role_create:
+    case Event::role_update:
+      if (key == "guild_id")
+        return v.snowflake(guild_id);
+      if (key == "role")
+        return v.object(read_role);
+      return false;
+
+    case Event::role_delete:
+      if (key == "guild_id")
+        return v.snowflake(guild_id);
+      if (key == "role_id")
+        return v.snowflake(id);
+      return false;
+
+    case Event::member_update:
+      if (key == "guild_id")
+        return v.snowflake(guild_id);
+      return read_guild_member(key, v);
+    }
+    return false;
+  };
+
+  // the members of a full payload ("op", "t", "s") are read by nobody, so
+  // the payload and its "d" object are read in the same pass
+  JsonScanner s{raw};
+  s.object([&](std::string_view key, JsonScanner &v) {
+    if (key == "d")
+      return v.object(read_member);
+    return read_member(key, v);
+  });
+
+  if (!s.ok() || (event == Event::ready ? !user_id : !guild_id)) {
+    LogWarning{} << "Événement de guild illisible";
+    return false;
+  }
+  if (event == Event::ready) {
+    self.store(user_id, std::memory_order_relaxed);
+    return true;
+  }
+  // the members of the others are not kept
+  if (event == Event::member_update && user_id != me)
+    return true;
+
+  std::unique_lock lk{mutex};
+  if (event == Event::guild_create) {
+    // an unavailable guild is sent without its channels
+    if (unavailable)
+      return true;
+    std::ranges::sort(guild.channels, [](const Channel &l, const Channel &r) {
+      return std::tie(l.position, l.id) < std::tie(r.position, r.id);
+    });
+    guild.id = guild_id;
+    guild.owner = owner;
+    index_roles(guild);
+    guilds.insert_or_assign(guild_id, std::move(guild));
+    return true;
+  }
+  if (event == Event::guild_delete) {
+    guilds.erase(guild_id);
+    return true;
+  }
+
+  // the guilds not received yet are answered by the REST calls
+  auto itr = guilds.find(guild_id);
+  if (itr == std::end(guilds))
+    return true;
+  auto &g = itr->second;
+  switch (event) {
+  case Event::guild_update:
+    g.owner = owner;
+    break;
+  case Event::channel_create:
+  case Event::channel_update:
+    if (channel_type == guild_text_channel) {
+      put(g, std::move(channel));
+      break;
+    }
+    [[fallthrough]];
+  case Event::channel_delete:
+    std::erase_if(g.channels,
+                  [&](const Channel &c) { return c.id == channel.id; });
+    break;
+  case Event::role_create:
+  case Event::role_update:
+    put(g, std::move(role));
+    break;
+  case Event::role_delete:
+    std::erase_if(g.roles, [id](const Role &r) { return r.id == id; });
+    index_roles(g);
+    break;
+  case Event::member_update:
+    g.self_roles = std::move(member_roles);
+    g.self_known = true;
+    index_self(g);
+    break;
+  default:
+    break;
+  }
+  return true;
+}
+
+bool GuildDirectory::channels(Snowflake guild,
+                              std::vector<ApiChannel> &out) const {
+  std::shared_lock lk{mutex};
+  auto itr = guilds.find(guild);
+  if (itr == std::end(guilds))
+    return false;
+  auto &g = itr->second;
+  out.clear();
+  out.reserve(g.channels.size());
+  for (auto &c : g.channels)
+    out.push_back(
+        {c.id, true, c.name,
+         !g.self_known || (permissions(g, c) & perm_send) == perm_send});
+  return true;
+}
+
+bool GuildDirectory::roles(Snowflake guild, std::vector<ApiRole> &out) const {
+  std::shared_lock lk{mutex};
+  auto itr = guilds.find(guild);
+  if (itr == std::end(guilds))
+    return false;
+  out.clear();
+  out.reserve(itr->second.roles.size());
+  for (auto &r : itr->second.roles)
+    out.push_back({r.id, r.name});
+  return true;
+}
+
+bool GuildDirectory::role(Snowflake guild, std::string_view name,
+                          ApiRole &out) const {
+  std::shared_lock lk{mutex};
+  auto itr = guilds.find(guild);
+  if (itr == std::end(guilds))
+    return false;
+  if (auto r = find_role(itr->second, name))
+    out = {r->id, r->name};
+  else
+    out = {};
+  return true;
+}
+
+bool GuildDirectory::roles_with_prefix(Snowflake guild,
+                                       std::string_view prefix,
+                                       std::size_t limit,
+                                       std::vector<ApiRole> &out) const {
+  std::shared_lock lk{mutex};
+  auto itr = guilds.find(guild);
+  if (itr == std::end(guilds))
+    return false;
+  auto &roles = itr->second.roles;
+  out.clear();
+  // the names starting with the prefix follow it in the folded order
+  for (auto r = std::ranges::lower_bound(roles, prefix, less_folded,
+                                         &Role::name);
+       r != std::end(roles) && out.size() < limit &&
+       starts_with_folded(r->name, prefix);
+       ++r)
+    out.push_back({r->id, r->name});
+  return true;
+}
+
+bool GuildDirectory::permissions(Snowflake guild, Snowflake channel,
+                                 std::uint64_t &out) const {
+  std::shared_lock lk{mutex};
+  auto itr = guilds.find(guild);
+  if (itr == std::end(guilds) || !itr->second.self_known)
+    return false;
+  auto &g = itr->second;
+  auto c = std::ranges::find(g.channels, channel, &Channel::id);
+  if (c == std::end(g.channels))
+    return false;
+  out = permissions(g, *c);
+  return true;
+}
+
+bool GuildDirectory::can_send(Snowflake guild, Snowflake channel,
+                              bool &out) const {
+  std::uint64_t p{0};
+  if (!permissions(guild, channel, p))
+    return false;
+  out = (p & perm_send) == perm_send;
+  return true;
+}
+
+bool GuildDirectory::can_grant(Snowflake guild, Snowflake role,
+                               bool &out) const {
+  std::shared_lock lk{mutex};
+  auto itr = guilds.find(guild);
+  if (itr == std::end(guilds) || !itr->second.self_known)
+    return false;
+  auto &g = itr->second;
+  auto r = std::ranges::find(g.roles, role, &Role::id);
+  if (r == std::end(g.roles))
+    return false;
+  // the administrators are bound by the role order too
+  out = g.owner == self.load(std::memory_order_relaxed) ||
+        ((g.self_permissions & (perm_administrator | perm_manage_roles)) &&
+         g.self_position > r->position);
+  return true;
+}
+
+std::size_t GuildDirectory::size() const {
+  std::shared_lock lk{mutex};
+  return guilds.size();
+}
+
+std::size_t GuildDirectory::memory_usage() const {
+  std::shared_lock lk{mutex};
+  std::size_t bytes{
+      guilds.size() * (sizeof(decltype(guilds)::value_type) + sizeof(void *)) +
+      guilds.bucket_count() * sizeof(void *)};
+  for (auto &[id, g] : guilds) {
+    bytes += g.channels.capacity() * sizeof(Channel) +
+             g.roles.capacity() * sizeof(Role) +
+             g.role_names.capacity() * sizeof(std::uint32_t) +
+             g.self_roles.capacity() * sizeof(Snowflake);
+    for (auto &c : g.channels)
+      bytes += string_heap(c.name) +
+               c.overwrites.capacity() * sizeof(Overwrite);
+    for (auto &r : g.roles)
+      bytes += string_heap(r.name);
+  }
+  return bytes;
+}
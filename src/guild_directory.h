@@ -0,0 +1,169 @@
+#ifndef GUILD_DIRECTORY_H
+#define GUILD_DIRECTORY_H
+
+#include "bot_api.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief The text channels and roles of the guilds, read from the gateway
+ * events
+ * Only what the handlers use is kept. The raw payloads are scanned once
+ * without building a JSON tree, so the presences and emojis of a
+ * GUILD_CREATE are skipped without being allocated, and of its members
+ * only the roles of the bot are kept. With the role permissions and the
+ * channel overwrites, they give the permissions of the bot
+ */
+class GuildDirectory {
+public:
+  enum class Event {
+    ready,
+    guild_create,
+    guild_update,
+    guild_delete,
+    channel_create,
+    channel_update,
+    channel_delete,
+    role_create,
+    role_update,
+    role_delete,
+    member_update
+  };
+
+  /**
+   * @brief Apply a gateway event, given as the raw payload or its "d"
+   * object
+   *
+   * @return false if the payload could not be read, the directory is
+   * unchanged
+   */
+  bool ingest(Event event, std::string_view raw);
+
+  /**
+   * @brief The text channels of the guild, ordered as in the client
+   *
+   * @return false if the guild is unknown, out is unchanged
+   */
+  bool channels(Snowflake guild, std::vector<ApiChannel> &out) const;
+
+  /**
+   * @brief The roles of the guild
+   *
+   * @return false if the guild is unknown, out is unchanged
+   */
+  bool roles(Snowflake guild, std::vector<ApiRole> &out) const;
+
+  /**
+   * @brief The role with this exact name, its id is 0 if there is none
+   *
+   * @return false if the guild is unknown, out is unchanged
+   */
+  bool role(Snowflake guild, std::string_view name, ApiRole &out) const;
+
+  /**
+   * @brief At most limit roles whose name starts with the prefix, case
+   * insensitive, ordered by name
+   *
+   * @return false if the guild is unknown, out is unchanged
+   */
+  bool roles_with_prefix(Snowflake guild, std::string_view prefix,
+                         std::size_t limit, std::vector<ApiRole> &out) const;
+
+  /**
+   * @brief The permissions of the bot in the text channel, the overwrites
+   * applied
+   *
+   * @return false if the guild, the channel or the roles of the bot are
+   * unknown, out is unchanged
+   */
+  bool permissions(Snowflake guild, Snowflake channel,
+                   std::uint64_t &out) const;
+
+  /**
+   * @brief Whether the bot may see the text channel and send messages
+   * there
+   *
+   * @return false if the guild, the channel or the roles of the bot are
+   * unknown, out is unchanged
+   */
+  bool can_send(Snowflake guild, Snowflake channel, bool &out) const;
+
+  /**
+   * @brief Whether the bot may give the role: it needs the permission to
+   * manage the roles and a role above it
+   *
+   * @return false if the guild, the role or the roles of the bot are
+   * unknown, out is unchanged
+   */
+  bool can_grant(Snowflake guild, Snowflake role, bool &out) const;
+
+  [[nodiscard]] std::size_t size() const;
+
+  /**
+   * @brief Estimated heap memory of the directory
+   */
+  [[nodiscard]] std::size_t memory_usage() const;
+
+private:
+  struct Overwrite {
+    /** A role, the guild for @everyone, or a member */
+    Snowflake id{0};
+    std::uint64_t allow{0};
+    std::uint64_t deny{0};
+  };
+
+  struct Channel {
+    Snowflake id{0};
+    std::int32_t position{0};
+    std::string name;
+    std::vector<Overwrite> overwrites;
+  };
+
+  struct Role {
+    Snowflake id{0};
+    std::string name;
+    std::int32_t position{0};
+    std::uint64_t permissions{0};
+  };
+
+  struct Guild {
+    Snowflake id{0};
+    Snowflake owner{0};
+    std::vector<Channel> channels;
+    /** Ordered by case folded name, the prefixes are a lower_bound */
+    std::vector<Role> roles;
+    /** Open addressing table of the exact names, index in roles + 1 */
+    std::vector<std::uint32_t> role_names;
+    /** The member of the bot was read, self_roles is meaningful */
+    bool self_known{false};
+    std::vector<Snowflake> self_roles;
+    /** Of @everyone and self_roles, kept by index_self */
+    std::uint64_t self_permissions{0};
+    std::int32_t self_position{0};
+  };
+
+  static void put(Guild &g, Channel c);
+  static void put(Guild &g, Role r);
+  /** Sort the roles and rebuild their name table, after any change */
+  static void index_roles(Guild &g);
+  /** Compute the guild permissions of the bot, after any role change */
+  static void index_self(Guild &g);
+  static const Role *find_role(const Guild &g, std::string_view name);
+  /** The permissions of the bot in the channel, the guild is known */
+  [[nodiscard]] std::uint64_t permissions(const Guild &g,
+                                          const Channel &c) const;
+
+  mutable std::shared_mutex mutex;
+  std::unordered_map<Snowflake, Guild> guilds;
+  /** The user of the bot, read from READY */
+  std::atomic<Snowflake> self{0};
+};
+
+#endif // GUILD_DIRECTORY_H
@@ -0,0 +1,364 @@
+#include "handler_module.h"
+#include "configuration.h"
+
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#ifndef WIN32
+#include <csignal>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::atomic<std::size_t> g_mapped{0};
+
+} // namespace
+
+struct HandlerModule::Loaded {
+  Loaded(void *h, const HandlerModuleTable &t, std::string n)
+      : handle{h}, table{t}, name{std::move(n)} {
+    g_mapped.fetch_add(1, std::memory_order_relaxed);
+  }
+  ~Loaded();
+  Loaded(const Loaded &) = delete;
+  Loaded &operator=(const Loaded &) = delete;
+
+  void *handle;
+  const HandlerModuleTable &table;
+  std::string name;
+};
+
+namespace {
+
+/** The module of the event or callback run by the thread */
+thread_local std::shared_ptr<const void> t_lease;
+
+/**
+ * @brief Make the callbacks created in the scope hold the module
+ */
+class LeaseScope {
+public:
+  explicit LeaseScope(std::shared_ptr<const void> lease)
+      : previous{std::exchange(t_lease, std::move(lease))} {}
+  ~LeaseScope() { t_lease = std::move(previous); }
+  LeaseScope(const LeaseScope &) = delete;
+  LeaseScope &operator=(const LeaseScope &) = delete;
+
+private:
+  std::shared_ptr<const void> previous;
+};
+
+/**
+ * @brief Callback of a module, the module is released after the callback
+ * is destroyed
+ */
+template <typename T> struct Leased {
+  std::shared_ptr<const void> lease;
+  ApiCallback<T> callback;
+
+  void operator()(const ApiResult<T> &r) const {
+    LeaseScope scope{lease};
+    callback(r);
+  }
+};
+
+template <typename T> ApiCallback<T> leased(ApiCallback<T> callback) {
+  if (!callback)
+    return callback;
+  return Leased<T>{t_lease, std::move(callback)};
+}
+
+} // namespace
+
+void HandlerModule::Api::channels_get(
+    Snowflake guild, ApiCallback<std::vector<ApiChannel>> callback) {
+  inner.channels_get(guild, leased(std::move(callback)));
+}
+
+void HandlerModule::Api::roles_get(
+    Snowflake guild, ApiCallback<std::vector<ApiRole>> callback) {
+  inner.roles_get(guild, leased(std::move(callback)));
+}
+
+void HandlerModule::Api::message_get(Snowflake channel, Snowflake message,
+                                     ApiCallback<ApiMessage> callback) {
+  inner.message_get(channel, message, leased(std::move(callback)));
+}
+
+void HandlerModule::Api::message_create(Snowflake guild, Snowflake channel,
+                                        std::string content,
+                                        ApiCallback<> callback) {
+  inner.message_create(guild, channel, std::move(content),
+                       leased(std::move(callback)));
+}
+
+void HandlerModule::Api::message_create_button(Snowflake guild,
+                                               Snowflake channel,
+                                               std::string content,
+                                               ApiButton button,
+                                               ApiCallback<> callback) {
+  inner.message_create_button(guild, channel, std::move(content),
+                              std::move(button), leased(std::move(callback)));
+}
+
+void HandlerModule::Api::guild_member_add_role(Snowflake guild,
+                                               Snowflake user, Snowflake role,
+                                               ApiCallback<> callback) {
+  inner.guild_member_add_role(guild, user, role, leased(std::move(callback)));
+}
+
+void HandlerModule::Api::guild_member_remove_role(Snowflake guild,
+                                                  Snowflake user,
+                                                  Snowflake role,
+                                                  ApiCallback<> callback) {
+  inner.guild_member_remove_role(guild, user, role,
+                                 leased(std::move(callback)));
+}
+
+void HandlerModule::Api::global_commands_get(
+    ApiCallback<std::vector<CommandDefinition>> callback) {
+  inner.global_commands_get(leased(std::move(callback)));
+}
+
+void HandlerModule::Api::global_command_delete(Snowflake command,
+                                               ApiCallback<> callback) {
+  inner.global_command_delete(command, leased(std::move(callback)));
+}
+
+void HandlerModule::Api::global_command_create(
+    const CommandDefinition &command, ApiCallback<> callback) {
+  inner.global_command_create(command, leased(std::move(callback)));
+}
+
+void HandlerModule::Api::interaction_reply(const Interaction &interaction,
+                                           std::string content,
+                                           ApiCallback<> callback) {
+  inner.interaction_reply(interaction, std::move(content),
+                          leased(std::move(callback)));
+}
+
+void HandlerModule::Api::interaction_thinking(const Interaction &interaction,
+                                              bool ephemeral,
+                                              ApiCallback<> callback) {
+  inner.interaction_thinking(interaction, ephemeral,
+                             leased(std::move(callback)));
+}
+
+void HandlerModule::Api::interaction_edit_response(
+    const Interaction &interaction, std::string content,
+    ApiCallback<> callback) {
+  inner.interaction_edit_response(interaction, std::move(content),
+                                  leased(std::move(callback)));
+}
+
+void HandlerModule::Api::interaction_autocomplete(
+    const Interaction &interaction, std::vector<CommandChoice> choices,
+    ApiCallback<> callback) {
+  inner.interaction_autocomplete(interaction, std::move(choices),
+                                 leased(std::move(callback)));
+}
+
+void HandlerModule::Api::message_reactions_get(
+    Snowflake channel, Snowflake message, std::string emoji, Snowflake after,
+    ApiCallback<std::vector<Snowflake>> callback) {
+  inner.message_reactions_get(channel, message, std::move(emoji), after,
+                              leased(std::move(callback)));
+}
+
+void HandlerModule::Api::guild_members_get(
+    Snowflake guild, Snowflake after,
+    ApiCallback<std::vector<ApiMember>> callback) {
+  inner.guild_members_get(guild, after, leased(std::move(callback)));
+}
+
+std::chrono::nanoseconds HandlerModule::Api::now() const {
+  return inner.now();
+}
+
+void HandlerModule::Api::after(std::chrono::nanoseconds delay,
+                               std::function<void()> f) {
+  // f holds the module scheduling it, even when it schedules itself again.
+  // The timers of the process go through process_api() so they hold none
+  inner.after(delay, [lease = t_lease, f = std::move(f)] {
+    LeaseScope scope{lease};
+    f();
+  });
+}
+
+ApiCallback<> HandlerModule::Api::keep(ApiCallback<> callback) {
+  return leased(std::move(callback));
+}
+
+void HandlerModule::Api::role_find(Snowflake guild, std::string name,
+                                   ApiCallback<ApiRole> callback) {
+  inner.role_find(guild, std::move(name), leased(std::move(callback)));
+}
+
+void HandlerModule::Api::roles_complete(
+    Snowflake guild, std::string prefix, std::size_t limit,
+    ApiCallback<std::vector<ApiRole>> callback) {
+  inner.roles_complete(guild, std::move(prefix), limit,
+                       leased(std::move(callback)));
+}
+
+std::size_t HandlerModule::mapped_count() {
+  return g_mapped.load(std::memory_order_relaxed);
+}
+
+template <typename F> void HandlerModule::call(F &&f) {
+  auto module = current.load(std::memory_order_acquire);
+  if (!module) {
+    LogError{} << "Pas de module de handlers chargé";
+    return;
+  }
+  LeaseScope scope{module};
+  f(module->table);
+}
+
+void HandlerModule::register_bot(Api &api) {
+  registered_with.store(&api, std::memory_order_release);
+  call([&api](const HandlerModuleTable &t) { t.register_bot(api); });
+}
+
+void HandlerModule::on_slashcommand(Api &api, const Interaction &event) {
+  call([&](const HandlerModuleTable &t) { t.on_slashcommand(api, event); });
+}
+
+void HandlerModule::on_autocomplete(Api &api, const Interaction &event) {
+  call([&](const HandlerModuleTable &t) { t.on_autocomplete(api, event); });
+}
+
+void HandlerModule::send_goodbye(Api &api, const MemberRemoveEvent &event) {
+  call([&](const HandlerModuleTable &t) { t.send_goodbye(api, event); });
+}
+
+void HandlerModule::on_message_reaction_add(Api &api,
+                                            const ReactionAddEvent &event) {
+  call([&](const HandlerModuleTable &t) {
+    t.on_message_reaction_add(api, event);
+  });
+}
+
+void HandlerModule::on_message_reaction_remove(
+    Api &api, const ReactionRemoveEvent &event) {
+  call([&](const HandlerModuleTable &t) {
+    t.on_message_reaction_remove(api, event);
+  });
+}
+
+void HandlerModule::on_button_click(Api &api, const Interaction &event) {
+  call([&](const HandlerModuleTable &t) { t.on_button_click(api, event); });
+}
+
+void HandlerModule::on_member_screened(Api &api,
+                                       const MemberScreenedEvent &event) {
+  call([&](const HandlerModuleTable &t) { t.on_member_screened(api, event); });
+}
+
+#ifndef WIN32
+
+HandlerModule::Loaded::~Loaded() {
+  LogNotice{} << "Module " << name << " déchargé";
+  ::dlclose(handle);
+  g_mapped.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool HandlerModule::load(const std::filesystem::path &p) {
+  std::lock_guard lk{load_mutex};
+
+  // dlopen returns the module already mapped for the same file, a copy is
+  // opened so the new build is really loaded while the old one drains
+  auto copy = std::filesystem::temp_directory_path() /
+              ("louloute_handlers_" + std::to_string(::getpid()) + '_' +
+               std::to_string(++generation) + p.extension().string());
+  std::error_code ec;
+  std::filesystem::copy_file(p, copy,
+                             std::filesystem::copy_options::overwrite_existing,
+                             ec);
+  if (ec) {
+    LogError{} << "Impossible de copier le module " << p << ": "
+               << ec.message();
+    return false;
+  }
+
+  int flags{RTLD_NOW | RTLD_LOCAL};
+#ifdef LOULOUTEBOT_PROFILING
+  // the profiling tags of the module are linked in the global list
+  flags |= RTLD_NODELETE;
+#endif
+  auto handle = ::dlopen(copy.c_str(), flags);
+  std::filesystem::remove(copy, ec);
+  if (!handle) {
+    LogError{} << "Impossible de charger le module " << p << ": "
+               << ::dlerror();
+    return false;
+  }
+
+  auto entry = reinterpret_cast<HandlerModuleEntry>(
+      ::dlsym(handle, handler_module_entry));
+  const HandlerModuleTable *table = entry ? entry() : nullptr;
+  if (!table || table->abi != handler_module_abi ||
+      table->layout != handler_module_layout) {
+    LogError{} << "Le module " << p << " n'est pas compatible";
+    ::dlclose(handle);
+    return false;
+  }
+
+  auto module = std::make_shared<const Loaded>(
+      handle, *table, p.filename().string() + '#' + std::to_string(generation));
+  LogNotice{} << "Module " << module->name << " chargé";
+  path = p;
+  current.store(module, std::memory_order_release);
+
+  // the new commands are registered on Discord
+  if (auto api = registered_with.load(std::memory_order_acquire)) {
+    LeaseScope scope{module};
+    module->table.register_bot(*api);
+  }
+  return true;
+}
+
+void HandlerModule::reload_on_signal(int sig) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, sig);
+  if (pthread_sigmask(SIG_BLOCK, &set, nullptr)) {
+    LogError{} << "Impossible de bloquer le signal " << sig;
+    return;
+  }
+  std::thread{[this, set] {
+    for (;;) {
+      int received{0};
+      if (sigwait(&set, &received))
+        return;
+      std::filesystem::path p;
+      {
+        std::lock_guard lk{load_mutex};
+        p = path;
+      }
+      load(p);
+    }
+  }}.detach();
+}
+
+#else
+
+HandlerModule::Loaded::~Loaded() {
+  g_mapped.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool HandlerModule::load(const std::filesystem::path &p) {
+  LogError{} << "Pas de module de handlers " << p << " sous Windows";
+  return false;
+}
+
+void HandlerModule::reload_on_signal(int sig) {
+  LogWarning{} << "Pas de rechargement sur signal " << sig;
+}
+
+#endif // WIN32
@@ -0,0 +1,176 @@
+#ifndef HANDLER_MODULE_H
+#define HANDLER_MODULE_H
+
+#include "bot_api.h"
+#include "guild_config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+
+/**
+ * @brief Bumped when the meaning of the module entry points changes
+ */
+inline constexpr std::uint32_t handler_module_abi{8};
+
+/**
+ * @brief Fingerprint of the types shared by the process and the modules,
+ * a module built against other headers is refused
+ */
+inline constexpr std::uint64_t handler_module_layout = [] {
+  std::uint64_t h{14695981039346656037ULL};
+  for (std::uint64_t size :
+       {sizeof(BotApi), sizeof(Interaction), sizeof(MemberRemoveEvent),
+        sizeof(ReactionAddEvent), sizeof(ReactionRemoveEvent),
+        sizeof(MemberScreenedEvent),
+        sizeof(ApiMessage), sizeof(ApiChannel), sizeof(ApiError),
+        sizeof(CommandDefinition), sizeof(GuildConfig)})
+    h = (h ^ size) * 1099511628211ULL;
+  return h;
+}();
+
+/**
+ * @brief The entry points of a handler module
+ */
+struct HandlerModuleTable {
+  std::uint32_t abi;
+  std::uint64_t layout;
+  void (*register_bot)(BotApi &);
+  void (*on_slashcommand)(BotApi &, const Interaction &);
+  void (*on_autocomplete)(BotApi &, const Interaction &);
+  void (*send_goodbye)(BotApi &, const MemberRemoveEvent &);
+  void (*on_message_reaction_add)(BotApi &, const ReactionAddEvent &);
+  void (*on_message_reaction_remove)(BotApi &, const ReactionRemoveEvent &);
+  void (*on_button_click)(BotApi &, const Interaction &);
+  void (*on_member_screened)(BotApi &, const MemberScreenedEvent &);
+};
+
+/** The symbol exported by a module, returning its table */
+inline constexpr const char *handler_module_entry{"louloute_handlers"};
+using HandlerModuleEntry = const HandlerModuleTable *(*)();
+
+/**
+ * @brief The handlers loaded from a module, replaceable while the bot runs
+ * Each event and each pending REST callback holds the module it came from,
+ * a replaced module is unloaded once its last callback is done. The gateway
+ * sessions belong to the process and are never touched
+ */
+class HandlerModule {
+  struct Loaded;
+  using Lease = std::shared_ptr<const Loaded>;
+
+public:
+  /**
+   * @brief BotApi handed to the modules, the callbacks keep their module
+   * loaded until they are called and destroyed
+   */
+  class Api : public BotApi {
+  public:
+    explicit Api(BotApi &b) : inner{b} {}
+
+    void channels_get(Snowflake guild,
+                      ApiCallback<std::vector<ApiChannel>> callback) override;
+    void roles_get(Snowflake guild,
+                   ApiCallback<std::vector<ApiRole>> callback) override;
+    void message_get(Snowflake channel, Snowflake message,
+                     ApiCallback<ApiMessage> callback) override;
+    void message_create(Snowflake guild, Snowflake channel,
+                        std::string content, ApiCallback<> callback) override;
+    void message_create_button(Snowflake guild, Snowflake channel,
+                               std::string content, ApiButton button,
+                               ApiCallback<> callback) override;
+    void guild_member_add_role(Snowflake guild, Snowflake user, Snowflake role,
+                               ApiCallback<> callback) override;
+    void guild_member_remove_role(Snowflake guild, Snowflake user,
+                                  Snowflake role,
+                                  ApiCallback<> callback) override;
+
+    void global_commands_get(
+        ApiCallback<std::vector<CommandDefinition>> callback) override;
+    void global_command_delete(Snowflake command,
+                               ApiCallback<> callback) override;
+    void global_command_create(const CommandDefinition &command,
+                               ApiCallback<> callback) override;
+
+    void interaction_reply(const Interaction &interaction, std::string content,
+                           ApiCallback<> callback) override;
+    void interaction_thinking(const Interaction &interaction, bool ephemeral,
+                              ApiCallback<> callback) override;
+    void interaction_edit_response(const Interaction &interaction,
+                                   std::string content,
+                                   ApiCallback<> callback) override;
+    void interaction_autocomplete(const Interaction &interaction,
+                                  std::vector<CommandChoice> choices,
+                                  ApiCallback<> callback) override;
+
+    void message_reactions_get(
+        Snowflake channel, Snowflake message, std::string emoji,
+        Snowflake after,
+        ApiCallback<std::vector<Snowflake>> callback) override;
+    void
+    guild_members_get(Snowflake guild, Snowflake after,
+                      ApiCallback<std::vector<ApiMember>> callback) override;
+
+    [[nodiscard]] std::chrono::nanoseconds now() const override;
+    void after(std::chrono::nanoseconds delay,
+               std::function<void()> f) override;
+    ApiCallback<> keep(ApiCallback<> callback) override;
+    BotApi &process_api() override { return inner; }
+
+    void role_find(Snowflake guild, std::string name,
+                   ApiCallback<ApiRole> callback) override;
+    void roles_complete(Snowflake guild, std::string prefix,
+                        std::size_t limit,
+                        ApiCallback<std::vector<ApiRole>> callback) override;
+
+  private:
+    BotApi &inner;
+  };
+
+  HandlerModule() = default;
+  HandlerModule(const HandlerModule &) = delete;
+  HandlerModule &operator=(const HandlerModule &) = delete;
+
+  /**
+   * @brief Load the module and make it handle the next events
+   * The bot commands are registered again with the new module if they
+   * already were
+   *
+   * @return false if the module can't be used, the current one is kept
+   */
+  bool load(const std::filesystem::path &path);
+
+  /**
+   * @brief Load again the last module each time the process receive the
+   * signal. Must be called before any thread is started
+   */
+  void reload_on_signal(int sig);
+
+  /**
+   * @brief Count of the modules still mapped, the replaced ones included
+   */
+  [[nodiscard]] static std::size_t mapped_count();
+
+  void register_bot(Api &api);
+  void on_slashcommand(Api &api, const Interaction &event);
+  void on_autocomplete(Api &api, const Interaction &event);
+  void send_goodbye(Api &api, const MemberRemoveEvent &event);
+  void on_message_reaction_add(Api &api, const ReactionAddEvent &event);
+  void on_message_reaction_remove(Api &api, const ReactionRemoveEvent &event);
+  void on_button_click(Api &api, const Interaction &event);
+  void on_member_screened(Api &api, const MemberScreenedEvent &event);
+
+private:
+  template <typename F> void call(F &&f);
+
+  std::atomic<Lease> current;
+  std::mutex load_mutex;
+  std::filesystem::path path;
+  std::uint64_t generation{0};
+  std::atomic<Api *> registered_with{nullptr};
+};
+
+#endif // HANDLER_MODULE_H
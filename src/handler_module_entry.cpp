@@ -0,0 +1,19 @@
+#include "handler_module.h"
+#include "handlers.h"
+
+/**
+ * @brief The entry point looked for by HandlerModule::load
+ */
+extern "C" const HandlerModuleTable *louloute_handlers() {
+  static const HandlerModuleTable table{handler_module_abi,
+                                        handler_module_layout,
+                                        &register_bot,
+                                        &on_slashcommand,
+                                        &on_autocomplete,
+                                        &send_goodbye,
+                                        &on_message_reaction_add,
+                                        &on_message_reaction_remove,
+                                        &on_button_click,
+                                        &on_member_screened};
+  return &table;
+}
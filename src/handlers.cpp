@@ -0,0 +1,757 @@
+#include "handlers.h"
+#include "charte_backfill.h"
+#include "event_arena.h"
+#include "metrics.h"
+#include "profiling.h"
+#include "reaction_debouncer.h"
+#include "reaction_roles.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <memory_resource>
+#include <ranges>
+#include <unordered_map>
+#include <vector>
+
+template <typename T, typename U> struct default_second {
+  std::pair<T, U> value;
+  operator std::pair<T, U> &() { return value; }
+  operator const std::pair<T, U> &() const { return value; }
+
+  default_second(const T &left) : value{left, U{}} {}
+  default_second(const T &left, const U &right) : value{left, right} {}
+};
+
+struct GlobalCommand {
+  std::string_view help;
+  void (*handle)(BotApi &, const Interaction &);
+
+  std::vector<CommandOption> options;
+  std::uint64_t permissions;
+  bool registered{false};
+
+  void operator()(BotApi &b, const Interaction &e) { handle(b, e); }
+
+  template <size_t N>
+  GlobalCommand(
+      const char (&str)[N], void (*h)(BotApi &, const Interaction &),
+      std::initializer_list<
+          default_second<CommandOption, std::initializer_list<CommandChoice>>>
+          l = {},
+      std::uint64_t p = perm_use_application_commands)
+      : help{str, N - 1}, handle{h}, permissions{p} {
+    options.reserve(l.size());
+    std::ranges::transform(
+        l, std::back_inserter(options),
+        [](const default_second<CommandOption,
+                                std::initializer_list<CommandChoice>> &p)
+            -> CommandOption {
+          auto res{p.value.first};
+          res.choices.reserve(p.value.second.size());
+          std::ranges::transform(
+              p.value.second, std::back_inserter(res.choices),
+              [](const CommandChoice &c) -> CommandChoice { return c; });
+          return res;
+        });
+  }
+};
+
+static void global_help(BotApi &, const Interaction &event);
+static void global_setup(BotApi &, const Interaction &event);
+static void global_test(BotApi &, const Interaction &event);
+static void global_metrics(BotApi &, const Interaction &event);
+static void global_backfill(BotApi &, const Interaction &event);
+static void global_reaction_role(BotApi &, const Interaction &event);
+
+#ifdef LOULOUTEBOT_PROFILING
+static void global_profile(BotApi &, const Interaction &event);
+#endif
+static std::unordered_map<std::string, GlobalCommand> g_global_commands{
+    {"help", {"Au secours!", &global_help}},
+    {"test",
+     {"Test une action",
+      &global_test,
+      {{{.name = "action",
+         .description = "l'action a tester",
+         .required = true},
+        {{"Envoyer goodbye", "goodbye"}}},
+       {{.name = "param",
+         .description = "paramètre de l'action",
+         .required = true}}},
+      0}},
+    {"setup",
+     {"Configuration (Admin)",
+      &global_setup,
+      {{{.name = "param",
+         .description = "Paramètre a modifier",
+         .required = true,
+         .autocomplete = true},
+        {}},
+       {{.name = "value",
+         .description = "Valeur a définir",
+         .required = true,
+         .autocomplete = true}}},
+      perm_administrator}},
+    {"metrics",
+     {"Mémoire et métriques du bot (Admin)", &global_metrics, {},
+      perm_administrator}},
+    {"backfill",
+     {"Donne le rôle de charte à ceux qui l'ont validée avant (Admin)",
+      &global_backfill, {}, perm_administrator}},
+    {"reaction_role",
+     {"Rôles donnés par les réactions à un message (Admin)",
+      &global_reaction_role,
+      {{{.name = "action",
+         .description = "Ajouter, retirer ou lister",
+         .required = true},
+        {{"Ajouter", "add"}, {"Retirer", "remove"}, {"Lister", "list"}}},
+       {{.name = "message", .description = "Lien du message"}},
+       {{.name = "emoji", .description = "Emoji de la réaction"}},
+       {{.name = "role", .description = "Rôle donné", .autocomplete = true}}},
+      perm_administrator}},
+#ifdef LOULOUTEBOT_PROFILING
+    {"profile",
+     {"Allocations et attentes des mutex (Admin)", &global_profile, {},
+      perm_administrator}},
+#endif
+};
+
+static void global_help(BotApi &bot, const Interaction &event) {
+  PROFILE_SCOPE("command/help");
+  ScratchStream oss;
+  oss << R"string(Ne te noie pas !
+Voici la liste des commandes disponibles:)string";
+  for (auto &i : g_global_commands) {
+    oss << "\n- /" << i.first << ": " << i.second.help;
+    for (auto &j : i.second.options)
+      oss << "\n - /" << j.name << ": " << j.description;
+  }
+  bot.interaction_reply(event, oss.str());
+}
+
+// the parameters of /setup, proposed while they are typed
+static constexpr std::array<std::string_view, 5> g_setup_params{
+    "charte_role", "charte_reaction_valider", "charte_message",
+    "charte_bouton", "charte_screening"};
+
+// the custom id of the button validating the charte
+static constexpr std::string_view g_charte_button{"charte_valider"};
+// Discord refuses the longer button labels
+static constexpr std::size_t g_button_label_size{80};
+
+/**
+ * @brief Read the link of a message of the guild, as copied in the client
+ *
+ * @return the error to reply, empty if the link is one of the guild
+ */
+static std::string_view parse_message_url(std::string_view url,
+                                          Snowflake guild_id, Snowflake &chan,
+                                          Snowflake &mess) {
+  auto split{url | std::views::split('/') |
+             std::views::transform([](auto r) {
+               return std::string_view{r.data(), r.size()};
+             })};
+  std::pmr::vector<std::string_view> v{split.begin(), split.end(),
+                                       EventArena::resource()};
+
+  if (v.size() < 3)
+    return "Pas une url";
+
+  Snowflake guild{0};
+  if (!Configuration::to_id(v[v.size() - 3], guild) || guild != guild_id)
+    return "Pas pour ce serveur";
+
+  if (!Configuration::to_id(v[v.size() - 2], chan))
+    chan = 0;
+  if (!Configuration::to_id(v[v.size() - 1], mess))
+    mess = 0;
+  return {};
+}
+
+static void global_setup(BotApi &bot, const Interaction &event) {
+  PROFILE_SCOPE("command/setup");
+  auto value_str = event.parameter("value");
+  auto param_str = event.parameter("param");
+
+  if (!value_str || !param_str)
+    return bot.interaction_reply(event, "Même pas en rêve !");
+
+  if (*param_str == "charte_role") {
+
+    if (value_str->empty())
+      return bot.interaction_reply(event, "Pas de role donné !");
+
+    return bot.interaction_thinking(
+        event, true,
+        [&bot, event, name = *value_str](const ApiResult<> &ccb) {
+          if (ccb.is_error()) {
+            return bot.interaction_edit_response(event, "Erreur");
+          }
+
+          bot.role_find(
+              event.guild_id, name,
+              [&bot, event, name](const ApiResult<ApiRole> &callback) {
+                if (callback.is_error()) {
+                  bot.interaction_edit_response(event, "Role non trouvé");
+                  LogError{} << "role non trouvé: "
+                             << callback.get_error().message;
+                  return;
+                }
+
+                const auto &r = callback.get();
+
+                if (!r.id) {
+                  bot.interaction_edit_response(event, "Role non trouvé");
+                  LogError{} << "role non trouvé: " << name;
+                  return;
+                }
+
+                g_guild_configs.set_guild_charte_role(event.guild_id,
+                                                      std::to_string(r.id));
+                // the members who validated before get the role
+                g_charte_backfill.start(bot, event.guild_id);
+                return bot.interaction_edit_response(event, "Okay");
+              });
+        });
+
+  } else if (*param_str == "charte_reaction_valider") {
+
+    if (value_str->empty())
+      return bot.interaction_reply(event, "Pas de réaction donné !");
+
+    g_guild_configs.set_guild_charte_reaction_valider(event.guild_id,
+                                                      *value_str);
+
+    return bot.interaction_reply(event, "Okay");
+  } else if (*param_str == "charte_message") {
+
+    Snowflake chan{0};
+    Snowflake mess{0};
+    if (auto error = parse_message_url(*value_str, event.guild_id, chan, mess);
+        !error.empty())
+      return bot.interaction_reply(event, std::string{error});
+
+    return bot.interaction_thinking(event, true, [&bot, event, chan, mess](
+                                                     const ApiResult<> &ccb) {
+      if (ccb.is_error()) {
+        return bot.interaction_edit_response(event, "Erreur");
+      }
+
+      bot.message_get(chan, mess, [&bot, event, mess, chan](
+                                      const ApiResult<ApiMessage> &callback) {
+        if (callback.is_error()) {
+          bot.interaction_edit_response(event, "message non trouvé");
+          LogError{} << "message non trouvé: " << callback.get_error().message;
+          return;
+        }
+
+        const auto &m = callback.get();
+
+        if (m.reactions.empty()) {
+          return bot.interaction_edit_response(event,
+                                               "Pas de réaction trouvé");
+        }
+
+        auto reaction_valider =
+            g_guild_configs.get_guild_charte_reaction_valider(event.guild_id);
+
+        if (std::ranges::find_if(m.reactions, [&reaction_valider](
+                                                  const ApiReaction &r) {
+              return std::string_view{r.emoji_name} == reaction_valider;
+            }) == end(m.reactions)) {
+          return bot.interaction_edit_response(
+              event, "Réaction de validation non trouvé");
+        }
+
+        g_guild_configs.set_guild_charte_message(event.guild_id, chan, mess);
+        g_charte_backfill.start(bot, event.guild_id);
+        bot.interaction_edit_response(event, "Effectué");
+      });
+    });
+
+  } else if (*param_str == "charte_screening") {
+
+    if (*value_str != "oui" && *value_str != "non")
+      return bot.interaction_reply(event, "oui ou non !");
+
+    g_guild_configs.set_guild_charte_screening(event.guild_id,
+                                               *value_str == "oui");
+
+    return bot.interaction_reply(event, "Okay");
+  } else if (*param_str == "charte_bouton") {
+
+    if (value_str->empty() || value_str->size() > g_button_label_size)
+      return bot.interaction_reply(event, "Texte du bouton vide ou trop long");
+
+    if (!g_guild_configs.get_guild_charte_role(event.guild_id))
+      return bot.interaction_reply(event, "Pas de role de charte");
+
+    // the button is posted where the command is typed, below the charte
+    return bot.interaction_thinking(
+        event, true, [&bot, event, label = *value_str](const ApiResult<> &ccb) {
+          if (ccb.is_error())
+            return bot.interaction_edit_response(event, "Erreur");
+
+          bot.message_create_button(
+              event.guild_id, event.channel_id, "Pour valider la charte:",
+              {std::string{g_charte_button}, label},
+              [&bot, event](const ApiResult<> &callback) {
+                if (callback.is_error()) {
+                  LogError{} << "bouton non envoyé: "
+                             << callback.get_error().message;
+                  return bot.interaction_edit_response(event,
+                                                       "Bouton non envoyé");
+                }
+                bot.interaction_edit_response(event, "Effectué");
+              });
+        });
+
+  } else {
+    return bot.interaction_reply(event, "paramètre inconnu");
+  }
+  bot.interaction_reply(event, "Effectué");
+}
+
+static void global_reaction_role(BotApi &bot, const Interaction &event) {
+  PROFILE_SCOPE("command/reaction_role");
+  const auto *action = event.parameter("action");
+  if (!action)
+    return bot.interaction_reply(event, "Même pas en rêve !");
+
+  if (*action == "list") {
+    auto rules = g_guild_configs.get_guild_reaction_roles(event.guild_id);
+    if (rules.empty())
+      return bot.interaction_reply(event, "Pas de rôle de réaction");
+    ScratchStream oss;
+    oss << "Rôles de réaction:";
+    for (auto &r : rules) {
+      oss << "\n- https://discord.com/channels/" << event.guild_id << '/'
+          << r.channel << '/' << r.message << ' ';
+      // the custom emojis are kept as their id
+      if (Snowflake id{0}; Configuration::to_id(r.emoji, id))
+        oss << "<:emoji:" << id << '>';
+      else
+        oss << r.emoji;
+      oss << " <@&" << r.role << '>';
+    }
+    // a message is limited to 2000 characters
+    return bot.interaction_reply(event,
+                                 std::string{oss.view().substr(0, 2000)});
+  }
+
+  if (*action != "add" && *action != "remove")
+    return bot.interaction_reply(event, "Action inconnue");
+
+  const auto *message = event.parameter("message");
+  const auto *emoji = event.parameter("emoji");
+  const auto *role = event.parameter("role");
+  if (!message || !emoji || !role || role->empty())
+    return bot.interaction_reply(event,
+                                 "Il faut le message, l'emoji et le rôle !");
+
+  ReactionRole rule;
+  if (auto error = parse_message_url(*message, event.guild_id, rule.channel,
+                                     rule.message);
+      !error.empty())
+    return bot.interaction_reply(event, std::string{error});
+  if (!rule.channel || !rule.message)
+    return bot.interaction_reply(event, "Pas une url");
+  rule.emoji = normalize_emoji(*emoji);
+  // the fields of a rule are separated by ':' in the configuration
+  if (rule.emoji.empty() || rule.emoji.find(':') != std::string::npos)
+    return bot.interaction_reply(event, "Pas un emoji");
+
+  return bot.interaction_thinking(
+      event, true,
+      [&bot, event, rule = std::move(rule), name = *role,
+       add = *action == "add"](const ApiResult<> &ccb) mutable {
+        if (ccb.is_error())
+          return bot.interaction_edit_response(event, "Erreur");
+
+        bot.role_find(
+            event.guild_id, name,
+            [&bot, event, rule = std::move(rule), name,
+             add](const ApiResult<ApiRole> &callback) mutable {
+              if (callback.is_error() || !callback.get().id) {
+                bot.interaction_edit_response(event, "Role non trouvé");
+                LogError{} << "role non trouvé: " << name;
+                return;
+              }
+              rule.role = callback.get().id;
+              if (add)
+                return bot.interaction_edit_response(
+                    event,
+                    g_guild_configs.add_reaction_role(event.guild_id, rule)
+                        ? "Effectué"
+                        : "Déjà configuré");
+              bot.interaction_edit_response(
+                  event,
+                  g_guild_configs.remove_reaction_role(event.guild_id, rule)
+                      ? "Effectué"
+                      : "Pas configuré");
+            });
+      });
+}
+
+static void global_backfill(BotApi &bot, const Interaction &event) {
+  PROFILE_SCOPE("command/backfill");
+  if (!g_charte_backfill.start(bot, event.guild_id))
+    return bot.interaction_reply(
+        event, "Charte pas configurée, ou rattrapage déjà en cours");
+  bot.interaction_reply(event, "Rattrapage lancé");
+}
+
+// another goodbye channel is looked for at most this many times
+static constexpr unsigned g_goodbye_retries{2};
+
+static void send_goodbye(BotApi &bot, const MemberRemoveEvent &event,
+                         unsigned retries) {
+  g_guild_configs.get_guild_goodbye_channel(
+      bot, event.guild_id,
+      [&bot, event, retries](Snowflake guild_id,
+                             Snowflake goodbye_channel_id) {
+        ScratchStream oss;
+        oss << "Bye bye on t'aimait bien " << event.username;
+        bot.message_create(
+            guild_id, goodbye_channel_id, oss.str(),
+            [&bot, guild_id, event, retries](const ApiResult<> &ccb) {
+              if (!ccb.is_error())
+                return;
+              // the channel is not the culprit, the guild keeps failing
+              if (ccb.get_error().code == api_error_circuit_open)
+                return;
+              g_guild_configs.clear_guild_goodbye_channel(guild_id);
+              if (!retries) {
+                LogError{} << "Pas de salon pour dire au revoir dans "
+                           << guild_id;
+                return;
+              }
+              send_goodbye(bot, event, retries - 1);
+            });
+      });
+}
+
+void send_goodbye(BotApi &bot, const MemberRemoveEvent &event) {
+  EventScope scope;
+  PROFILE_SCOPE("handler/goodbye");
+  send_goodbye(bot, event, g_goodbye_retries);
+}
+
+void register_bot(BotApi &bot) {
+  EventScope scope;
+  PROFILE_SCOPE("handler/register");
+
+  bot.global_commands_get(
+      [&bot](const ApiResult<std::vector<CommandDefinition>> &ccb) {
+        if (ccb.is_error()) {
+          LogError{} << ccb.get_error().message;
+          return;
+        }
+        const auto &list = ccb.get();
+        for (auto &i : list) {
+          LogInformational{} << "Global command " << i.name << " is set";
+          bool is_ok{false};
+          for (auto &j : g_global_commands) {
+            if (i.name != j.first)
+              continue;
+
+            if (j.second.permissions != i.permissions)
+              break;
+
+            if (j.second.options.size() != i.options.size())
+              break;
+
+            std::vector<bool> option_found;
+            option_found.resize(j.second.options.size(), false);
+
+            for (size_t idx = 0; auto &k : i.options) {
+              bool option_ok{false};
+              for (auto &l : j.second.options) {
+                if (k.name != l.name)
+                  continue;
+
+                if (k.autocomplete != l.autocomplete)
+                  break;
+
+                if (k.choices.size() != l.choices.size())
+                  break;
+
+                std::vector<bool> choice_found;
+                choice_found.resize(l.choices.size(), false);
+                for (size_t choise_idx = 0; auto &m : l.choices) {
+                  bool choice_ok{false};
+                  for (auto &n : k.choices) {
+                    if (m.name != n.name)
+                      continue;
+
+                    choice_ok = true;
+                    break;
+                  }
+
+                  if (!choice_ok)
+                    break;
+
+                  choice_found[choise_idx] = true;
+                  ++choise_idx;
+                }
+
+                if (std::ranges::find(choice_found, false) ==
+                    end(choice_found))
+                  option_ok = true;
+                break;
+              }
+              if (!option_ok) {
+                break;
+              }
+              option_found[idx] = true;
+              ++idx;
+            }
+            if (std::ranges::find(option_found, false) == end(option_found)) {
+              j.second.registered = true;
+              is_ok = true;
+              LogInformational{} << "Keep";
+              break;
+            }
+          }
+          if (!is_ok) {
+            LogInformational{} << "Delete";
+            bot.global_command_delete(i.id);
+          }
+        }
+
+        for (auto &i : g_global_commands) {
+          if (!i.second.registered) {
+            LogInformational{} << "Create Global command " << i.first;
+            bot.global_command_create(
+                {0,
+                 i.first,
+                 {i.second.help.begin(), i.second.help.end()},
+                 i.second.permissions,
+                 i.second.options});
+          }
+        }
+      });
+}
+
+static void global_test(BotApi &bot, const Interaction &event) {
+  PROFILE_SCOPE("command/test");
+  auto action_str = event.parameter("action");
+  auto param_str = event.parameter("param");
+
+  if (!action_str || !param_str)
+    return bot.interaction_reply(event, "Même pas en rêve !");
+
+  if (*action_str == "goodbye") {
+    send_goodbye(bot, {event.guild_id, 0, *param_str});
+  } else {
+    LogError{} << "Action " << *action_str << " inconnue";
+    return bot.interaction_reply(event, "Action inconnu");
+  }
+
+  bot.interaction_reply(event, "Effectué");
+}
+
+/**
+ * @brief The commands showing the whole process are for its operators: the
+ * user LOULOUTEBOT_OWNER, or the administrators of LOULOUTEBOT_ADMIN_GUILD
+ */
+static bool is_operator(const Interaction &event) {
+  auto env_id = [](const char *name) {
+    Snowflake id{0};
+    auto value = std::getenv(name);
+    if (!value || !Configuration::to_id(value, id))
+      id = 0;
+    return id;
+  };
+  static const Snowflake owner = env_id("LOULOUTEBOT_OWNER");
+  static const Snowflake admin_guild = env_id("LOULOUTEBOT_ADMIN_GUILD");
+  return (owner && event.user_id == owner) ||
+         (admin_guild && event.guild_id == admin_guild);
+}
+
+static void global_metrics(BotApi &bot, const Interaction &event) {
+  PROFILE_SCOPE("command/metrics");
+  if (!is_operator(event))
+    return bot.interaction_reply(event, "Réservé aux opérateurs du bot");
+  ScratchStream oss;
+  Metrics::instance().write_memory_summary(oss);
+  oss << "\n```\n";
+  Metrics::instance().write(oss);
+  // a message is limited to 2000 characters
+  auto content = oss.view().substr(0, 2000 - 4);
+  bot.interaction_reply(event, std::string{content} + "\n```");
+}
+
+#ifdef LOULOUTEBOT_PROFILING
+static void global_profile(BotApi &bot, const Interaction &event) {
+  if (!is_operator(event))
+    return bot.interaction_reply(event, "Réservé aux opérateurs du bot");
+  ScratchStream oss;
+  profiling_report(oss);
+  // a message is limited to 2000 characters
+  auto report = oss.view().substr(0, 2000 - 8);
+  bot.interaction_reply(event, "```\n" + std::string{report} + "\n```");
+}
+#endif
+
+void on_slashcommand(BotApi &bot, const Interaction &event) {
+  EventScope scope;
+  PROFILE_SCOPE("handler/slashcommand");
+  dispatch_command(g_global_commands, event.command, bot, event);
+}
+
+void on_autocomplete(BotApi &bot, const Interaction &event) {
+  EventScope scope;
+  PROFILE_SCOPE("handler/autocomplete");
+  const auto *focused = event.parameter(event.focused);
+  const auto typed =
+      focused ? std::string_view{*focused} : std::string_view{};
+  const auto *param = event.parameter("param");
+
+  if (event.command == "setup" && event.focused == "param") {
+    std::vector<CommandChoice> choices;
+    for (auto p : g_setup_params)
+      if (starts_with_folded(p, typed))
+        choices.push_back({std::string{p}, std::string{p}});
+    return bot.interaction_autocomplete(event, std::move(choices));
+  }
+
+  if ((event.command == "setup" && event.focused == "value" && param &&
+       *param == "charte_role") ||
+      (event.command == "reaction_role" && event.focused == "role"))
+    return bot.roles_complete(
+        event.guild_id, std::string{typed}, max_autocomplete_choices,
+        [&bot, event](const ApiResult<std::vector<ApiRole>> &callback) {
+          std::vector<CommandChoice> choices;
+          if (callback.is_error())
+            LogError{} << "roles non trouvés: "
+                       << callback.get_error().message;
+          else
+            for (auto &r : callback.get())
+              choices.push_back({r.name, r.name});
+          bot.interaction_autocomplete(event, std::move(choices));
+        });
+
+  // nothing to propose, Discord waits for an answer anyway
+  bot.interaction_autocomplete(event, {});
+}
+
+/**
+ * @brief The charte role of the guild, if the reaction is the one validating
+ * its charte
+ */
+static Snowflake charte_role(Snowflake guild, Snowflake channel,
+                             Snowflake message, std::string_view emoji) {
+  if (!guild) {
+    LogError{} << "Pas de guild";
+    return 0;
+  }
+
+  switch (g_guild_configs.match_charte_reaction(guild, channel, message,
+                                                emoji)) {
+  case CharteMatch::wrong_message:
+    LogError{} << "Pas le bon message";
+    return 0;
+
+  case CharteMatch::wrong_emoji:
+    LogError{} << "Pas le bon emoji: "
+               << g_guild_configs.get_guild_charte_reaction_valider(guild)
+               << " <=> " << emoji;
+    return 0;
+
+  case CharteMatch::accepted:
+    break;
+  }
+
+  auto r = g_guild_configs.get_guild_charte_role(guild);
+  // unset, or cleared when the role was deleted
+  if (!r)
+    LogError{} << "Pas de role de charte";
+  return r;
+}
+
+/**
+ * @brief Give or take back the roles of the reaction: those of the reaction
+ * roles it matches, else the charte role
+ */
+static void on_reaction(BotApi &bot, Snowflake guild, Snowflake channel,
+                        Snowflake message, Snowflake user, Snowflake emoji_id,
+                        std::string_view emoji_name, bool granted) {
+  std::pmr::vector<Snowflake> roles{EventArena::resource()};
+  if (guild && g_guild_configs.match_reaction_roles(guild, message, emoji_id,
+                                                    emoji_name, roles)) {
+    for (auto r : roles)
+      g_reaction_debouncer.set(bot, guild, user, r, granted);
+    return;
+  }
+  if (auto r = charte_role(guild, channel, message, emoji_name))
+    g_reaction_debouncer.set(bot, guild, user, r, granted);
+}
+
+void on_message_reaction_add(BotApi &bot, const ReactionAddEvent &event) {
+  EventScope scope;
+  PROFILE_SCOPE("handler/reaction_add");
+  on_reaction(bot, event.guild_id, event.channel_id, event.message_id,
+              event.user_id, event.emoji_id, event.emoji_name, true);
+}
+
+void on_message_reaction_remove(BotApi &bot,
+                                const ReactionRemoveEvent &event) {
+  EventScope scope;
+  PROFILE_SCOPE("handler/reaction_remove");
+  on_reaction(bot, event.guild_id, event.channel_id, event.message_id,
+              event.user_id, event.emoji_id, event.emoji_name, false);
+}
+
+void on_button_click(BotApi &bot, const Interaction &event) {
+  EventScope scope;
+  PROFILE_SCOPE("handler/button_click");
+  if (event.command != g_charte_button) {
+    LogError{} << "Bouton inconnu: " << event.command;
+    return bot.interaction_reply(event, "Bouton inconnu");
+  }
+
+  auto r = event.guild_id
+               ? g_guild_configs.get_guild_charte_role(event.guild_id)
+               : Snowflake{0};
+  // unset, or cleared when the role was deleted
+  if (!r) {
+    LogError{} << "Pas de role de charte";
+    return bot.interaction_reply(event, "Pas de role de charte");
+  }
+
+  bot.interaction_thinking(event, true, [&bot, event,
+                                         r](const ApiResult<> &ccb) {
+    // the clicks in a row of a member give a single call, each click is
+    // answered once it is done
+    g_reaction_debouncer.set(
+        bot, event.guild_id, event.user_id, r, true,
+        [&bot, event, deferred = !ccb.is_error()](const ApiResult<> &res) {
+          if (!deferred)
+            return;
+          if (res.is_error()) {
+            LogError{} << res.get_error().message;
+            return bot.interaction_edit_response(
+                event, "Impossible de donner le rôle de la charte, réessaie "
+                       "plus tard");
+          }
+          bot.interaction_edit_response(event, "Charte validée !");
+        });
+  });
+}
+
+void on_member_screened(BotApi &bot, const MemberScreenedEvent &event) {
+  EventScope scope;
+  PROFILE_SCOPE("handler/member_screened");
+  if (!g_guild_configs.get_guild_charte_screening(event.guild_id))
+    return;
+
+  auto r = g_guild_configs.get_guild_charte_role(event.guild_id);
+  // unset, or cleared when the role was deleted
+  if (!r) {
+    LogError{} << "Pas de role de charte";
+    return;
+  }
+  g_reaction_debouncer.set(bot, event.guild_id, event.user_id, r, true);
+}
@@ -0,0 +1,58 @@
+#ifndef HANDLERS_H
+#define HANDLERS_H
+
+#include "bot_api.h"
+#include "guild_config.h"
+
+#include <utility>
+
+/**
+ * @brief Look for the named command and run it
+ *
+ * @param commands The command table
+ * @param name The command to run
+ * @param args The arguments forwarded to the command
+ * @return true if the command was found, else false
+ */
+template <typename Map, typename... Args>
+bool dispatch_command(Map &commands, const typename Map::key_type &name,
+                      Args &&...args) {
+  auto idx = commands.find(name);
+  if (idx == std::end(commands))
+    return false;
+  idx->second(std::forward<Args>(args)...);
+  return true;
+}
+
+/**
+ * @brief Check the global commands registered on Discord and create or
+ * delete them to match the bot commands
+ */
+void register_bot(BotApi &bot);
+
+void on_slashcommand(BotApi &bot, const Interaction &event);
+
+/**
+ * @brief Propose the values of the option being typed, answered from the
+ * role index when the bot has one
+ */
+void on_autocomplete(BotApi &bot, const Interaction &event);
+
+void send_goodbye(BotApi &bot, const MemberRemoveEvent &event);
+
+void on_message_reaction_add(BotApi &bot, const ReactionAddEvent &event);
+void on_message_reaction_remove(BotApi &bot,
+                                const ReactionRemoveEvent &event);
+
+/**
+ * @brief The clicks on the buttons of the bot, the charte validation
+ */
+void on_button_click(BotApi &bot, const Interaction &event);
+
+/**
+ * @brief A member accepted the rules screening, the charte role is given
+ * if the guild validates its charte this way
+ */
+void on_member_screened(BotApi &bot, const MemberScreenedEvent &event);
+
+#endif // HANDLERS_H
@@ -0,0 +1,316 @@
+#ifndef JSON_SCANNER_H
+#define JSON_SCANNER_H
+
+#include "bot_api.h"
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Pull reader of a JSON text, the values not asked for are skipped
+ * without being decoded
+ */
+class JsonScanner {
+  // the bytes looked for while scanning, find_first_of calls memchr on each
+  // byte of the text
+  enum ByteClass : std::uint8_t {
+    quote = 1,
+    backslash = 2,
+    opening = 4,
+    closing = 8
+  };
+  static constexpr auto byte_classes = [] {
+    std::array<std::uint8_t, 256> t{};
+    t['"'] = quote;
+    t['\\'] = backslash;
+    t['{'] = t['['] = opening;
+    t['}'] = t[']'] = closing;
+    return t;
+  }();
+
+public:
+  explicit JsonScanner(std::string_view t, std::size_t p = 0)
+      : text{t}, pos{p} {}
+
+  [[nodiscard]] bool ok() const { return !failed; }
+
+  /**
+   * @brief Call f(key, *this) for each member, f returns false when it
+   * didn't read the value so it is skipped
+   */
+  template <typename F> bool object(F &&f) {
+    if (!expect('{'))
+      return false;
+    if (peek() == '}')
+      return expect('}');
+    do {
+      ws();
+      auto key = raw_string();
+      if (failed || !expect(':'))
+        return fail();
+      if (!f(key, *this))
+        skip();
+      if (failed)
+        return false;
+    } while (accept(','));
+    return expect('}');
+  }
+
+  /**
+   * @brief Call f(*this) for each element, f must read the element
+   */
+  template <typename F> bool array(F &&f) {
+    if (!expect('['))
+      return false;
+    if (peek() == ']')
+      return expect(']');
+    do {
+      f(*this);
+      if (failed)
+        return false;
+    } while (accept(','));
+    return expect(']');
+  }
+
+  bool string(std::string &out) {
+    out.clear();
+    if (!expect('"'))
+      return false;
+    for (;;) {
+      auto end = find(quote | backslash);
+      if (end == text.size())
+        return fail();
+      out.append(text.substr(pos, end - pos));
+      pos = end + 1;
+      if (text[end] == '"')
+        return true;
+      if (!escape(out))
+        return false;
+    }
+  }
+
+  /**
+   * @brief An id, sent as a string of digits
+   */
+  bool snowflake(Snowflake &out) {
+    ws();
+    if (peek() != '"')
+      return integer(out);
+    ++pos;
+    auto end = text.find('"', pos);
+    if (end == std::string_view::npos)
+      return fail();
+    auto [ptr, ec] = std::from_chars(text.data() + pos, text.data() + end, out);
+    pos = end + 1;
+    return ec == std::errc{} ? true : fail();
+  }
+
+  template <typename T> bool integer(T &out) {
+    ws();
+    auto token = literal();
+    if (token == "null") {
+      out = 0;
+      return true;
+    }
+    auto [ptr, ec] =
+        std::from_chars(token.data(), token.data() + token.size(), out);
+    return ec == std::errc{} ? true : fail();
+  }
+
+  bool boolean(bool &out) {
+    ws();
+    auto token = literal();
+    out = token == "true";
+    return out || token == "false" || token == "null" ? true : fail();
+  }
+
+  bool skip() {
+    ws();
+    switch (peek()) {
+    case '"':
+      raw_string();
+      return ok();
+    case '{':
+    case '[': {
+      std::size_t depth{0};
+      do {
+        auto end = find(quote | opening | closing);
+        if (end == text.size())
+          return fail();
+        pos = end;
+        switch (text[pos]) {
+        case '"':
+          raw_string();
+          continue;
+        case '{':
+        case '[':
+          ++depth;
+          break;
+        default:
+          --depth;
+          break;
+        }
+        ++pos;
+      } while (depth && ok());
+      return ok();
+    }
+    default:
+      return !literal().empty() ? true : fail();
+    }
+  }
+
+private:
+  bool fail() {
+    failed = true;
+    pos = text.size();
+    return false;
+  }
+
+  void ws() {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\n' ||
+                                 text[pos] == '\r' || text[pos] == '\t'))
+      ++pos;
+  }
+
+  char peek() {
+    ws();
+    return pos < text.size() ? text[pos] : '\0';
+  }
+
+  bool accept(char c) {
+    if (peek() != c)
+      return false;
+    ++pos;
+    return true;
+  }
+
+  bool expect(char c) { return accept(c) ? true : fail(); }
+
+  /**
+   * @brief Offset of the next byte of the classes, the size if none
+   */
+  std::size_t find(unsigned classes) const {
+    auto p = pos;
+    while (p < text.size() &&
+           !(byte_classes[static_cast<unsigned char>(text[p])] & classes))
+      ++p;
+    return p;
+  }
+
+  /**
+   * @brief The content of a string without decoding it
+   */
+  std::string_view raw_string() {
+    if (!expect('"'))
+      return {};
+    const auto begin = pos;
+    for (;;) {
+      // memchr is vectorized, the escapes are rare enough to be checked
+      // backwards from the quote found
+      auto end = text.find('"', pos);
+      if (end == std::string_view::npos) {
+        fail();
+        return {};
+      }
+      pos = end + 1;
+      std::size_t backslashes{0};
+      while (end - backslashes > begin && text[end - backslashes - 1] == '\\')
+        ++backslashes;
+      if (backslashes % 2 == 0)
+        return text.substr(begin, end - begin);
+    }
+  }
+
+  std::string_view literal() {
+    const auto begin = pos;
+    while (pos < text.size() && text[pos] != ',' && text[pos] != '}' &&
+           text[pos] != ']' && text[pos] != ' ' && text[pos] != '\n' &&
+           text[pos] != '\r' && text[pos] != '\t')
+      ++pos;
+    return text.substr(begin, pos - begin);
+  }
+
+  bool hex4(std::uint32_t &out) {
+    if (pos + 4 > text.size())
+      return fail();
+    auto [ptr, ec] =
+        std::from_chars(text.data() + pos, text.data() + pos + 4, out, 16);
+    if (ec != std::errc{} || ptr != text.data() + pos + 4)
+      return fail();
+    pos += 4;
+    return true;
+  }
+
+  bool escape(std::string &out) {
+    if (pos >= text.size())
+      return fail();
+    switch (text[pos++]) {
+    case '"':
+      out += '"';
+      return true;
+    case '\\':
+      out += '\\';
+      return true;
+    case '/':
+      out += '/';
+      return true;
+    case 'b':
+      out += '\b';
+      return true;
+    case 'f':
+      out += '\f';
+      return true;
+    case 'n':
+      out += '\n';
+      return true;
+    case 'r':
+      out += '\r';
+      return true;
+    case 't':
+      out += '\t';
+      return true;
+    case 'u':
+      break;
+    default:
+      return fail();
+    }
+
+    std::uint32_t cp{0};
+    if (!hex4(cp))
+      return false;
+    // the characters out of the BMP are sent as a surrogate pair
+    if (cp >= 0xd800 && cp < 0xdc00 && text.substr(pos, 2) == "\\u") {
+      pos += 2;
+      std::uint32_t low{0};
+      if (!hex4(low))
+        return false;
+      cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+    }
+    if (cp < 0x80) {
+      out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+      out += static_cast<char>(0xc0 | (cp >> 6));
+      out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+      out += static_cast<char>(0xe0 | (cp >> 12));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+      out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else {
+      out += static_cast<char>(0xf0 | (cp >> 18));
+      out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+      out += static_cast<char>(0x80 | (cp & 0x3f));
+    }
+    return true;
+  }
+
+  std::string_view text;
+  std::size_t pos;
+  bool failed{false};
+};
+
+#endif // JSON_SCANNER_H
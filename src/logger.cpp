@@ -80,6 +80,7 @@ StdlogBackend::StdlogBackend()
 
 void StdlogBackend::write(LogLevel l, std::string_view sv)
 {
+  PROFILE_SCOPE("log/stdlog");
   static const char *colors[] = {"\033[0;33;41;5;1m",
                                  "\033[0;37;41;5;1m",
                                  "\033[0;37;43;5;1m",
@@ -89,7 +90,7 @@ void StdlogBackend::write(LogLevel l, std::string_view sv)
                                  "\033[0m",
                                  "\033[0m"};
   static const char *norm = "\033[0m";
-  static std::mutex log_mutex;
+  static ProfiledMutex log_mutex{"stdlog"};
 
   std::unique_lock lk{log_mutex};
   const char *c = colors[0];
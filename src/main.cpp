@@ -1,451 +1,134 @@
+#include "caching_bot_api.h"
+#include "charte_backfill.h"
+#include "circuit_breaker.h"
 #include "configuration.h"
+#include "dispatch_dedupe.h"
+#include "dpp_bot_api.h"
+#include "guild_directory.h"
+#include "guild_config.h"
+#include "handler_module.h"
+#include "metrics.h"
+#include "profiling.h"
+#include "reaction_debouncer.h"
+#include "screening.h"
 #include <dpp/dpp.h>
 
-#include <concepts>
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_set>
 
 #ifndef BOT_TOKEN
 #error Pas de token de bot defini
 #endif
 
-std::filesystem::path g_config_file{"config.ini"};
-
-class GuildConfig {
-  Configuration guilds_config;
-
-public:
-  GuildConfig() = default;
-
-  Configuration &operator=(Configuration &&lhs) {
-    guilds_config = std::forward<Configuration>(lhs);
-    return guilds_config;
-  }
-
-  template <class F>
-    requires std::invocable<F, dpp::snowflake, dpp::snowflake>
-  void get_guild_goodbye_channel(dpp::cluster &bot, dpp::snowflake guild_id,
-                                 F &&callback) {
-    const auto &guild_config = guilds_config[guild_id.str()];
-
-    auto channel_id = guild_config.get<dpp::snowflake>("goodbye_channel", "0");
-
-    if (!channel_id.empty()) {
-      return callback(guild_id, channel_id);
-    }
-
-    bot.channels_get(
-        guild_id, [this, guild_id, callback = std::forward<F>(callback)](
-                      const dpp::confirmation_callback_t &ccb) {
-          if (ccb.is_error()) {
-            return dpp::utility::log_error()(ccb);
-          }
-          const auto &channels = ccb.get<dpp::channel_map>();
-          for (auto &i : channels) {
-            if (i.second.get_type() == dpp::CHANNEL_TEXT) {
-              auto &new_guild_config = guilds_config[guild_id.str()];
-              new_guild_config.set("goodbye_channel", i.first.str());
-              Configuration::to_file(guilds_config, g_config_file);
-              return callback(guild_id, i.first);
-            }
-          }
-        });
-  }
-
-  void clear_guild_goodbye_channel(dpp::snowflake guild_id) {
-    guilds_config.set(guild_id.str(), "goodbye_channel", "0");
-    Configuration::to_file(guilds_config, g_config_file);
-  }
-
-  void set_guild_charte_message(dpp::snowflake guild_id, dpp::snowflake channel,
-                                dpp::snowflake message) {
-    auto &c = guilds_config[guild_id.str()];
-    c.set("charte_channel", channel.str());
-    c.set("charte_message", message.str());
-
-    Configuration::to_file(guilds_config, g_config_file);
-  }
-
-  void set_guild_charte_reaction_valider(dpp::snowflake guild_id,
-                                         const std::string &reaction) {
-    auto &c = guilds_config[guild_id.str()];
-    c.set("charte_reaction_valider", reaction);
-
-    Configuration::to_file(guilds_config, g_config_file);
-  }
-
-  void set_guild_charte_role(dpp::snowflake guild_id, const std::string &role) {
-    auto &c = guilds_config[guild_id.str()];
-    c.set("charte_role", role);
-
-    Configuration::to_file(guilds_config, g_config_file);
-  }
-
-  std::string get_guild_charte_role(dpp::snowflake guild_id) const {
-    auto &c = guilds_config[guild_id.str()];
-    return c.get<std::string>("charte_role", "");
-  }
-
-  std::string get_guild_charte_reaction_valider(dpp::snowflake guild_id) const {
-    auto &c = guilds_config[guild_id.str()];
-    return c.get<std::string>("charte_reaction_valider");
-  }
-
-  std::pair<std::string, std::string>
-  get_guild_charte_message(dpp::snowflake guild_id) const {
-    std::pair<std::string, std::string> res;
-    auto &c = guilds_config[guild_id.str()];
-    res.first = c.get<std::string>("charte_channel");
-    res.second = c.get<std::string>("charte_message");
-    return res;
-  }
-};
-
-template <typename T, typename U> struct default_second {
-  std::pair<T, U> value;
-  operator std::pair<T, U> &() { return value; }
-  operator const std::pair<T, U> &() const { return value; }
-
-  default_second(const T &left) : value{left, U{}} {}
-  default_second(const T &left, const U &right) : value{left, right} {}
-};
-
-struct GlobalCommand {
-  std::string_view help;
-  void (*handle)(dpp::cluster &, const dpp::slashcommand_t &);
-
-  std::vector<dpp::command_option> options;
-  dpp::permission permissions;
-  bool registered{false};
-
-  void operator()(dpp::cluster &b, const dpp::slashcommand_t &e) {
-    handle(b, e);
-  }
-
-  template <size_t N>
-  GlobalCommand(
-      const char (&str)[N],
-      void (*h)(dpp::cluster &, const dpp::slashcommand_t &),
-      std::initializer_list<
-          default_second<dpp::command_option,
-                         std::initializer_list<dpp::command_option_choice>>>
-          l = {},
-      dpp::permission p = dpp::p_use_application_commands)
-      : help{str, N - 1}, handle{h}, permissions{p} {
-    options.reserve(l.size());
-    std::ranges::transform(
-        l, std::back_inserter(options),
-        [](const default_second<
-            dpp::command_option,
-            std::initializer_list<dpp::command_option_choice>> &p)
-            -> dpp::command_option {
-          auto res{p.value.first};
-          res.choices.reserve(p.value.second.size());
-          std::ranges::transform(
-              p.value.second, std::back_inserter(res.choices),
-              [](const dpp::command_option_choice &c)
-                  -> dpp::command_option_choice { return c; });
-          return res;
-        });
-  }
-};
-
-static void global_help(dpp::cluster &, const dpp::slashcommand_t &event);
-static void global_setup(dpp::cluster &, const dpp::slashcommand_t &event);
-static void global_test(dpp::cluster &, const dpp::slashcommand_t &event);
-static std::unordered_map<std::string, GlobalCommand> g_global_commands{
-    {"help", {"Au secours!", &global_help}},
-    {"test",
-     {"Test une action",
-      &global_test,
-      {{{dpp::co_string, "action", "l'action a tester", true},
-        {{"Envoyer goodbye", "goodbye"}}},
-       {{dpp::co_string, "param", "paramètre de l'action", true}}},
-      0}},
-    {"setup",
-     {"Configuration (Admin)",
-      &global_setup,
-      {{{dpp::co_string, "param", "Paramètre a modifier", true}, {}},
-       {{dpp::co_string, "value", "Valeur a définir", true}}},
-      dpp::p_administrator}},
-};
-
-static GuildConfig g_guild_configs;
-
-static void global_help(dpp::cluster &, const dpp::slashcommand_t &event) {
-  std::ostringstream oss;
-  oss << R"string(Ne te noie pas !
-Voici la liste des commandes disponibles:)string";
-  for (auto &i : g_global_commands) {
-    oss << "\n- /" << i.first << ": " << i.second.help;
-    for (auto &j : i.second.options)
-      oss << "\n - /" << j.name << ": " << j.description;
-  }
-  event.reply(oss.str());
-}
-
-static void global_setup(dpp::cluster &bot, const dpp::slashcommand_t &event) {
-  auto value = event.get_parameter("value");
-  auto param = event.get_parameter("param");
-  auto value_str = std::get_if<std::string>(&value);
-  auto param_str = std::get_if<std::string>(&param);
-
-  if (!value_str || !param_str)
-    return event.reply("Même pas en rêve !");
-
-  if (*param_str == "charte_role") {
-
-    if (value_str->empty())
-      return event.reply("Pas de role donné !");
-
-    return event.thinking(true, [&bot, event, name = *value_str](
-                                    const dpp::confirmation_callback_t &ccb) {
-      if (ccb.is_error()) {
-        return event.edit_original_response(dpp::message("Erreur"));
-      }
-
-      bot.roles_get(
-          event.command.guild_id,
-          [event, name](const dpp::confirmation_callback_t &callback) {
-            if (callback.is_error()) {
-              event.edit_original_response(dpp::message("Role non trouvé"));
-              LogError{} << "role non trouvé: " << callback.get_error().message;
-              return;
-            }
-
-            const auto &m = callback.get<dpp::role_map>();
-
-            auto r = std::ranges::find_if(
-                m, [&name](const auto &r) { return r.second.name == name; });
-
-            if (r == end(m)) {
-              event.edit_original_response(dpp::message("Role non trouvé"));
-              LogError{} << "role non trouvé: " << callback.get_error().message;
-              return;
-            }
-
-            g_guild_configs.set_guild_charte_role(event.command.guild_id,
-                                                  r->first.str());
-            return event.edit_original_response(dpp::message("Okay"));
-          });
-    });
-
-  } else if (*param_str == "charte_reaction_valider") {
-
-    if (value_str->empty())
-      return event.reply("Pas de réaction donné !");
-
-    g_guild_configs.set_guild_charte_reaction_valider(event.command.guild_id,
-                                                      *value_str);
-
-    return event.reply("Okay");
-  } else if (*param_str == "charte_message") {
-
-    auto split{*value_str | std::views::split('/') |
-               std::views::transform([](auto r) {
-                 return std::string_view{r.data(), r.size()};
-               })};
-    auto v = std::vector<std::string_view>{split.begin(), split.end()};
-
-    if (v.size() < 3) {
-      return event.reply("Pas une url");
-    }
-
-    if (event.command.guild_id.str() != v[v.size() - 3]) {
-      return event.reply("Pas pour ce serveur");
-    }
-
-    return event.thinking(true, [&bot, event,
-                                 chan = std::string{v[v.size() - 2]},
-                                 mess = std::string{v[v.size() - 1]}](
-                                    const dpp::confirmation_callback_t &ccb) {
-      if (ccb.is_error()) {
-        return event.edit_original_response(dpp::message("Erreur"));
-      }
-
-      bot.message_get(
-          mess, chan,
-          [event, mess, chan](const dpp::confirmation_callback_t &callback) {
-            if (callback.is_error()) {
-              event.edit_original_response(dpp::message("message non trouvé"));
-              LogError{} << "message non trouvé: "
-                         << callback.get_error().message;
-              return;
-            }
-
-            const auto &m = callback.get<dpp::message>();
-
-            if (m.reactions.empty()) {
-              return event.edit_original_response(
-                  dpp::message("Pas de réaction trouvé"));
-            }
-
-            auto reaction_valider =
-                g_guild_configs.get_guild_charte_reaction_valider(
-                    event.command.guild_id);
-
-            if (std::ranges::find_if(
-                    m.reactions, [&reaction_valider](const dpp::reaction &r) {
-                      return r.emoji_name == reaction_valider;
-                    }) == end(m.reactions)) {
-              return event.edit_original_response(
-                  dpp::message("Réaction de validation non trouvé"));
-            }
-
-            g_guild_configs.set_guild_charte_message(event.command.guild_id,
-                                                     chan, mess);
-            event.edit_original_response(dpp::message("Effectué"));
-          });
-    });
-
-  } else {
-    return event.reply("paramètre inconnu");
-  }
-  event.reply("Effectué");
-}
-
-static void send_goodbye(dpp::cluster &bot,
-                         const dpp::guild_member_remove_t &event) {
-  g_guild_configs.get_guild_goodbye_channel(
-      bot, event.guild_id,
-      [&bot, event](dpp::snowflake guild_id,
-                    dpp::snowflake goodbye_channel_id) {
-        std::ostringstream oss;
-        oss << "Bye bye on t'aimait bien " << event.removed.username;
-        auto msg =
-            dpp::message(oss.str()).set_guild_id(guild_id).set_channel_id(
-                goodbye_channel_id);
-        bot.message_create(msg, [&bot, guild_id, event](
-                                    const dpp::confirmation_callback_t &ccb) {
-          if (!ccb.is_error())
-            return;
-          g_guild_configs.clear_guild_goodbye_channel(guild_id);
-          send_goodbye(bot, event);
-        });
-      });
-}
-
-static void register_bot(dpp::cluster &bot) {
-
-  bot.global_commands_get([&bot](const dpp::confirmation_callback_t &ccb) {
-    if (ccb.is_error()) {
-      return dpp::utility::log_error()(ccb);
-    }
-    const auto &list = ccb.get<dpp::slashcommand_map>();
-    for (auto &i : list) {
-      LogInformational{} << "Global command " << i.second.name << " is set";
-      bool is_ok{false};
-      for (auto &j : g_global_commands) {
-        if (i.second.name != j.first)
-          continue;
-
-        if (j.second.permissions != i.second.default_member_permissions)
-          break;
-
-        if (j.second.options.size() != i.second.options.size())
-          break;
-
-        std::vector<bool> option_found;
-        option_found.resize(j.second.options.size(), false);
-
-        for (size_t idx = 0; auto &k : i.second.options) {
-          bool option_ok{false};
-          for (auto &l : j.second.options) {
-            if (k.name != l.name)
-              continue;
-
-            if (k.choices.size() != l.choices.size())
-              break;
-
-            std::vector<bool> choice_found;
-            choice_found.resize(l.choices.size(), false);
-            for (size_t choise_idx = 0; auto &m : l.choices) {
-              bool choice_ok{false};
-              for (auto &n : k.choices) {
-                if (m.name != n.name)
-                  continue;
-
-                choice_ok = true;
-                break;
-              }
-
-              if (!choice_ok)
-                break;
-
-              choice_found[choise_idx] = true;
-              ++choise_idx;
-            }
-
-            if (std::ranges::find(choice_found, false) == end(choice_found))
-              option_ok = true;
-            break;
-          }
-          if (!option_ok) {
-            break;
-          }
-          option_found[idx] = true;
-          ++idx;
-        }
-        if (std::ranges::find(option_found, false) == end(option_found)) {
-          j.second.registered = true;
-          is_ok = true;
-          LogInformational{} << "Keep";
-          break;
-        }
-      }
-      if (!is_ok) {
-        LogInformational{} << "Delete";
-        bot.global_command_delete(i.first);
-      }
-    }
+#ifndef HANDLER_MODULE
+#define HANDLER_MODULE "libLoulouteHandlers.so"
+#endif
 
-    for (auto &i : g_global_commands) {
-      if (!i.second.registered) {
-        LogInformational{} << "Create Global command " << i.first;
-        auto c = dpp::slashcommand{
-            i.first, {i.second.help.begin(), i.second.help.end()}, bot.me.id};
-        c.set_default_permissions(i.second.permissions);
-        for (const auto &j : i.second.options) {
-          c.add_option(j);
-        }
-        bot.global_command_create(c);
-      }
-    }
+std::filesystem::path g_config_file{"config.ini"};
+std::filesystem::path g_metrics_file{};
+
+/**
+ * @brief Add the DPP caches to the memory metrics
+ */
+static void register_dpp_metrics() {
+  auto &metrics = Metrics::instance();
+  metrics.add_memory("dpp_guilds",
+                     [] { return dpp::get_guild_cache()->bytes(); });
+  metrics.add_memory("dpp_roles",
+                     [] { return dpp::get_role_cache()->bytes(); });
+  metrics.add_memory("dpp_channels",
+                     [] { return dpp::get_channel_cache()->bytes(); });
+  metrics.add_memory("dpp_users",
+                     [] { return dpp::get_user_cache()->bytes(); });
+  metrics.add_memory("dpp_emojis",
+                     [] { return dpp::get_emoji_cache()->bytes(); });
+  // the members are stored in their guild, not in a cache
+  metrics.add_memory("dpp_members", [] {
+    auto cache = dpp::get_guild_cache();
+    std::shared_lock lk{cache->get_mutex()};
+    std::size_t bytes{0};
+    for (auto &[id, g] : cache->get_container())
+      bytes += g->members.size() *
+               (sizeof(dpp::guild_member) + sizeof(dpp::snowflake) +
+                2 * sizeof(void *));
+    return bytes;
+  });
+  metrics.add_gauge("guilds_cached", "Guilds in the DPP cache", [] {
+    return static_cast<double>(dpp::get_guild_cache()->count());
   });
-}
-
-static void global_test(dpp::cluster &bot, const dpp::slashcommand_t &event) {
-  auto action = event.get_parameter("action");
-  auto param = event.get_parameter("param");
-  auto action_str = std::get_if<std::string>(&action);
-  auto param_str = std::get_if<std::string>(&param);
-
-  if (!action_str || !param_str)
-    return event.reply("Même pas en rêve !");
-
-  auto u = event.command.get_issuing_user();
-
-  if (*action_str == "goodbye") {
-    auto ev = dpp::guild_member_remove_t();
-    ev.guild_id = event.command.guild_id;
-    ev.removed.username = *param_str;
-    send_goodbye(bot, ev);
-  } else {
-    LogError{} << "Action " << *action_str << " inconnue";
-    return event.reply("Action inconnu");
-  }
-
-  event.reply("Effectué");
 }
 
 int main(int argc, char *const argv[]) {
 
+#ifdef LOULOUTEBOT_PROFILING
+  // before any thread is started, they inherit the blocked signal
+  profiling_report_on_signal(SIGUSR1);
+#endif
+
   LogBase::setLevel(LogLevel::Debugging);
 
   if (argc > 1)
     g_config_file = argv[1];
+  if (argc > 2)
+    g_metrics_file = argv[2];
+
+  // the handlers can be replaced by a new build with SIGHUP, the gateway
+  // sessions stay connected
+  std::filesystem::path module_file{HANDLER_MODULE};
+  if (auto file = std::getenv("LOULOUTEBOT_HANDLERS"))
+    module_file = file;
+  HandlerModule handlers;
+  if (!handlers.load(module_file))
+    return 1;
+  handlers.reload_on_signal(SIGHUP);
+
+  // indexed while the gateway connects, each guild is parsed on first use
+  g_guild_configs.load(g_config_file);
+  g_guild_configs.set_file(g_config_file);
+  // the bot processes of the host share their settings through this segment
+  if (auto name = std::getenv("LOULOUTEBOT_SHARED_CONFIG"))
+    if (!g_guild_configs.share(name))
+      LogWarning{} << "Configuration partagée " << name
+                   << " inutilisable, configuration locale utilisée";
+
+  // the channels and roles the handlers use are kept by the directory, DPP
+  // only caches the guilds
+  dpp::cache_policy_t cache_policy;
+  cache_policy.user_policy = dpp::cp_none;
+  cache_policy.emoji_policy = dpp::cp_none;
+  cache_policy.role_policy = dpp::cp_none;
+  cache_policy.channel_policy = dpp::cp_none;
+  GuildDirectory directory;
+  ScreeningTracker screening;
+  DispatchDeduplicator dispatches;
+
+  // the members events give the rules screening and the roles of the bot
+  // kept by the directory, the intent must be enabled on the developer
+  // portal or Discord closes the connection
+  auto intents = static_cast<std::uint32_t>(dpp::i_default_intents |
+                                            dpp::i_guild_members);
+  // the guilds validating their charte with the button and without reaction
+  // roles need no reaction event, most of the inbound events are dropped
+  if (std::getenv("LOULOUTEBOT_NO_REACTIONS")) {
+    intents &= ~static_cast<std::uint32_t>(dpp::i_guild_message_reactions);
+    LogNotice{} << "Événements des réactions non reçus";
+  }
 
-  g_guild_configs = Configuration::from_file(g_config_file);
-
-  dpp::cluster bot(BOT_TOKEN);
+  // each start identifies again and gets a GUILD_CREATE of every guild, a
+  // session is not resumed across restarts: the id of the bot, the directory
+  // and the screening are only built from READY and GUILD_CREATE, and DPP
+  // gives no hook to seed a shard from its own thread before it connects
+  dpp::cluster bot(BOT_TOKEN, intents, 0, 0, 1, true, cache_policy);
+  DppBotApi dpp_api{bot, &directory};
+  // below the cache, the cached answers are still given while open
+  CircuitBreaker breaker;
+  CircuitBreakerBotApi guarded_api{dpp_api, breaker};
+  CachingBotApi cached_api{guarded_api};
+  HandlerModule::Api api{cached_api};
 
   bot.on_log([](const dpp::log_t &l) {
     switch (l.severity) {
@@ -476,55 +159,232 @@ int main(int argc, char *const argv[]) {
     }
   });
 
-  bot.on_slashcommand([&bot](const dpp::slashcommand_t &event) {
-    auto command = event.command.get_command_name();
-    auto idx = g_global_commands.find(command);
-    if (idx == std::end(g_global_commands))
-      return;
-    idx->second(bot, event);
+  bot.on_slashcommand([&](const dpp::slashcommand_t &event) {
+    handlers.on_slashcommand(api, to_interaction(event));
   });
 
-  bot.on_guild_member_remove([&bot](const dpp::guild_member_remove_t &event) {
-    send_goodbye(bot, event);
+  bot.on_autocomplete([&](const dpp::autocomplete_t &event) {
+    handlers.on_autocomplete(api, to_interaction(event));
   });
 
-  bot.on_ready([&bot](const dpp::ready_t &) {
+  bot.on_button_click([&](const dpp::button_click_t &event) {
+    handlers.on_button_click(api, to_interaction(event));
+  });
+
+  // a resumed session may send again the events already handled
+  bot.on_guild_member_remove([&](const dpp::guild_member_remove_t &event) {
+    if (!dispatches.replayed(DispatchDeduplicator::Event::member_remove,
+                             event.raw_event))
+      handlers.send_goodbye(api, to_event(event));
+  });
+
+  auto update_directory = [&directory](GuildDirectory::Event e) {
+    return [&directory, e](const dpp::event_dispatch_t &event) {
+      directory.ingest(e, event.raw_event);
+    };
+  };
+  bot.on_ready(update_directory(GuildDirectory::Event::ready));
+  bot.on_guild_create(update_directory(GuildDirectory::Event::guild_create));
+  bot.on_guild_update(update_directory(GuildDirectory::Event::guild_update));
+  bot.on_guild_delete(update_directory(GuildDirectory::Event::guild_delete));
+  bot.on_channel_create(
+      update_directory(GuildDirectory::Event::channel_create));
+  bot.on_channel_update(
+      update_directory(GuildDirectory::Event::channel_update));
+  bot.on_channel_delete(
+      update_directory(GuildDirectory::Event::channel_delete));
+  bot.on_guild_role_create(
+      update_directory(GuildDirectory::Event::role_create));
+  bot.on_guild_role_update(
+      update_directory(GuildDirectory::Event::role_update));
+  bot.on_guild_role_delete(
+      update_directory(GuildDirectory::Event::role_delete));
+  // only the roles of the bot are kept, for its permissions
+  bot.on_guild_member_update(
+      update_directory(GuildDirectory::Event::member_update));
+
+  // the members passing the rules screening accept the charte
+  auto update_screening = [&](ScreeningTracker::Event e) {
+    return [&, e](const dpp::event_dispatch_t &event) {
+      if (auto accepted = screening.ingest(e, event.raw_event))
+        handlers.on_member_screened(api, *accepted);
+    };
+  };
+  bot.on_guild_create(update_screening(ScreeningTracker::Event::guild_create));
+  bot.on_guild_delete(update_screening(ScreeningTracker::Event::guild_delete));
+  bot.on_guild_member_add(
+      update_screening(ScreeningTracker::Event::member_add));
+  bot.on_guild_member_update(
+      update_screening(ScreeningTracker::Event::member_update));
+  bot.on_guild_member_remove(
+      update_screening(ScreeningTracker::Event::member_remove));
+
+  auto invalidate_cache = [&cached_api](CacheEvent e) {
+    return [&cached_api, e](const dpp::event_dispatch_t &event) {
+      cached_api.invalidate(e, event.raw_event);
+    };
+  };
+  bot.on_ready(invalidate_cache(CacheEvent::ready));
+  bot.on_guild_create(invalidate_cache(CacheEvent::guild));
+  bot.on_guild_update(invalidate_cache(CacheEvent::guild));
+  bot.on_guild_delete(invalidate_cache(CacheEvent::guild));
+  bot.on_channel_create(invalidate_cache(CacheEvent::channel));
+  bot.on_channel_update(invalidate_cache(CacheEvent::channel));
+  bot.on_channel_delete(invalidate_cache(CacheEvent::channel));
+  bot.on_guild_role_create(invalidate_cache(CacheEvent::role));
+  bot.on_guild_role_update(invalidate_cache(CacheEvent::role));
+  bot.on_guild_role_delete(invalidate_cache(CacheEvent::role));
+  bot.on_guild_member_update(invalidate_cache(CacheEvent::member));
+  bot.on_message_update(invalidate_cache(CacheEvent::message));
+  bot.on_message_delete(invalidate_cache(CacheEvent::message));
+  bot.on_message_delete_bulk(invalidate_cache(CacheEvent::message_bulk));
+  bot.on_message_reaction_add(invalidate_cache(CacheEvent::reaction));
+  bot.on_message_reaction_remove(invalidate_cache(CacheEvent::reaction));
+  bot.on_message_reaction_remove_all(invalidate_cache(CacheEvent::reaction));
+  bot.on_message_reaction_remove_emoji(
+      invalidate_cache(CacheEvent::reaction));
+
+  // the settings never keep a reference to something deleted, so no REST
+  // call is done against it
+  auto forget_deleted = [](DeletedEvent e) {
+    return [e](const dpp::event_dispatch_t &event) {
+      g_guild_configs.forget_deleted(e, event.raw_event);
+    };
+  };
+  bot.on_channel_delete(forget_deleted(DeletedEvent::channel_delete));
+  bot.on_guild_role_delete(forget_deleted(DeletedEvent::role_delete));
+  bot.on_message_delete(forget_deleted(DeletedEvent::message_delete));
+  bot.on_message_delete_bulk(
+      forget_deleted(DeletedEvent::message_delete_bulk));
+
+  // the routes of the commands need the id of the bot, known from READY
+  bot.on_ready([&](const dpp::ready_t &) {
     if (dpp::run_once<struct register_bot_commands>()) {
-      register_bot(bot);
+      handlers.register_bot(api);
     }
   });
 
-  bot.on_message_reaction_add([&bot](const dpp::message_reaction_add_t &event) {
-    if (!event.reacting_guild) {
-      LogError{} << "Pas de guild";
-      return;
-    }
-    auto [chan, mess] =
-        g_guild_configs.get_guild_charte_message(event.reacting_guild->id);
-    if (chan != event.channel_id.str() || mess != event.message_id.str()) {
-      LogError{} << "Pas le bon message";
+  // the validations made while the bot was away get their role, once: the
+  // guilds sent again after an outage or a new identify were seen already
+  std::mutex backfilled_mutex;
+  std::unordered_set<Snowflake> backfilled;
+  bot.on_guild_create([&](const dpp::guild_create_t &event) {
+    if (!event.created || event.created->is_unavailable())
       return;
+    {
+      std::lock_guard lk{backfilled_mutex};
+      if (!backfilled.insert(event.created->id).second)
+        return;
     }
+    g_charte_backfill.start(api, event.created->id);
+  });
 
-    auto emoji = g_guild_configs.get_guild_charte_reaction_valider(
-        event.reacting_guild->id);
-    if (emoji != event.reacting_emoji.name) {
-      LogError{} << "Pas le bon emoji: " << emoji << " <=> "
-                 << event.reacting_emoji.name;
-      return;
+  // most reactions are on messages nobody watches, they are dropped from
+  // the ids DPP read before the names are copied and the handlers called
+  std::atomic<std::uint64_t> reactions_dropped{0};
+  auto watched = [&](DispatchDeduplicator::Event e, const dpp::guild *guild,
+                     Snowflake channel, Snowflake message,
+                     const dpp::emoji &emoji,
+                     const dpp::event_dispatch_t &event) {
+    if (!guild || !g_guild_configs.watches_reaction(guild->id, channel,
+                                                    message, emoji.id,
+                                                    emoji.name)) {
+      reactions_dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
     }
+    // only the watched ones are remembered
+    return !dispatches.replayed(e, event.raw_event);
+  };
+  bot.on_message_reaction_add([&](const dpp::message_reaction_add_t &event) {
+    if (watched(DispatchDeduplicator::Event::reaction_add,
+                event.reacting_guild, event.channel_id, event.message_id,
+                event.reacting_emoji, event))
+      handlers.on_message_reaction_add(api, to_event(event));
+  });
+  bot.on_message_reaction_remove(
+      [&](const dpp::message_reaction_remove_t &event) {
+        if (watched(DispatchDeduplicator::Event::reaction_remove,
+                    event.reacting_guild, event.channel_id, event.message_id,
+                    event.reacting_emoji, event))
+          handlers.on_message_reaction_remove(api, to_event(event));
+      });
 
-    auto r = g_guild_configs.get_guild_charte_role(event.reacting_guild->id);
-
-    bot.guild_member_add_role(
-        event.reacting_guild->id, event.reacting_user.id, r,
-        [event](const dpp::confirmation_callback_t &ccb) {
-          if (ccb.is_error()) {
-            return dpp::utility::log_error()(ccb);
-          }
-          LogError{} << "User accepté: " << event.reacting_user.username;
-        });
+  register_metrics();
+  register_dpp_metrics();
+  Metrics::instance().add_memory(
+      "guild_directory", [&directory] { return directory.memory_usage(); });
+  Metrics::instance().add_memory(
+      "api_cache", [&cached_api] { return cached_api.memory_usage(); });
+  Metrics::instance().add_gauge(
+      "api_cache_hits", "Read calls answered by the cache", [&cached_api] {
+        return static_cast<double>(cached_api.hits());
+      });
+  Metrics::instance().add_gauge(
+      "api_cache_misses", "Read calls sent to Discord by the cache",
+      [&cached_api] { return static_cast<double>(cached_api.misses()); });
+  Metrics::instance().add_gauge(
+      "api_cache_coalesced", "Read calls answered by the same call in flight",
+      [&cached_api] { return static_cast<double>(cached_api.coalesced()); });
+  Metrics::instance().add_gauge(
+      "circuits_open", "Guild routes whose calls are refused",
+      [&breaker] { return static_cast<double>(breaker.open_count()); });
+  Metrics::instance().add_gauge(
+      "circuit_refused", "Calls refused by an open circuit",
+      [&breaker] { return static_cast<double>(breaker.refused()); });
+  Metrics::instance().add_gauge(
+      "charte_backfill_running", "Guilds whose charte backfill is running",
+      [] { return static_cast<double>(g_charte_backfill.running()); });
+  Metrics::instance().add_gauge(
+      "charte_backfill_reactions", "Charte reactions read by the backfills",
+      [] { return static_cast<double>(g_charte_backfill.reactions()); });
+  Metrics::instance().add_gauge(
+      "charte_backfill_members", "Members read by the backfills",
+      [] { return static_cast<double>(g_charte_backfill.members()); });
+  Metrics::instance().add_gauge(
+      "charte_backfill_granted", "Charte roles given by the backfills",
+      [] { return static_cast<double>(g_charte_backfill.granted()); });
+  Metrics::instance().add_gauge(
+      "charte_backfill_failed", "Charte roles the backfills failed to give",
+      [] { return static_cast<double>(g_charte_backfill.failed()); });
+  Metrics::instance().add_gauge(
+      "charte_role_pending", "Members whose charte role change is debounced",
+      [] { return static_cast<double>(g_reaction_debouncer.size()); });
+  Metrics::instance().add_gauge(
+      "charte_role_collapsed",
+      "Charte reactions replaced by a later one before their call",
+      [] { return static_cast<double>(g_reaction_debouncer.collapsed()); });
+  Metrics::instance().add_memory("reaction_debouncer", [] {
+    return g_reaction_debouncer.memory_usage();
   });
+  Metrics::instance().add_gauge(
+      "reactions_dropped", "Reactions on no watched message",
+      [&reactions_dropped] {
+        return static_cast<double>(
+            reactions_dropped.load(std::memory_order_relaxed));
+      });
+  Metrics::instance().add_gauge(
+      "dispatch_replays", "Events sent again after a resume, not handled",
+      [&dispatches] { return static_cast<double>(dispatches.hits()); });
+  Metrics::instance().add_gauge(
+      "dispatch_replay_ratio", "Share of the checked events sent again",
+      [&dispatches] {
+        const auto checks = dispatches.checks();
+        return checks ? static_cast<double>(dispatches.hits()) /
+                            static_cast<double>(checks)
+                      : 0.0;
+      });
+  Metrics::instance().add_memory(
+      "dispatch_dedupe", [&dispatches] { return dispatches.memory_usage(); });
+  Metrics::instance().add_gauge(
+      "screening_pending", "Members who did not pass the rules screening",
+      [&screening] { return static_cast<double>(screening.size()); });
+  Metrics::instance().add_memory(
+      "screening", [&screening] { return screening.memory_usage(); });
+  Metrics::instance().add_gauge(
+      "handler_modules", "Handler modules mapped, the draining ones included",
+      [] { return static_cast<double>(HandlerModule::mapped_count()); });
+  Metrics::instance().start_reporting(std::chrono::minutes{10},
+                                      g_metrics_file);
 
   bot.start(dpp::st_wait);
 }
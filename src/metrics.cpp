@@ -0,0 +1,111 @@
+#include "metrics.h"
+#include "configuration.h"
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+Metrics &Metrics::instance() {
+  static Metrics m;
+  return m;
+}
+
+Metrics::~Metrics() noexcept { stop_reporting(); }
+
+void Metrics::add_gauge(std::string name, std::string help, Reader reader) {
+  std::lock_guard lk{mutex};
+  gauges.push_back({std::move(name), std::move(help), std::move(reader)});
+}
+
+void Metrics::add_memory(std::string subsystem, SizeReader bytes) {
+  std::lock_guard lk{mutex};
+  memory.push_back({std::move(subsystem), std::move(bytes)});
+}
+
+void Metrics::set_guild_count(SizeReader count) {
+  std::lock_guard lk{mutex};
+  guild_count = std::move(count);
+}
+
+void Metrics::write(std::ostream &os) const {
+  std::lock_guard lk{mutex};
+  for (auto &g : gauges)
+    os << "# HELP louloute_" << g.name << ' ' << g.help << "\n# TYPE louloute_"
+       << g.name << " gauge\nlouloute_" << g.name << ' ' << g.reader() << '\n';
+
+  if (guild_count)
+    os << "# HELP louloute_guilds Guilds with a configuration section\n"
+          "# TYPE louloute_guilds gauge\nlouloute_guilds "
+       << guild_count() << '\n';
+
+  if (memory.empty())
+    return;
+  os << "# HELP louloute_memory_bytes Estimated bytes used by a subsystem\n"
+        "# TYPE louloute_memory_bytes gauge\n";
+  for (auto &m : memory)
+    os << "louloute_memory_bytes{subsystem=\"" << m.subsystem << "\"} "
+       << m.bytes() << '\n';
+}
+
+void Metrics::write_memory_summary(std::ostream &os) const {
+  std::lock_guard lk{mutex};
+  const std::size_t guilds = guild_count ? guild_count() : 0;
+  std::size_t total{0};
+  os << "Mémoire (" << guilds << " guilds):";
+  for (auto &m : memory) {
+    auto bytes = m.bytes();
+    total += bytes;
+    os << ' ' << m.subsystem << ' ' << bytes / 1024 << " KiB";
+    if (guilds)
+      os << " (" << bytes / guilds << " B/guild)";
+    os << ',';
+  }
+  os << " total " << total / 1024 << " KiB";
+}
+
+void Metrics::report(const std::filesystem::path &textfile) const {
+  std::ostringstream summary;
+  write_memory_summary(summary);
+  LogNotice{} << summary.str();
+
+  if (textfile.empty())
+    return;
+  // written aside then renamed, so the collector never reads half a file
+  auto tmp = textfile;
+  tmp += ".tmp";
+  {
+    std::ofstream os{tmp};
+    if (!os.is_open()) {
+      LogError{} << "Impossible d'écrire " << tmp;
+      return;
+    }
+    write(os);
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, textfile, ec);
+  if (ec)
+    LogError{} << "Impossible d'écrire " << textfile << ": " << ec.message();
+}
+
+void Metrics::start_reporting(std::chrono::seconds period,
+                              std::filesystem::path textfile) {
+  stop_reporting();
+  reporter_stop = false;
+  reporter = std::thread{[this, period, textfile = std::move(textfile)] {
+    std::unique_lock lk{reporter_mutex};
+    while (!reporter_wake.wait_for(lk, period,
+                                   [this] { return reporter_stop; }))
+      report(textfile);
+  }};
+}
+
+void Metrics::stop_reporting() {
+  if (!reporter.joinable())
+    return;
+  {
+    std::lock_guard lk{reporter_mutex};
+    reporter_stop = true;
+  }
+  reporter_wake.notify_all();
+  reporter.join();
+}
@@ -0,0 +1,92 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Values of the bot read when they are exported
+ * The export uses the Prometheus text format, so the file written by the
+ * reporter can be served by the node_exporter textfile collector
+ */
+class Metrics {
+public:
+  using Reader = std::function<double()>;
+  using SizeReader = std::function<std::size_t()>;
+
+  static Metrics &instance();
+
+  Metrics(const Metrics &) = delete;
+  Metrics &operator=(const Metrics &) = delete;
+  ~Metrics() noexcept;
+
+  /**
+   * @brief Add a value exported as louloute_<name>
+   */
+  void add_gauge(std::string name, std::string help, Reader reader);
+
+  /**
+   * @brief Add the bytes used by a subsystem, exported as
+   * louloute_memory_bytes{subsystem="..."} and in the memory summary
+   */
+  void add_memory(std::string subsystem, SizeReader bytes);
+
+  /**
+   * @brief Set the count of guilds the memory per guild is computed with
+   */
+  void set_guild_count(SizeReader count);
+
+  /**
+   * @brief Write every value in the Prometheus text format
+   */
+  void write(std::ostream &os) const;
+
+  /**
+   * @brief Write the bytes per subsystem and per guild on one line
+   */
+  void write_memory_summary(std::ostream &os) const;
+
+  /**
+   * @brief Log the memory summary, and write the metrics to the file if
+   * not empty, at each period
+   */
+  void start_reporting(std::chrono::seconds period,
+                       std::filesystem::path textfile = {});
+  void stop_reporting();
+
+private:
+  Metrics() = default;
+
+  struct Gauge {
+    std::string name;
+    std::string help;
+    Reader reader;
+  };
+
+  struct Memory {
+    std::string subsystem;
+    SizeReader bytes;
+  };
+
+  void report(const std::filesystem::path &textfile) const;
+
+  mutable std::mutex mutex;
+  std::vector<Gauge> gauges;
+  std::vector<Memory> memory;
+  SizeReader guild_count;
+
+  std::mutex reporter_mutex;
+  std::condition_variable reporter_wake;
+  bool reporter_stop{false};
+  std::thread reporter;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,207 @@
+#include "profiling.h"
+#include "configuration.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string_view>
+#include <thread>
+
+#ifndef WIN32
+#include <csignal>
+#include <pthread.h>
+#endif
+
+namespace {
+
+// constant initialized, usable by operator new before the static
+// constructors ran
+std::atomic<ProfileTag *> g_tags{nullptr};
+std::atomic<LockStats *> g_locks{nullptr};
+std::atomic<std::uint64_t> g_untagged_allocations{0};
+std::atomic<std::uint64_t> g_untagged_bytes{0};
+thread_local ProfileTag *g_current_tag{nullptr};
+
+template <typename T> void push(std::atomic<T *> &head, T *node) {
+  node->next = head.load(std::memory_order_relaxed);
+  while (!head.compare_exchange_weak(node->next, node,
+                                     std::memory_order_release,
+                                     std::memory_order_relaxed))
+    ;
+}
+
+void count(std::size_t size) noexcept {
+  if (auto t = g_current_tag) {
+    t->allocations.fetch_add(1, std::memory_order_relaxed);
+    t->bytes.fetch_add(size, std::memory_order_relaxed);
+  } else {
+    g_untagged_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_untagged_bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+}
+
+void *counted_alloc(std::size_t size) {
+  count(size);
+  if (auto p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc{};
+}
+
+void *counted_alloc(std::size_t size, std::align_val_t al) {
+  count(size);
+  const auto align = static_cast<std::size_t>(al);
+  if (auto p = std::aligned_alloc(align, (size + align - 1) / align * align))
+    return p;
+  throw std::bad_alloc{};
+}
+
+/**
+ * @brief Upper bound of the bucket containing the given part of the waits
+ */
+std::uint64_t percentile(const LockStats &l, std::uint64_t total,
+                         std::uint64_t per_cent) {
+  std::uint64_t seen{0};
+  for (std::size_t i = 0; i < LockStats::bucket_count; ++i) {
+    seen += l.waits[i].load(std::memory_order_relaxed);
+    if (seen * 100 >= total * per_cent)
+      return i ? std::uint64_t{1} << i : 0;
+  }
+  return std::uint64_t{1} << (LockStats::bucket_count - 1);
+}
+
+} // namespace
+
+void *operator new(std::size_t size) { return counted_alloc(size); }
+void *operator new[](std::size_t size) { return counted_alloc(size); }
+void *operator new(std::size_t size, std::align_val_t al) {
+  return counted_alloc(size, al);
+}
+void *operator new[](std::size_t size, std::align_val_t al) {
+  return counted_alloc(size, al);
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+ProfileTag::ProfileTag(const char *n) : name{n} { push(g_tags, this); }
+
+ProfileScope::ProfileScope(ProfileTag &tag) noexcept
+    : previous{g_current_tag} {
+  g_current_tag = &tag;
+}
+
+ProfileScope::~ProfileScope() noexcept { g_current_tag = previous; }
+
+LockStats &LockStats::get(const char *name) {
+  static std::mutex registry_mutex;
+  std::lock_guard lk{registry_mutex};
+  for (auto l = g_locks.load(std::memory_order_acquire); l; l = l->next)
+    if (!std::strcmp(l->name, name))
+      return *l;
+  auto l = new LockStats{name};
+  push(g_locks, l);
+  return *l;
+}
+
+void LockStats::add_wait(std::uint64_t ns) {
+  auto bucket = std::min<std::size_t>(std::bit_width(ns), bucket_count - 1);
+  waits[bucket].fetch_add(1, std::memory_order_relaxed);
+  wait_ns.fetch_add(ns, std::memory_order_relaxed);
+  auto max = max_wait_ns.load(std::memory_order_relaxed);
+  while (ns > max && !max_wait_ns.compare_exchange_weak(
+                         max, ns, std::memory_order_relaxed))
+    ;
+}
+
+void ProfiledMutex::lock() {
+  if (m.try_lock()) {
+    stats.add_wait(0);
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  m.lock();
+  auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start);
+  // a contended wait lands at least in bucket 1
+  stats.add_wait(std::max<std::uint64_t>(waited.count(), 1));
+}
+
+void profiling_report(std::ostream &os) {
+  // a scope in a template or an inline function has a tag per instance
+  std::map<std::string_view, std::pair<std::uint64_t, std::uint64_t>> tags;
+  for (auto t = g_tags.load(std::memory_order_acquire); t; t = t->next) {
+    auto &[allocations, bytes] = tags[t->name];
+    allocations += t->allocations.load(std::memory_order_relaxed);
+    bytes += t->bytes.load(std::memory_order_relaxed);
+  }
+
+  os << std::setfill(' ') << std::left << std::setw(32) << "tag" << std::right
+     << std::setw(12) << "allocs" << std::setw(16) << "bytes" << '\n';
+  for (auto &[name, counts] : tags)
+    os << std::left << std::setw(32) << name << std::right << std::setw(12)
+       << counts.first << std::setw(16) << counts.second << '\n';
+  os << std::left << std::setw(32) << "untagged" << std::right << std::setw(12)
+     << g_untagged_allocations.load(std::memory_order_relaxed)
+     << std::setw(16) << g_untagged_bytes.load(std::memory_order_relaxed)
+     << "\n\n";
+
+  os << std::left << std::setw(24) << "mutex" << std::right << std::setw(12)
+     << "locks" << std::setw(12) << "contended" << std::setw(12) << "wait us"
+     << std::setw(12) << "p50 ns" << std::setw(12) << "p99 ns"
+     << std::setw(12) << "max ns" << '\n';
+  for (auto l = g_locks.load(std::memory_order_acquire); l; l = l->next) {
+    std::uint64_t total{0};
+    for (auto &w : l->waits)
+      total += w.load(std::memory_order_relaxed);
+    if (!total)
+      continue;
+    auto uncontended = l->waits[0].load(std::memory_order_relaxed);
+    os << std::left << std::setw(24) << l->name << std::right << std::setw(12)
+       << total << std::setw(12) << total - uncontended << std::setw(12)
+       << l->wait_ns.load(std::memory_order_relaxed) / 1000 << std::setw(12)
+       << percentile(*l, total, 50) << std::setw(12)
+       << percentile(*l, total, 99) << std::setw(12)
+       << l->max_wait_ns.load(std::memory_order_relaxed) << '\n';
+  }
+}
+
+void profiling_report_on_signal(int sig) {
+#ifndef WIN32
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, sig);
+  if (pthread_sigmask(SIG_BLOCK, &set, nullptr)) {
+    LogError{} << "Impossible de bloquer le signal " << sig;
+    return;
+  }
+  std::thread{[set] {
+    for (;;) {
+      int received{0};
+      if (sigwait(&set, &received))
+        return;
+      std::ostringstream oss;
+      profiling_report(oss);
+      LogNotice{} << "Profilage:\n" << oss.str();
+    }
+  }}.detach();
+#else
+  LogWarning{} << "Pas de rapport de profilage sur signal " << sig;
+#endif
+}
@@ -0,0 +1,123 @@
+#ifndef PROFILING_H
+#define PROFILING_H
+
+#include <mutex>
+
+#ifdef LOULOUTEBOT_PROFILING
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+/**
+ * @brief Allocation counters of a handler or a subsystem
+ * The tags are static objects linked in a global list on construction
+ */
+class ProfileTag {
+public:
+  explicit ProfileTag(const char *n);
+  ProfileTag(const ProfileTag &) = delete;
+  ProfileTag &operator=(const ProfileTag &) = delete;
+
+  const char *const name;
+  std::atomic<std::uint64_t> allocations{0};
+  std::atomic<std::uint64_t> bytes{0};
+  ProfileTag *next{nullptr};
+};
+
+/**
+ * @brief Charge the allocations made by the thread to the tag, until the
+ * end of the scope. The innermost scope is charged
+ */
+class ProfileScope {
+public:
+  explicit ProfileScope(ProfileTag &tag) noexcept;
+  ~ProfileScope() noexcept;
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+  ProfileTag *previous;
+};
+
+/**
+ * @brief Histogram of the time spent waiting for the mutexes of a name
+ * Bucket i counts the waits between 2^(i-1) and 2^i ns, bucket 0 the
+ * acquisitions without contention. Never destroyed, shared by every mutex
+ * of the same name
+ */
+class LockStats {
+public:
+  static constexpr std::size_t bucket_count{40};
+
+  static LockStats &get(const char *name);
+
+  void add_wait(std::uint64_t ns);
+
+  const char *const name;
+  std::array<std::atomic<std::uint64_t>, bucket_count> waits{};
+  std::atomic<std::uint64_t> wait_ns{0};
+  std::atomic<std::uint64_t> max_wait_ns{0};
+  LockStats *next{nullptr};
+
+private:
+  explicit LockStats(const char *n) : name{n} {}
+};
+
+/**
+ * @brief Mutex recording the time spent waiting for it
+ */
+class ProfiledMutex {
+public:
+  explicit ProfiledMutex(const char *name) : stats{LockStats::get(name)} {}
+  ProfiledMutex(const ProfiledMutex &) = delete;
+  ProfiledMutex &operator=(const ProfiledMutex &) = delete;
+
+  void lock();
+  bool try_lock() { return m.try_lock(); }
+  void unlock() { m.unlock(); }
+
+private:
+  LockStats &stats;
+  std::mutex m;
+};
+
+/**
+ * @brief Write the allocations per tag and the waits per mutex
+ */
+void profiling_report(std::ostream &os);
+
+/**
+ * @brief Log the report each time the process receive the signal
+ * Must be called before any thread is started, the signal is blocked in
+ * every thread and waited for by a dedicated one
+ */
+void profiling_report_on_signal(int sig);
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+/**
+ * @brief Charge the allocations until the end of the scope to the tag name
+ */
+#define PROFILE_SCOPE(tag_name)                                                \
+  static ProfileTag PROFILE_CONCAT(profile_tag_, __LINE__){tag_name};          \
+  ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__) {                      \
+    PROFILE_CONCAT(profile_tag_, __LINE__)                                     \
+  }
+
+#else
+
+/**
+ * @brief Plain mutex when the profiling is not built
+ */
+class ProfiledMutex : public std::mutex {
+public:
+  explicit ProfiledMutex(const char *) {}
+};
+
+#define PROFILE_SCOPE(tag_name)
+
+#endif // LOULOUTEBOT_PROFILING
+
+#endif // PROFILING_H
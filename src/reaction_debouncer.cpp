@@ -0,0 +1,100 @@
+#include "reaction_debouncer.h"
+#include "configuration.h"
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+ReactionDebouncer g_reaction_debouncer;
+
+void ReactionDebouncer::set(BotApi &bot, Snowflake guild, Snowflake user,
+                            Snowflake role, bool granted,
+                            ApiCallback<> done) {
+  // the flushes re-arm themselves as long as changes come, they must not
+  // hold the module of the handler calling
+  auto &api = bot.process_api();
+  const auto deadline = api.now() + window;
+  if (done)
+    done = bot.keep(std::move(done));
+  bool arm{false};
+  {
+    std::lock_guard lk{mutex};
+    auto [itr, inserted] = pending.try_emplace({guild, user, role}, deadline,
+                                               !granted, granted);
+    if (!inserted) {
+      itr->second.deadline = deadline;
+      itr->second.granted = granted;
+      collapsed_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (done)
+      itr->second.done.push_back(std::move(done));
+    deadlines.emplace_back(deadline, Key{guild, user, role});
+    arm = !std::exchange(armed, true);
+  }
+  if (arm)
+    api.after(window, [this, &api] { flush(api); });
+}
+
+void ReactionDebouncer::flush(BotApi &bot) {
+  std::vector<std::tuple<Snowflake, Snowflake, Snowflake, bool,
+                         std::vector<ApiCallback<>>>>
+      due;
+  std::vector<ApiCallback<>> unchanged;
+  std::chrono::nanoseconds next{0};
+  {
+    std::lock_guard lk{mutex};
+    const auto now = bot.now();
+    while (!deadlines.empty() && deadlines.front().first <= now) {
+      auto [deadline, key] = deadlines.front();
+      deadlines.pop_front();
+      auto itr = pending.find(key);
+      if (itr == std::end(pending) || itr->second.deadline != deadline)
+        continue;
+      if (itr->second.granted != itr->second.initial) {
+        due.emplace_back(key.guild, key.user, key.role, itr->second.granted,
+                         std::move(itr->second.done));
+      } else {
+        collapsed_count.fetch_add(1, std::memory_order_relaxed);
+        std::ranges::move(itr->second.done, std::back_inserter(unchanged));
+      }
+      pending.erase(itr);
+    }
+    armed = !deadlines.empty();
+    if (armed)
+      next = deadlines.front().first - now;
+  }
+
+  for (auto &done : unchanged)
+    done(std::monostate{});
+  for (auto &[guild, user, role, granted, done] : due) {
+    auto log = [user, granted, done = std::move(done)](const ApiResult<> &r) {
+      if (r.is_error())
+        LogError{} << r.get_error().message;
+      else
+        LogError{} << (granted ? "User accepté: " : "User retiré: ") << user;
+      for (auto &i : done)
+        i(r);
+    };
+    if (granted)
+      bot.guild_member_add_role(guild, user, role, log);
+    else
+      bot.guild_member_remove_role(guild, user, role, log);
+  }
+  if (armed)
+    bot.after(next, [this, &bot] { flush(bot); });
+}
+
+std::size_t ReactionDebouncer::size() const {
+  std::lock_guard lk{mutex};
+  return pending.size();
+}
+
+std::size_t ReactionDebouncer::memory_usage() const {
+  std::lock_guard lk{mutex};
+  return pending.size() *
+             (sizeof(decltype(pending)::value_type) + sizeof(void *)) +
+         pending.bucket_count() * sizeof(void *) +
+         deadlines.size() * sizeof(decltype(deadlines)::value_type);
+}
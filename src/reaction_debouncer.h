@@ -0,0 +1,100 @@
+#ifndef REACTION_DEBOUNCER_H
+#define REACTION_DEBOUNCER_H
+
+#include "bot_api.h"
+#include "profiling.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Role grants and removals waiting for the reactions to settle
+ * A member adding and removing a reaction in a row only changes the wanted
+ * state of the role. The call is sent once the state stayed the
+ * same for the window, and not at all if it came back to where it was
+ */
+class ReactionDebouncer {
+public:
+  explicit ReactionDebouncer(
+      std::chrono::nanoseconds window = std::chrono::seconds{2})
+      : window{window} {}
+
+  /**
+   * @brief Record that the member should have the role or not, the call is
+   * sent through the process api of bot once it settled
+   *
+   * @param done called with the result of the call settling the role, or a
+   * success when the role came back to its state and nothing was sent
+   */
+  void set(BotApi &bot, Snowflake guild, Snowflake user, Snowflake role,
+           bool granted, ApiCallback<> done = {});
+
+  /** The roles of members waiting */
+  [[nodiscard]] std::size_t size() const;
+  /** The changes replaced by a later one before being sent */
+  [[nodiscard]] std::uint64_t collapsed() const {
+    return collapsed_count.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Estimated heap memory of the waiting changes
+   */
+  [[nodiscard]] std::size_t memory_usage() const;
+
+private:
+  struct Key {
+    Snowflake guild;
+    Snowflake user;
+    Snowflake role;
+
+    bool operator==(const Key &) const = default;
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key &k) const {
+      return std::hash<Snowflake>{}((k.guild * 31 + k.user) * 31 + k.role);
+    }
+  };
+
+  struct Pending {
+    std::chrono::nanoseconds deadline{0};
+    /** The state before the first change, nothing is sent if it is back */
+    bool initial{false};
+    bool granted{false};
+    /** Those waiting for the role to settle, kept through bot */
+    std::vector<ApiCallback<>> done;
+  };
+
+  /**
+   * @brief Send the settled changes, and wait for the next one
+   */
+  void flush(BotApi &bot);
+
+  const std::chrono::nanoseconds window;
+
+  mutable ProfiledMutex mutex{"reaction_debouncer"};
+  std::unordered_map<Key, Pending, KeyHash> pending;
+  /**
+   * In the order of the changes, so of their deadlines. A change pushing
+   * back the deadline of its member leaves its previous one stale here
+   */
+  std::deque<std::pair<std::chrono::nanoseconds, Key>> deadlines;
+  /** A flush is waited for */
+  bool armed{false};
+
+  std::atomic<std::uint64_t> collapsed_count{0};
+};
+
+/**
+ * @brief The waiting reaction role changes, kept by the process so they
+ * survive the handler module reloads
+ */
+extern ReactionDebouncer g_reaction_debouncer;
+
+#endif // REACTION_DEBOUNCER_H
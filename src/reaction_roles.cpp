@@ -0,0 +1,164 @@
+#include "reaction_roles.h"
+#include "configuration.h"
+
+#include <algorithm>
+#include <mutex>
+
+std::string ReactionRole::to_string() const {
+  return std::to_string(channel) + ':' + std::to_string(message) + ':' +
+         emoji + ':' + std::to_string(role);
+}
+
+std::optional<ReactionRole> ReactionRole::parse(std::string_view s) {
+  // the emoji is between the second and the last ':'
+  const auto first = s.find(':');
+  const auto second =
+      first == std::string_view::npos ? first : s.find(':', first + 1);
+  const auto last = s.rfind(':');
+  if (second == std::string_view::npos || last <= second + 1)
+    return std::nullopt;
+  ReactionRole r;
+  if (!Configuration::to_id(s.substr(0, first), r.channel) ||
+      !Configuration::to_id(s.substr(first + 1, second - first - 1),
+                            r.message) ||
+      !Configuration::to_id(s.substr(last + 1), r.role))
+    return std::nullopt;
+  r.emoji = s.substr(second + 1, last - second - 1);
+  return r;
+}
+
+std::uint64_t emoji_key(Snowflake id, std::string_view name) {
+  if (id)
+    return id;
+  // FNV-1a
+  std::uint64_t h{0xcbf29ce484222325ULL};
+  for (unsigned char c : name) {
+    h ^= c;
+    h *= 0x100000001b3ULL;
+  }
+  return h | (1ULL << 63);
+}
+
+std::string normalize_emoji(std::string_view typed) {
+  while (!typed.empty() && typed.front() == ' ')
+    typed.remove_prefix(1);
+  while (!typed.empty() && typed.back() == ' ')
+    typed.remove_suffix(1);
+  if (typed.size() > 2 && typed.front() == '<' && typed.back() == '>') {
+    const auto inner = typed.substr(1, typed.size() - 2);
+    if (Snowflake id{0}; Configuration::to_id(
+            inner.substr(inner.rfind(':') + 1), id))
+      return std::to_string(id);
+  }
+  return std::string{typed};
+}
+
+namespace {
+
+/** The key of the emoji of a rule, written by normalize_emoji */
+std::uint64_t rule_key(std::string_view emoji) {
+  Snowflake id{0};
+  if (Configuration::to_id(emoji, id))
+    return emoji_key(id, {});
+  return emoji_key(0, emoji);
+}
+
+// heap bytes of a string, 0 when it is in the small string buffer
+std::size_t string_heap(const std::string &s) {
+  return s.capacity() > std::string{}.capacity() ? s.capacity() + 1 : 0;
+}
+
+} // namespace
+
+void ReactionRoleIndex::erase(Snowflake guild) {
+  auto itr = guilds.find(guild);
+  if (itr == std::end(guilds))
+    return;
+  for (const auto &r : itr->second) {
+    auto entry = index.find({r.message, rule_key(r.emoji)});
+    if (entry == std::end(index))
+      continue;
+    std::erase_if(entry->second,
+                  [guild](const Target &t) { return t.guild == guild; });
+    if (entry->second.empty())
+      index.erase(entry);
+  }
+  rule_count -= itr->second.size();
+  guilds.erase(itr);
+}
+
+void ReactionRoleIndex::assign(Snowflake guild,
+                               const std::vector<ReactionRole> &rules) {
+  std::lock_guard lk{mutex};
+  erase(guild);
+  if (rules.empty())
+    return;
+  for (const auto &r : rules)
+    index[{r.message, rule_key(r.emoji)}].push_back({guild, r.role});
+  rule_count += rules.size();
+  guilds.emplace(guild, rules);
+}
+
+void ReactionRoleIndex::clear() {
+  std::lock_guard lk{mutex};
+  index.clear();
+  guilds.clear();
+  rule_count = 0;
+}
+
+bool ReactionRoleIndex::roles(Snowflake guild, Snowflake message,
+                              Snowflake emoji_id, std::string_view emoji_name,
+                              std::pmr::vector<Snowflake> &out) const {
+  std::shared_lock lk{mutex};
+  auto itr = index.find({message, emoji_key(emoji_id, emoji_name)});
+  if (itr == std::end(index))
+    return false;
+  const auto size = out.size();
+  // a rule of a guild on the message of another one gives nothing
+  for (const auto &t : itr->second)
+    if (t.guild == guild)
+      out.push_back(t.role);
+  return out.size() != size;
+}
+
+bool ReactionRoleIndex::contains(Snowflake message, Snowflake emoji_id,
+                                 std::string_view emoji_name) const {
+  std::shared_lock lk{mutex};
+  return index.contains({message, emoji_key(emoji_id, emoji_name)});
+}
+
+std::vector<ReactionRole> ReactionRoleIndex::referencing(Snowflake guild,
+                                                         Snowflake id) const {
+  std::vector<ReactionRole> res;
+  std::shared_lock lk{mutex};
+  auto itr = guilds.find(guild);
+  if (itr == std::end(guilds))
+    return res;
+  std::ranges::copy_if(itr->second, std::back_inserter(res),
+                       [id](const ReactionRole &r) {
+                         return r.channel == id || r.message == id ||
+                                r.role == id;
+                       });
+  return res;
+}
+
+std::size_t ReactionRoleIndex::size() const {
+  std::shared_lock lk{mutex};
+  return rule_count;
+}
+
+std::size_t ReactionRoleIndex::memory_usage() const {
+  std::shared_lock lk{mutex};
+  std::size_t res = index.bucket_count() * sizeof(void *) +
+                    guilds.bucket_count() * sizeof(void *);
+  for (const auto &[key, targets] : index)
+    res += sizeof(std::pair<const Key, std::vector<Target>>) +
+           sizeof(void *) + targets.capacity() * sizeof(Target);
+  for (const auto &[guild, rules] : guilds) {
+    res += sizeof(std::pair<const Snowflake, std::vector<ReactionRole>>) +
+           sizeof(void *) + rules.capacity() * sizeof(ReactionRole);
+    for (const auto &r : rules)
+      res += string_heap(r.emoji);
+  }
+  return res;
+}
@@ -0,0 +1,114 @@
+#ifndef REACTION_ROLES_H
+#define REACTION_ROLES_H
+
+#include "bot_api.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief A reaction on a message giving a role, as configured by a guild
+ */
+struct ReactionRole {
+  Snowflake channel{0};
+  Snowflake message{0};
+  /** The id of a custom emoji, or the name of a unicode one */
+  std::string emoji;
+  Snowflake role{0};
+
+  bool operator==(const ReactionRole &) const = default;
+
+  /** Written as channel:message:emoji:role in the configuration */
+  [[nodiscard]] std::string to_string() const;
+  static std::optional<ReactionRole> parse(std::string_view s);
+};
+
+/**
+ * @brief The key of the emoji of a reaction: the id of a custom emoji, else
+ * a hash of the name with the high bit set, which no snowflake has
+ */
+[[nodiscard]] std::uint64_t emoji_key(Snowflake id, std::string_view name);
+
+/**
+ * @brief The emoji of a rule given as typed in Discord: a custom emoji
+ * <:name:id> or <a:name:id> is kept as its id, a unicode one as its name
+ */
+[[nodiscard]] std::string normalize_emoji(std::string_view typed);
+
+/**
+ * @brief The reaction roles of every guild, compiled in a single table
+ * keyed by (message, emoji) giving the roles, so a reaction costs one
+ * lookup whatever the count of rules and guilds
+ */
+class ReactionRoleIndex {
+public:
+  /**
+   * @brief Replace the rules of the guild
+   */
+  void assign(Snowflake guild, const std::vector<ReactionRole> &rules);
+  void clear();
+
+  /**
+   * @brief Append to out the roles the reaction gives in the guild
+   *
+   * @return false if the reaction matches no rule
+   */
+  bool roles(Snowflake guild, Snowflake message, Snowflake emoji_id,
+             std::string_view emoji_name,
+             std::pmr::vector<Snowflake> &out) const;
+
+  /**
+   * @brief A rule of some guild is on the message with the emoji
+   */
+  [[nodiscard]] bool contains(Snowflake message, Snowflake emoji_id,
+                              std::string_view emoji_name) const;
+
+  /**
+   * @brief The rules of the guild referencing the id, as channel, message
+   * or role
+   */
+  [[nodiscard]] std::vector<ReactionRole> referencing(Snowflake guild,
+                                                      Snowflake id) const;
+
+  /** The rules of every guild */
+  [[nodiscard]] std::size_t size() const;
+  [[nodiscard]] std::size_t memory_usage() const;
+
+private:
+  struct Key {
+    Snowflake message;
+    std::uint64_t emoji;
+
+    bool operator==(const Key &) const = default;
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key &k) const {
+      return std::hash<std::uint64_t>{}(k.message ^
+                                        (k.emoji * 0x9e3779b97f4a7c15ULL));
+    }
+  };
+
+  struct Target {
+    Snowflake guild;
+    Snowflake role;
+  };
+
+  /** Remove the entries of the guild, the lock is held */
+  void erase(Snowflake guild);
+
+  mutable std::shared_mutex mutex;
+  std::unordered_map<Key, std::vector<Target>, KeyHash> index;
+  /** The rules of each guild, to replace them and find their references */
+  std::unordered_map<Snowflake, std::vector<ReactionRole>> guilds;
+  std::size_t rule_count{0};
+};
+
+#endif // REACTION_ROLES_H
@@ -0,0 +1,151 @@
+#include "screening.h"
+#include "configuration.h"
+#include "guild_config.h"
+#include "json_scanner.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+std::optional<MemberScreenedEvent>
+ScreeningTracker::ingest(Event event, std::string_view raw) {
+  Snowflake guild_id{0};
+  Snowflake user_id{0};
+  // absent once the member accepted the rules
+  bool member_pending{false};
+  bool unavailable{false};
+  std::vector<Snowflake> members;
+  std::vector<Snowflake> roles;
+
+  auto read_user = [&](std::string_view key, JsonScanner &v) {
+    if (key == "id")
+      return v.snowflake(user_id);
+    return false;
+  };
+  auto read_guild_member = [&](std::string_view key, JsonScanner &v) {
+    if (key == "user")
+      return v.object(read_user);
+    if (key == "pending")
+      return v.boolean(member_pending);
+    if (key == "roles" && event == Event::member_update)
+      return v.array([&](JsonScanner &e) {
+        Snowflake role{0};
+        if (e.snowflake(role))
+          roles.push_back(role);
+      });
+    return false;
+  };
+
+  auto read_member = [&](std::string_view key, JsonScanner &v) {
+    switch (event) {
+    case Event::guild_create:
+    case Event::guild_delete:
+      if (key == "id")
+        return v.snowflake(guild_id);
+      if (key == "unavailable")
+        return v.boolean(unavailable);
+      if (key == "members" && event == Event::guild_create)
+        return v.array([&](JsonScanner &e) {
+          user_id = 0;
+          member_pending = false;
+          e.object(read_guild_member);
+          if (user_id && member_pending)
+            members.push_back(user_id);
+        });
+      return false;
+
+    case Event::member_add:
+    case Event::member_update:
+    case Event::member_remove:
+      if (key == "guild_id")
+        return v.snowflake(guild_id);
+      return read_guild_member(key, v);
+    }
+    return false;
+  };
+
+  // the payload and its "d" object are read in the same pass
+  JsonScanner s{raw};
+  s.object([&](std::string_view key, JsonScanner &v) {
+    if (key == "d")
+      return v.object(read_member);
+    return read_member(key, v);
+  });
+
+  const bool guild_event =
+      event == Event::guild_create || event == Event::guild_delete;
+  if (!s.ok() || !guild_id || (!guild_event && !user_id)) {
+    LogWarning{} << "Événement de membre illisible";
+    return std::nullopt;
+  }
+
+  // a member not pending without the charte role accepted the rules while
+  // not tracked: before the start, or missing from the members of its guild
+  bool unscreened{false};
+  if (event == Event::member_update && !member_pending &&
+      g_guild_configs.get_guild_charte_screening(guild_id)) {
+    auto r = g_guild_configs.get_guild_charte_role(guild_id);
+    unscreened = r && std::ranges::find(roles, r) == std::end(roles);
+  }
+
+  std::lock_guard lk{mutex};
+  auto g = pending.find(guild_id);
+  switch (event) {
+  case Event::guild_create:
+    // the members of a large guild are not all sent, and a session
+    // identified again sends the guild again: the members only add up
+    if (!members.empty()) {
+      if (g == std::end(pending))
+        g = pending.try_emplace(guild_id).first;
+      for (auto m : members)
+        member_count += g->second.insert(m).second;
+    }
+    return std::nullopt;
+
+  case Event::guild_delete:
+    // an unavailable guild is an outage, its members are still pending
+    if (unavailable || g == std::end(pending))
+      return std::nullopt;
+    member_count -= g->second.size();
+    pending.erase(g);
+    return std::nullopt;
+
+  case Event::member_add:
+  case Event::member_update:
+    if (member_pending) {
+      if (g == std::end(pending))
+        g = pending.try_emplace(guild_id).first;
+      member_count += g->second.insert(user_id).second;
+      return std::nullopt;
+    }
+    [[fallthrough]];
+  case Event::member_remove:
+    // most updates are of members who are not pending
+    if (g == std::end(pending) || !g->second.erase(user_id))
+      return unscreened ? std::optional{MemberScreenedEvent{guild_id, user_id}}
+                        : std::nullopt;
+    --member_count;
+    if (g->second.empty())
+      pending.erase(g);
+    if (event == Event::member_remove)
+      return std::nullopt;
+    return MemberScreenedEvent{guild_id, user_id};
+  }
+  return std::nullopt;
+}
+
+std::size_t ScreeningTracker::size() const {
+  std::lock_guard lk{mutex};
+  return member_count;
+}
+
+std::size_t ScreeningTracker::memory_usage() const {
+  std::lock_guard lk{mutex};
+  // a hash node is the value and the next pointer, plus the bucket array
+  std::size_t res = pending.bucket_count() * sizeof(void *);
+  for (const auto &[guild, members] : pending)
+    res += sizeof(decltype(pending)::value_type) + sizeof(void *) +
+           members.bucket_count() * sizeof(void *) +
+           members.size() * (sizeof(Snowflake) + sizeof(void *));
+  return res;
+}
@@ -0,0 +1,50 @@
+#ifndef SCREENING_H
+#define SCREENING_H
+
+#include "bot_api.h"
+#include "profiling.h"
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+/**
+ * @brief The members who did not pass the rules screening of their guild
+ * yet, read from the raw member events
+ * Only the pending members are kept, so an update which does not change
+ * the screening state of its member is dropped with one lookup. A member
+ * leaving the set is the acceptance of the rules, as is in a screening
+ * guild an update of a member not pending and without the charte role
+ */
+class ScreeningTracker {
+public:
+  enum class Event {
+    guild_create,
+    guild_delete,
+    member_add,
+    member_update,
+    member_remove
+  };
+
+  /**
+   * @brief Apply a gateway event, given as the raw payload or its "d"
+   * object
+   *
+   * @return the member who just passed the screening, if the event is its
+   * acceptance
+   */
+  std::optional<MemberScreenedEvent> ingest(Event event, std::string_view raw);
+
+  /** The members pending in every guild */
+  [[nodiscard]] std::size_t size() const;
+  [[nodiscard]] std::size_t memory_usage() const;
+
+private:
+  mutable ProfiledMutex mutex{"screening"};
+  std::unordered_map<Snowflake, std::unordered_set<Snowflake>> pending;
+  std::size_t member_count{0};
+};
+
+#endif // SCREENING_H
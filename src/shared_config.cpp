@@ -0,0 +1,322 @@
+#include "shared_config.h"
+#include "configuration.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr std::uint64_t store_magic{0x4c4f554c4f555445ULL}; // "LOULOUTE"
+constexpr std::uint32_t store_version{3};
+constexpr std::size_t reaction_words{SharedGuildStore::max_reaction_size / 8};
+// a reader gives up after this many tries, a writer died in the middle of
+// the slot and the next writer will repair it
+constexpr int max_read_tries{1 << 16};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "the shared segment needs address free atomics");
+
+} // namespace
+
+// a cache line, so the slots following it are aligned
+struct alignas(64) SharedGuildStore::Header {
+  std::atomic<std::uint64_t> magic;
+  std::uint32_t version;
+  std::uint32_t capacity;
+  std::atomic<std::uint64_t> size;
+  std::atomic<std::uint64_t> writing; /** index + 1 of the slot written */
+};
+
+struct alignas(64) SharedGuildStore::Slot {
+  std::atomic<std::uint64_t> guild;    /** 0 while free */
+  std::atomic<std::uint64_t> sequence; /** odd while written */
+  std::atomic<std::uint64_t> goodbye_channel;
+  std::atomic<std::uint64_t> charte_channel;
+  std::atomic<std::uint64_t> charte_message;
+  std::atomic<std::uint64_t> charte_role;
+  std::atomic<std::uint64_t> charte_screening;
+  std::atomic<std::uint64_t> reaction_size;
+  std::array<std::atomic<std::uint64_t>, reaction_words> reaction;
+};
+
+namespace {
+
+std::mutex &local_writer_mutex() {
+  // flock is held by the open file, so the threads of the process are
+  // serialized by a mutex first
+  static std::mutex m;
+  return m;
+}
+
+} // namespace
+
+#ifndef WIN32
+
+std::unique_ptr<SharedGuildStore>
+SharedGuildStore::open(const std::string &name, std::size_t capacity,
+                       const Init &init) {
+  int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    LogError{} << "shm_open " << name << ": " << std::strerror(errno);
+    return nullptr;
+  }
+
+  // the first process fills the segment, the others wait for it here
+  while (::flock(fd, LOCK_EX) && errno == EINTR)
+    ;
+
+  auto fail = [fd, &name](const char *what) {
+    LogError{} << what << ' ' << name << ": " << std::strerror(errno);
+    ::flock(fd, LOCK_UN);
+    ::close(fd);
+    return nullptr;
+  };
+
+  struct stat st {};
+  if (::fstat(fd, &st))
+    return fail("fstat");
+
+  auto length = static_cast<std::size_t>(st.st_size);
+  bool fresh{length < sizeof(Header)};
+  if (!fresh) {
+    auto map = ::mmap(nullptr, sizeof(Header), PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+      return fail("mmap");
+    auto h = static_cast<const Header *>(map);
+    const auto magic = h->magic.load(std::memory_order_acquire);
+    const auto version = h->version;
+    const std::size_t size = segment_size(h->capacity);
+    ::munmap(map, sizeof(Header));
+    // a process died while filling it, nobody mapped it
+    fresh = magic == 0;
+    if (!fresh) {
+      // the processes of an other version still map it, truncating it
+      // would kill them on their next access
+      if (magic != store_magic || version != store_version || size > length) {
+        LogError{} << "Segment " << name << " d'une autre version (" << version
+                   << "), configuration non partagée";
+        ::flock(fd, LOCK_UN);
+        ::close(fd);
+        return nullptr;
+      }
+      length = size;
+    }
+  }
+
+  if (fresh) {
+    length = segment_size(capacity);
+    // truncate first so the whole segment is zero filled
+    if (::ftruncate(fd, 0) || ::ftruncate(fd, static_cast<off_t>(length)))
+      return fail("ftruncate");
+  }
+
+  auto map =
+      ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return fail("mmap");
+
+  std::unique_ptr<SharedGuildStore> res{
+      new SharedGuildStore{fd, map, length}};
+  if (fresh) {
+    new (res->header) Header{};
+    res->header->version = store_version;
+    res->header->capacity = static_cast<std::uint32_t>(capacity);
+    for (std::size_t i = 0; i < capacity; ++i)
+      new (&res->slots[i]) Slot{};
+    if (init)
+      init(*res);
+    res->header->magic.store(store_magic, std::memory_order_release);
+  }
+
+  ::flock(fd, LOCK_UN);
+  return res;
+}
+
+void SharedGuildStore::unlink(const std::string &name) {
+  ::shm_unlink(name.c_str());
+}
+
+SharedGuildStore::~SharedGuildStore() noexcept {
+  ::munmap(mapping, mapping_size);
+  ::close(fd);
+}
+
+SharedGuildStore::WriterLock::WriterLock(SharedGuildStore &s) : store{s} {
+  local_writer_mutex().lock();
+  while (::flock(store.fd, LOCK_EX) && errno == EINTR)
+    ;
+
+  // the previous writer died in the middle of a slot, end its write so
+  // the readers stop retrying
+  if (auto w = store.header->writing.load(std::memory_order_relaxed)) {
+    auto &seq = store.slots[w - 1].sequence;
+    auto s = seq.load(std::memory_order_relaxed);
+    if (s & 1)
+      seq.store(s + 1, std::memory_order_release);
+    store.header->writing.store(0, std::memory_order_relaxed);
+  }
+}
+
+SharedGuildStore::WriterLock::~WriterLock() noexcept {
+  ::flock(store.fd, LOCK_UN);
+  local_writer_mutex().unlock();
+}
+
+#else
+
+std::unique_ptr<SharedGuildStore>
+SharedGuildStore::open(const std::string &name, std::size_t, const Init &) {
+  LogError{} << "Pas de configuration partagée " << name << " sous Windows";
+  return nullptr;
+}
+
+void SharedGuildStore::unlink(const std::string &) {}
+
+SharedGuildStore::~SharedGuildStore() noexcept {}
+
+SharedGuildStore::WriterLock::WriterLock(SharedGuildStore &s) : store{s} {}
+
+SharedGuildStore::WriterLock::~WriterLock() noexcept {}
+
+#endif // WIN32
+
+std::size_t SharedGuildStore::segment_size(std::size_t capacity) {
+  return sizeof(Header) + capacity * sizeof(Slot);
+}
+
+SharedGuildStore::SharedGuildStore(int f, void *map, std::size_t length)
+    : fd{f}, mapping{map}, mapping_size{length},
+      header{static_cast<Header *>(map)},
+      slots{reinterpret_cast<Slot *>(static_cast<char *>(map) +
+                                     sizeof(Header))} {}
+
+std::size_t SharedGuildStore::capacity() const { return header->capacity; }
+
+std::size_t SharedGuildStore::size() const {
+  return header->size.load(std::memory_order_relaxed);
+}
+
+SharedGuildStore::Slot *SharedGuildStore::find(Snowflake guild) const {
+  const std::size_t cap = header->capacity;
+  // the low bits of a snowflake are a counter, mix them with the time
+  auto idx = static_cast<std::size_t>((guild * 0x9e3779b97f4a7c15ULL) >> 17) %
+             cap;
+  for (std::size_t i = 0; i < cap; ++i) {
+    auto &slot = slots[(idx + i) % cap];
+    auto key = slot.guild.load(std::memory_order_acquire);
+    if (key == guild || key == 0)
+      return &slot;
+  }
+  return nullptr;
+}
+
+bool SharedGuildStore::read(const Slot &slot, GuildSettings &out) const {
+  for (int tries = 0; tries < max_read_tries; ++tries) {
+    auto before = slot.sequence.load(std::memory_order_acquire);
+    if (before & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    GuildSettings s;
+    s.goodbye_channel = slot.goodbye_channel.load(std::memory_order_relaxed);
+    s.charte_channel = slot.charte_channel.load(std::memory_order_relaxed);
+    s.charte_message = slot.charte_message.load(std::memory_order_relaxed);
+    s.charte_role = slot.charte_role.load(std::memory_order_relaxed);
+    s.charte_screening =
+        slot.charte_screening.load(std::memory_order_relaxed) != 0;
+    auto size = std::min<std::size_t>(
+        slot.reaction_size.load(std::memory_order_relaxed), max_reaction_size);
+    std::array<std::uint64_t, reaction_words> words;
+    for (std::size_t i = 0; i < reaction_words; ++i)
+      words[i] = slot.reaction[i].load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != before)
+      continue;
+
+    s.charte_reaction_valider.assign(reinterpret_cast<const char *>(&words),
+                                     size);
+    out = std::move(s);
+    return true;
+  }
+  LogError{} << "Lecture de la configuration partagée impossible";
+  return false;
+}
+
+bool SharedGuildStore::load(Snowflake guild, GuildSettings &out) const {
+  auto slot = find(guild);
+  if (!slot || slot->guild.load(std::memory_order_acquire) != guild)
+    return false;
+  return read(*slot, out);
+}
+
+bool SharedGuildStore::store(Snowflake guild,
+                             const GuildSettings &settings) {
+  const auto &reaction = settings.charte_reaction_valider;
+  if (reaction.size() > max_reaction_size) {
+    LogError{} << "Réaction trop longue pour la configuration partagée: "
+               << reaction;
+    return false;
+  }
+  auto slot = find(guild);
+  if (!slot) {
+    LogError{} << "Configuration partagée pleine, " << guild << " non écrit";
+    return false;
+  }
+
+  header->writing.store(static_cast<std::uint64_t>(slot - slots) + 1,
+                        std::memory_order_relaxed);
+  auto seq = slot->sequence.load(std::memory_order_relaxed);
+  slot->sequence.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot->goodbye_channel.store(settings.goodbye_channel,
+                              std::memory_order_relaxed);
+  slot->charte_channel.store(settings.charte_channel,
+                             std::memory_order_relaxed);
+  slot->charte_message.store(settings.charte_message,
+                             std::memory_order_relaxed);
+  slot->charte_role.store(settings.charte_role, std::memory_order_relaxed);
+  slot->charte_screening.store(settings.charte_screening,
+                               std::memory_order_relaxed);
+  std::array<std::uint64_t, reaction_words> words{};
+  std::memcpy(&words, reaction.data(), reaction.size());
+  for (std::size_t i = 0; i < reaction_words; ++i)
+    slot->reaction[i].store(words[i], std::memory_order_relaxed);
+  slot->reaction_size.store(reaction.size(), std::memory_order_relaxed);
+
+  slot->sequence.store(seq + 2, std::memory_order_release);
+  if (slot->guild.load(std::memory_order_relaxed) != guild) {
+    // published once its content is complete
+    slot->guild.store(guild, std::memory_order_release);
+    header->size.fetch_add(1, std::memory_order_relaxed);
+  }
+  header->writing.store(0, std::memory_order_relaxed);
+  return true;
+}
+
+void SharedGuildStore::for_each(
+    const std::function<void(Snowflake, const GuildSettings &)> &f) const {
+  for (std::size_t i = 0; i < header->capacity; ++i) {
+    auto guild = slots[i].guild.load(std::memory_order_acquire);
+    if (!guild)
+      continue;
+    GuildSettings s;
+    read(slots[i], s);
+    f(guild, s);
+  }
+}
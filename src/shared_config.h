@@ -0,0 +1,119 @@
+#ifndef SHARED_CONFIG_H
+#define SHARED_CONFIG_H
+
+#include "bot_api.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+/**
+ * @brief The settings of a guild, as stored in the shared segment
+ */
+struct GuildSettings {
+  Snowflake goodbye_channel{0};
+  Snowflake charte_channel{0};
+  Snowflake charte_message{0};
+  Snowflake charte_role{0};
+  std::string charte_reaction_valider;
+  /** The charte is accepted through the rules screening of Discord */
+  bool charte_screening{false};
+};
+
+/**
+ * @brief Guild settings shared by every bot process of the host
+ * The segment (shm_open + mmap) holds a table of slots addressed by the
+ * guild id. The readers never lock: each slot is protected by a sequence
+ * counter, odd while it is written, and a read is retried if the counter
+ * changed. The writers are serialized by a flock on the segment, which the
+ * kernel releases if the process dies
+ */
+class SharedGuildStore {
+public:
+  static constexpr std::size_t max_reaction_size{64};
+  using Init = std::function<void(SharedGuildStore &)>;
+
+  /**
+   * @brief Map the named segment, create it if needed
+   *
+   * @param name The shm name, starting with '/'
+   * @param capacity The count of slots of a new segment, the capacity of
+   * an existing segment is kept
+   * @param init Called with the writer lock held to fill a new segment
+   * @return the store, nullptr if the segment can't be used or was made by
+   * an other version, which may still map it
+   */
+  static std::unique_ptr<SharedGuildStore>
+  open(const std::string &name, std::size_t capacity, const Init &init);
+
+  /**
+   * @brief Remove the segment name, the mapped stores stay valid
+   */
+  static void unlink(const std::string &name);
+
+  ~SharedGuildStore() noexcept;
+  SharedGuildStore(const SharedGuildStore &) = delete;
+  SharedGuildStore &operator=(const SharedGuildStore &) = delete;
+
+  /**
+   * @brief Read the settings of the guild without locking
+   *
+   * @return false if the guild has no slot or its slot can't be read
+   */
+  bool load(Snowflake guild, GuildSettings &out) const;
+
+  /**
+   * @brief Exclusive right to write the segment, shared with the other
+   * processes
+   */
+  class WriterLock {
+  public:
+    explicit WriterLock(SharedGuildStore &s);
+    ~WriterLock() noexcept;
+    WriterLock(const WriterLock &) = delete;
+    WriterLock &operator=(const WriterLock &) = delete;
+
+  private:
+    SharedGuildStore &store;
+  };
+
+  /**
+   * @brief Write the settings of the guild, a WriterLock must be held
+   *
+   * @return false if the table is full or the reaction too long
+   */
+  bool store(Snowflake guild, const GuildSettings &settings);
+
+  /**
+   * @brief Call f(guild, settings) for every guild of the segment
+   */
+  void for_each(
+      const std::function<void(Snowflake, const GuildSettings &)> &f) const;
+
+  [[nodiscard]] std::size_t capacity() const;
+  [[nodiscard]] std::size_t size() const;
+  [[nodiscard]] std::size_t memory_usage() const { return mapping_size; }
+
+private:
+  struct Header;
+  struct Slot;
+
+  SharedGuildStore(int fd, void *map, std::size_t length);
+
+  static std::size_t segment_size(std::size_t capacity);
+
+  Slot *find(Snowflake guild) const;
+  /** @return false if a writer kept the slot busy, out is unchanged */
+  bool read(const Slot &slot, GuildSettings &out) const;
+
+  int fd;
+  void *mapping;
+  std::size_t mapping_size;
+  Header *header;
+  Slot *slots;
+};
+
+#endif // SHARED_CONFIG_H
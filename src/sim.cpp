@@ -0,0 +1,511 @@
+#include "caching_bot_api.h"
+#include "charte_backfill.h"
+#include "circuit_breaker.h"
+#include "configuration.h"
+#include "dispatch_dedupe.h"
+#include "fake_bot_api.h"
+#include "handlers.h"
+#include "profiling.h"
+#include "reaction_debouncer.h"
+#include "screening.h"
+#include "simulation.h"
+
+#include <iostream>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr Snowflake guild_id{100000000000000000ULL};
+constexpr Snowflake text_channel{guild_id + 1};
+constexpr Snowflake charte_channel{guild_id + 2};
+constexpr Snowflake charte_message{guild_id + 3};
+constexpr Snowflake charte_role{guild_id + 4};
+
+struct Scenario {
+  std::string_view name;
+  std::string_view description;
+  void (*run)(FakeBotApi &);
+};
+
+/**
+ * @brief Reset the guild configuration and the fake Discord guild
+ */
+void setup_guild(FakeBotApi &api, bool configured) {
+  std::ostringstream oss;
+  oss << '[' << guild_id << "]\n";
+  if (configured)
+    oss << "goodbye_channel = " << text_channel << '\n'
+        << "charte_channel = " << charte_channel << '\n'
+        << "charte_message = " << charte_message << '\n'
+        << "charte_reaction_valider = ✅\n"
+        << "charte_role = " << charte_role << '\n';
+  std::istringstream is{oss.str()};
+  g_guild_configs = Configuration{is};
+
+  auto &g = api.guild(guild_id);
+  g.channels = {{text_channel, true, "general"},
+                {charte_channel, true, "charte"}};
+  g.roles = {{charte_role, "membre"}};
+  g.messages[charte_message] = {charte_message, charte_channel, {{0, "✅"}}};
+}
+
+Interaction setup_command(Snowflake id, const std::string &param,
+                          const std::string &value) {
+  return {id,       "token",  guild_id, text_channel, 1,
+          "admin", "setup", {{"param", param}, {"value", value}}};
+}
+
+/**
+ * @brief A member as sent by the gateway, with or without the charte role
+ */
+std::string guild_member(Snowflake user, bool pending, bool charte) {
+  return "{\"user\":{\"id\":\"" + std::to_string(user) +
+         "\",\"username\":\"member\"},\"roles\":[" +
+         (charte ? "\"" + std::to_string(charte_role) + "\"" : "") +
+         "],\"pending\":" + (pending ? "true" : "false") + "}";
+}
+
+std::string member_update(Snowflake user, bool pending, bool charte) {
+  return "{\"t\":\"GUILD_MEMBER_UPDATE\",\"d\":{\"guild_id\":\"" +
+         std::to_string(guild_id) + "\"," +
+         guild_member(user, pending, charte).substr(1) + "}";
+}
+
+const Scenario scenarios[] = {
+    {"reaction_burst", "1000 members validate the charte within a second",
+     [](FakeBotApi &api) {
+       setup_guild(api, true);
+       for (Snowflake i = 0; i < 1000; ++i) {
+         on_message_reaction_add(api, {guild_id, charte_channel,
+                                       charte_message, 1000 + i, "member", 0,
+                                       "✅"});
+         api.advance(1ms);
+       }
+     }},
+    {"button_burst",
+     "1000 members click the charte button within a second, some twice",
+     [](FakeBotApi &api) {
+       setup_guild(api, true);
+       for (Snowflake i = 0; i < 1000; ++i) {
+         Interaction click{10000 + i, "token", guild_id, charte_channel,
+                           1000 + i,  "member", "charte_valider"};
+         on_button_click(api, click);
+         // an impatient member clicks again
+         if (i % 10 == 0) {
+           click.id += 100000;
+           on_button_click(api, click);
+         }
+         api.advance(1ms);
+       }
+       // the grants wait for the rate limit of the guild, 10 every 10s
+       api.advance(20min);
+       std::size_t missing{0};
+       for (Snowflake i = 0; i < 1000; ++i)
+         missing += !api.has_role(guild_id, 1000 + i, charte_role);
+       if (missing)
+         std::cout << "button: " << missing << " members without role\n";
+       if (api.calls(ApiRoute::interaction_edit_response) != 1100)
+         std::cout << "button: "
+                   << api.calls(ApiRoute::interaction_edit_response)
+                   << " clicks answered of 1100\n";
+     }},
+    {"screening",
+     "500 members join pending and accept the rules among 10000 updates",
+     [](FakeBotApi &api) {
+       setup_guild(api, true);
+       on_slashcommand(api, setup_command(1, "charte_screening", "oui"));
+       ScreeningTracker screening;
+       auto ingest = [&](ScreeningTracker::Event e, Snowflake user,
+                         bool pending, bool charte) {
+         if (auto accepted = screening.ingest(
+                 e, member_update(user, pending, charte)))
+           on_member_screened(api, *accepted);
+       };
+       for (Snowflake i = 0; i < 500; ++i)
+         ingest(ScreeningTracker::Event::member_add, 1000 + i, true, false);
+       // nicknames and roles of the members who already accepted
+       for (Snowflake i = 0; i < 10000; ++i) {
+         ingest(ScreeningTracker::Event::member_update, 5000 + i % 2000,
+                false, true);
+         if (i % 20 == 0)
+           ingest(ScreeningTracker::Event::member_update, 1000 + i / 20,
+                  false, false);
+         api.advance(1ms);
+       }
+       api.advance(10s);
+       std::size_t missing{0};
+       for (Snowflake i = 0; i < 500; ++i)
+         missing += !api.has_role(guild_id, 1000 + i, charte_role);
+       if (missing || screening.size())
+         std::cout << "screening: " << missing << " members without role, "
+                   << screening.size() << " pending\n";
+     }},
+    {"screening_restart",
+     "300 members pending before the start, the guild lists 100 of them",
+     [](FakeBotApi &api) {
+       setup_guild(api, true);
+       on_slashcommand(api, setup_command(1, "charte_screening", "oui"));
+       ScreeningTracker screening;
+       auto guild_create = [&](Snowflake first) {
+         std::string raw = "{\"t\":\"GUILD_CREATE\",\"d\":{\"id\":\"" +
+                           std::to_string(guild_id) + "\",\"members\":[";
+         for (Snowflake i = first; i < first + 100; ++i)
+           raw += (i == first ? "" : ",") +
+                  guild_member(1000 + i, true, false);
+         screening.ingest(ScreeningTracker::Event::guild_create, raw + "]}}");
+       };
+       // a session identified again gets another part of the members
+       guild_create(0);
+       guild_create(50);
+       for (Snowflake i = 0; i < 300; ++i) {
+         if (auto accepted = screening.ingest(
+                 ScreeningTracker::Event::member_update,
+                 member_update(1000 + i, false, false)))
+           on_member_screened(api, *accepted);
+         api.advance(1ms);
+       }
+       api.advance(10s);
+       std::size_t missing{0};
+       for (Snowflake i = 0; i < 300; ++i)
+         missing += !api.has_role(guild_id, 1000 + i, charte_role);
+       if (missing || screening.size())
+         std::cout << "screening: " << missing << " members without role, "
+                   << screening.size() << " pending\n";
+     }},
+    {"resume_replay",
+     "300 members leave and 300 validate, a resume sends 100 of each again",
+     [](FakeBotApi &api) {
+       setup_guild(api, true);
+       DispatchDeduplicator dispatches;
+       auto member_remove = [](std::uint64_t seq, Snowflake user) {
+         return R"({"t":"GUILD_MEMBER_REMOVE","s":)" + std::to_string(seq) +
+                R"(,"op":0,"d":{"guild_id":")" + std::to_string(guild_id) +
+                R"(","user":{"id":")" + std::to_string(user) +
+                R"(","username":"member"}}})";
+       };
+       auto reaction_add = [](std::uint64_t seq, Snowflake user) {
+         return R"({"t":"MESSAGE_REACTION_ADD","s":)" + std::to_string(seq) +
+                R"(,"op":0,"d":{"user_id":")" + std::to_string(user) +
+                R"(","channel_id":")" + std::to_string(charte_channel) +
+                R"(","message_id":")" + std::to_string(charte_message) +
+                R"(","guild_id":")" + std::to_string(guild_id) +
+                R"(","emoji":{"id":null,"name":"✅"}}})";
+       };
+       // the dispatches as main.cpp handles them
+       auto dispatch = [&](std::uint64_t seq, Snowflake i) {
+         const auto removed = member_remove(2 * seq, 5000 + i);
+         if (!dispatches.replayed(DispatchDeduplicator::Event::member_remove,
+                                  removed))
+           send_goodbye(api, {guild_id, 5000 + i, "member"});
+         const auto added = reaction_add(2 * seq + 1, 1000 + i);
+         if (!dispatches.replayed(DispatchDeduplicator::Event::reaction_add,
+                                  added))
+           on_message_reaction_add(api, {guild_id, charte_channel,
+                                         charte_message, 1000 + i, "member",
+                                         0, "✅"});
+       };
+       for (Snowflake i = 0; i < 300; ++i) {
+         dispatch(i + 1, i);
+         api.advance(10ms);
+       }
+       api.advance(5s);
+       for (Snowflake i = 200; i < 300; ++i)
+         dispatch(i + 1, i);
+       api.advance(10s);
+       if (dispatches.hits() != 200)
+         std::cout << "replays: " << dispatches.hits() << " suppressed\n";
+     }},
+    {"reaction_burst_missing_role",
+     "1000 members validate the charte, the role was deleted",
+     [](FakeBotApi &api) {
+       setup_guild(api, true);
+       api.guild(guild_id).roles.clear();
+       CircuitBreaker breaker{{}, [&api] { return api.now(); }, 1};
+       CircuitBreakerBotApi guarded{api, breaker};
+       for (Snowflake i = 0; i < 1000; ++i) {
+         on_message_reaction_add(guarded, {guild_id, charte_channel,
+                                           charte_message, 1000 + i, "member",
+                                           0, "✅"});
+         api.advance(1ms);
+       }
+       // the callbacks use the breaker, it must outlive them
+       api.run();
+       // the guild is misconfigured, the circuit opens and refuses the rest
+       if (breaker.open_count() != 1 || !breaker.refused())
+         std::cout << "breaker: " << breaker.open_count() << " open, "
+                   << breaker.refused() << " refused\n";
+     }},
+    {"reaction_burst_outage",
+     "1000 members validate the charte while Discord fails, then it is back",
+     [](FakeBotApi &api) {
+       setup_guild(api, true);
+       api.fail_roles(guild_id, 503);
+       CircuitBreaker breaker{{}, [&api] { return api.now(); }, 1};
+       CircuitBreakerBotApi guarded{api, breaker};
+       for (Snowflake i = 0; i < 1000; ++i) {
+         on_message_reaction_add(guarded, {guild_id, charte_channel,
+                                           charte_message, 1000 + i, "member",
+                                           0, "✅"});
+         api.advance(1ms);
+       }
+       api.advance(10s);
+       const auto opened = breaker.open_count();
+       api.fail_roles(guild_id, 0);
+       api.advance(60s);
+       on_message_reaction_add(guarded, {guild_id, charte_channel,
+                                         charte_message, 3000, "member", 0,
+                                         "✅"});
+       // the probe waits for the rate limit behind the calls sent before
+       // the circuit opened, their failures must not fail it. The
+       // callbacks use the breaker, it must outlive them
+       api.run();
+       if (opened != 1 || breaker.open_count() ||
+           !api.has_role(guild_id, 3000, charte_role))
+         std::cout << "breaker: " << opened << " opened, "
+                   << breaker.open_count() << " still open\n";
+     }},
+    {"reaction_flapping",
+     "300 members toggle the charte reaction, only their last state is sent",
+     [](FakeBotApi &api) {
+       setup_guild(api, true);
+       for (Snowflake i = 0; i < 100; ++i)
+         api.guild_member_add_role(guild_id, 1200 + i, charte_role, {});
+       api.run();
+       const auto collapsed = g_reaction_debouncer.collapsed();
+       auto add = [&api](Snowflake user) {
+         on_message_reaction_add(api, {guild_id, charte_channel,
+                                       charte_message, user, "member", 0,
+                                       "✅"});
+       };
+       auto remove = [&api](Snowflake user) {
+         on_message_reaction_remove(
+             api, {guild_id, charte_channel, charte_message, user, 0, "✅"});
+       };
+       // 1000: added, removed and added back. 1100: added and removed.
+       // 1200: had the role, removed
+       for (Snowflake i = 0; i < 300; ++i)
+         i < 200 ? add(1000 + i) : remove(1000 + i);
+       api.advance(300ms);
+       for (Snowflake i = 0; i < 200; ++i)
+         remove(1000 + i);
+       api.advance(300ms);
+       for (Snowflake i = 0; i < 100; ++i)
+         add(1000 + i);
+       api.advance(5s);
+       std::size_t wrong{0};
+       for (Snowflake i = 0; i < 300; ++i)
+         wrong += api.has_role(guild_id, 1000 + i, charte_role) != (i < 100);
+       if (wrong || g_reaction_debouncer.size() ||
+           g_reaction_debouncer.collapsed() - collapsed != 400)
+         std::cout << "debouncer: " << wrong << " wrong roles, "
+                   << g_reaction_debouncer.collapsed() - collapsed
+                   << " collapsed\n";
+     }},
+    {"goodbye_unconfigured_burst",
+     "20 members leave a guild without goodbye channel at once",
+     [](FakeBotApi &api) {
+       setup_guild(api, false);
+       for (Snowflake i = 0; i < 20; ++i)
+         send_goodbye(api, {guild_id, 1000 + i, "member"});
+     }},
+    {"goodbye_unconfigured_burst_coalesced",
+     "20 members leave a guild without goodbye channel, the reads coalesce",
+     [](FakeBotApi &api) {
+       setup_guild(api, false);
+       CachingBotApi cached{api};
+       for (Snowflake i = 0; i < 20; ++i)
+         send_goodbye(cached, {guild_id, 1000 + i, "member"});
+       // the callbacks use the cache, it must outlive them
+       api.run();
+       if (cached.coalesced() != 19)
+         std::cout << "cache: " << cached.coalesced() << " coalesced\n";
+     }},
+    {"goodbye_broken_channel",
+     "the goodbye channel rejects the messages, the handler retries",
+     [](FakeBotApi &api) {
+       setup_guild(api, true);
+       api.fail_channel(text_channel);
+       send_goodbye(api, {guild_id, 1000, "member"});
+     }},
+    {"setup_charte",
+     "an admin configures the charte role and message, and posts the button",
+     [](FakeBotApi &api) {
+       setup_guild(api, false);
+       on_slashcommand(api, setup_command(1, "charte_reaction_valider", "✅"));
+       on_slashcommand(api, setup_command(2, "charte_role", "membre"));
+       on_slashcommand(
+           api, setup_command(3, "charte_message",
+                              "https://discord.com/channels/" +
+                                  std::to_string(guild_id) + '/' +
+                                  std::to_string(charte_channel) + '/' +
+                                  std::to_string(charte_message)));
+       api.advance(5s);
+       // the button needs the charte role
+       on_slashcommand(api, setup_command(4, "charte_bouton", "J'accepte"));
+       api.advance(5s);
+       if (api.last_message() != "Effectué")
+         std::cout << "charte_bouton: " << api.last_message() << '\n';
+       for (Snowflake i = 1; i <= 4; ++i)
+         if (api.responses(i) != 1)
+           std::cout << "interaction " << i << ": " << api.responses(i)
+                     << " responses\n";
+     }},
+    {"setup_charte_cached",
+     "an admin checks the charte message three times, the second read is "
+     "cached",
+     [](FakeBotApi &api) {
+       setup_guild(api, false);
+       CachingBotApi cached{api};
+       const auto url = "https://discord.com/channels/" +
+                        std::to_string(guild_id) + '/' +
+                        std::to_string(charte_channel) + '/' +
+                        std::to_string(charte_message);
+       on_slashcommand(cached,
+                       setup_command(1, "charte_reaction_valider", "✅"));
+       on_slashcommand(cached, setup_command(2, "charte_message", url));
+       api.advance(5s);
+       on_slashcommand(cached, setup_command(3, "charte_message", url));
+       // the message is read again once its time to live is over on the
+       // simulated clock
+       api.advance(2min);
+       on_slashcommand(cached, setup_command(4, "charte_message", url));
+       // the callbacks use the cache, it must outlive them
+       api.run();
+       if (cached.hits() != 1 || cached.misses() != 2)
+         std::cout << "cache: " << cached.hits() << " hits, "
+                   << cached.misses() << " misses\n";
+     }},
+    {"charte_backfill",
+     "300 users validated the charte while the bot was away, 250 stayed",
+     [](FakeBotApi &api) {
+       setup_guild(api, true);
+       auto &g = api.guild(guild_id);
+       for (Snowflake i = 0; i < 300; ++i) {
+         g.reactors[{charte_message, "✅"}].insert(1000 + i * 7);
+         if (i % 6)
+           g.members.insert(1000 + i * 7);
+       }
+       // some got the role live already
+       for (Snowflake i = 0; i < 50; ++i)
+         api.guild_member_add_role(guild_id, 1000 + i * 7 * 6 + 7, charte_role,
+                                   {});
+       // members who did not react
+       for (Snowflake i = 0; i < 1500; ++i)
+         g.members.insert(1003 + i * 7);
+       api.run();
+       g_charte_backfill.start(api, guild_id);
+       api.advance(600s);
+       std::size_t missing{0};
+       for (auto u : g.reactors[{charte_message, "✅"}])
+         if (g.members.contains(u) && !api.has_role(guild_id, u, charte_role))
+           ++missing;
+       if (missing || g_charte_backfill.running())
+         std::cout << "backfill: " << missing << " members without role\n";
+     }},
+    {"reaction_roles",
+     "3 reaction roles added by command, 300 members pick theirs",
+     [](FakeBotApi &api) {
+       setup_guild(api, true);
+       constexpr Snowflake roles_message{guild_id + 5};
+       constexpr Snowflake games_role{guild_id + 10};
+       constexpr Snowflake books_role{guild_id + 11};
+       constexpr Snowflake books_emoji{guild_id + 20};
+       auto &g = api.guild(guild_id);
+       g.roles.push_back({games_role, "jeux"});
+       g.roles.push_back({books_role, "lecture"});
+       const auto url = "https://discord.com/channels/" +
+                        std::to_string(guild_id) + '/' +
+                        std::to_string(text_channel) + '/' +
+                        std::to_string(roles_message);
+       auto add = [&](Snowflake id, const std::string &emoji,
+                      const std::string &role) {
+         on_slashcommand(api, {id,
+                               "token",
+                               guild_id,
+                               text_channel,
+                               1,
+                               "admin",
+                               "reaction_role",
+                               {{"action", "add"},
+                                {"message", url},
+                                {"emoji", emoji},
+                                {"role", role}}});
+       };
+       add(1, "🎮", "jeux");
+       add(2, "<:livre:" + std::to_string(books_emoji) + '>', "lecture");
+       // two roles for the same reaction
+       add(3, "🎮", "membre");
+       api.advance(5s);
+       for (Snowflake i = 0; i < 300; ++i) {
+         if (i % 2)
+           on_message_reaction_add(api, {guild_id, text_channel,
+                                         roles_message, 1000 + i, "member",
+                                         books_emoji, "livre"});
+         else
+           on_message_reaction_add(api, {guild_id, text_channel,
+                                         roles_message, 1000 + i, "member", 0,
+                                         "🎮"});
+         api.advance(1ms);
+       }
+       api.advance(10s);
+       std::size_t wrong{0};
+       for (Snowflake i = 0; i < 300; ++i) {
+         const auto user = 1000 + i;
+         wrong += api.has_role(guild_id, user, books_role) != (i % 2 == 1) ||
+                  api.has_role(guild_id, user, games_role) != (i % 2 == 0) ||
+                  api.has_role(guild_id, user, charte_role) != (i % 2 == 0);
+       }
+       if (wrong || g_guild_configs.reaction_role_count() != 3)
+         std::cout << "reaction roles: " << wrong << " members wrong, "
+                   << g_guild_configs.reaction_role_count() << " rules\n";
+     }},
+    {"register_commands", "the commands are created on a new application",
+     [](FakeBotApi &api) { register_bot(api); }},
+};
+
+} // namespace
+
+int main(int argc, char *const argv[]) {
+  std::uint64_t seed{1};
+  // long enough for 1000 role grants at the rate limit of a guild
+  auto duration = std::chrono::nanoseconds{20min};
+
+  if (argc > 1)
+    ConfigurationSection::convert_to_num(argv[1], seed, seed);
+  if (argc > 2) {
+    std::uint64_t seconds{1200};
+    ConfigurationSection::convert_to_num(argv[2], seconds, seconds);
+    duration = std::chrono::seconds{seconds};
+  }
+
+  LogBase::setLevel(LogLevel::Critical);
+
+  bool failed{false};
+  for (auto &s : scenarios) {
+    FakeBotApi api{FakeBotApi::Completion::clock};
+    Simulation sim{seed};
+    api.set_scheduler(&sim);
+
+    s.run(api);
+    if (api.now() < duration)
+      api.advance(duration - api.now());
+
+    std::cout << "== " << s.name << ": " << s.description << " (seed "
+              << seed << ")\n";
+    sim.report(std::cout);
+    if (api.pending()) {
+      std::cout << "FAILED: " << api.pending() << " calls still pending after "
+                << std::chrono::duration_cast<std::chrono::seconds>(duration)
+                       .count()
+                << "s\n";
+      failed = true;
+    }
+    std::cout << '\n';
+  }
+
+#ifdef LOULOUTEBOT_PROFILING
+  profiling_report(std::cout);
+#endif
+  return failed ? 1 : 0;
+}
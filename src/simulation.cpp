@@ -0,0 +1,117 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <iomanip>
+
+using namespace std::chrono_literals;
+
+Simulation::Simulation(std::uint64_t seed) : rng{seed} {
+  // rate limits close to the ones Discord returns for a bot
+  set_model(ApiRoute::message_create, {80ms, 60ms, 10, 8, 5, 5s});
+  set_model(ApiRoute::guild_member_add_role, {90ms, 50ms, 10, 8, 10, 10s});
+  set_model(ApiRoute::guild_member_remove_role,
+            {90ms, 50ms, 10, 8, 10, 10s});
+  set_model(ApiRoute::channels_get, {60ms, 30ms, 10, 6, 50, 1s});
+  set_model(ApiRoute::roles_get, {60ms, 30ms, 10, 6, 50, 1s});
+  set_model(ApiRoute::message_get, {60ms, 30ms, 10, 6, 50, 1s});
+  set_model(ApiRoute::message_reactions_get, {80ms, 40ms, 10, 6, 5, 1s});
+  set_model(ApiRoute::guild_members_get, {150ms, 80ms, 10, 6, 10, 10s});
+  set_model(ApiRoute::interaction_reply, {40ms, 20ms, 5, 4, 0, 1s});
+  set_model(ApiRoute::interaction_thinking, {40ms, 20ms, 5, 4, 0, 1s});
+  set_model(ApiRoute::interaction_edit_response,
+            {50ms, 30ms, 5, 4, 5, 5s});
+}
+
+void Simulation::mix(std::uint64_t v) {
+  // FNV-1a over the 8 bytes
+  for (int i = 0; i < 8; ++i) {
+    trace ^= (v >> (i * 8)) & 0xff;
+    trace *= 0x100000001b3ULL;
+  }
+}
+
+std::pair<std::chrono::nanoseconds, std::uint64_t>
+Simulation::schedule(ApiRoute route, Snowflake bucket,
+                     std::chrono::nanoseconds now) {
+  const auto idx = static_cast<std::size_t>(route);
+  const auto &model = models[idx];
+  auto &stats = route_stats[idx];
+
+  auto start = now;
+  if (model.limit) {
+    // the calls wait in order for a window with some left, like the DPP
+    // request queue does. The window of the bucket may be one after the
+    // current time when calls are already waiting
+    auto &b = buckets[{route, bucket}];
+    if (start >= b.reset) {
+      b.remaining = model.limit;
+      b.reset = start + model.window;
+    } else if (!b.remaining) {
+      start = b.reset;
+      b.remaining = model.limit;
+      b.reset = start + model.window;
+    } else {
+      start = std::max(start, b.reset - model.window);
+    }
+    if (start > now)
+      ++stats.throttled;
+    --b.remaining;
+  }
+
+  auto latency = model.base;
+  if (model.jitter.count() > 0)
+    latency += std::chrono::nanoseconds{
+        static_cast<std::int64_t>(rng() % model.jitter.count())};
+  if (model.tail_per_mille && rng() % 1000 < model.tail_per_mille)
+    latency *= model.tail_factor;
+
+  auto done = start + latency;
+  auto order = rng();
+  stats.latencies.push_back(done - now);
+
+  mix(idx);
+  mix(bucket);
+  mix(static_cast<std::uint64_t>(now.count()));
+  mix(static_cast<std::uint64_t>(done.count()));
+
+  return {done, order};
+}
+
+void Simulation::report(std::ostream &os) const {
+  auto ms = [](std::chrono::nanoseconds d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+
+  os << std::left << std::setw(28) << "route" << std::right << std::setw(8)
+     << "calls" << std::setw(10) << "throttled" << std::setw(10) << "p50 ms"
+     << std::setw(10) << "p90 ms" << std::setw(10) << "p99 ms"
+     << std::setw(10) << "max ms" << '\n';
+  for (std::size_t i = 0; i < api_route_count; ++i) {
+    const auto &s = route_stats[i];
+    if (s.latencies.empty())
+      continue;
+    auto sorted = s.latencies;
+    std::ranges::sort(sorted);
+    auto pct = [&sorted](std::size_t p) {
+      return sorted[std::min(sorted.size() - 1, sorted.size() * p / 100)];
+    };
+    os << std::left << std::setw(28) << to_string(static_cast<ApiRoute>(i))
+       << std::right << std::setw(8) << sorted.size() << std::setw(10)
+       << s.throttled << std::fixed << std::setprecision(1) << std::setw(10)
+       << ms(pct(50)) << std::setw(10) << ms(pct(90)) << std::setw(10)
+       << ms(pct(99)) << std::setw(10) << ms(sorted.back()) << '\n';
+  }
+  for (std::size_t i = 0; i < api_route_count; ++i) {
+    const auto &s = route_stats[i];
+    if (s.latencies.empty())
+      continue;
+    const auto longest = std::ranges::max(s.latencies);
+    if (longest > slow_call)
+      os << "warning: " << to_string(static_cast<ApiRoute>(i))
+         << " calls waited up to " << std::fixed << std::setprecision(1)
+         << std::chrono::duration<double>(longest).count()
+         << " s on the rate limit\n";
+  }
+  os << "trace " << std::hex << std::setw(16) << std::setfill('0') << trace
+     << std::dec << std::setfill(' ') << '\n';
+}
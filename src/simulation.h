@@ -0,0 +1,84 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "fake_bot_api.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <random>
+#include <vector>
+
+/**
+ * @brief Behaviour of a REST route in the simulation
+ * The latency is base + uniform jitter, and one call out of
+ * 1000 / tail_per_mille takes tail_factor times longer
+ */
+struct RouteModel {
+  std::chrono::nanoseconds base{std::chrono::milliseconds{80}};
+  std::chrono::nanoseconds jitter{std::chrono::milliseconds{40}};
+  std::uint32_t tail_per_mille{10};
+  std::uint32_t tail_factor{8};
+  std::uint32_t limit{0}; /** calls per window and bucket, 0 for no limit */
+  std::chrono::nanoseconds window{std::chrono::seconds{1}};
+};
+
+/**
+ * @brief Seeded scheduler for FakeBotApi in clock mode
+ * Every random draw is taken from the raw output of a mt19937_64, so a seed
+ * gives the same completion times and order on every platform
+ */
+class Simulation : public FakeBotApi::Scheduler {
+public:
+  struct RouteStats {
+    std::vector<std::chrono::nanoseconds> latencies;
+    std::uint64_t throttled{0};
+  };
+
+  explicit Simulation(std::uint64_t seed);
+
+  void set_model(ApiRoute route, const RouteModel &model) {
+    models[static_cast<std::size_t>(route)] = model;
+  }
+
+  std::pair<std::chrono::nanoseconds, std::uint64_t>
+  schedule(ApiRoute route, Snowflake bucket,
+           std::chrono::nanoseconds now) override;
+
+  [[nodiscard]] const RouteStats &stats(ApiRoute route) const {
+    return route_stats[static_cast<std::size_t>(route)];
+  }
+
+  /**
+   * @brief Hash of every scheduled call, equal between two runs only if
+   * they scheduled the same calls at the same times
+   */
+  [[nodiscard]] std::uint64_t trace_hash() const { return trace; }
+
+  /** A member waiting longer for the answer of a call is warned about */
+  static constexpr std::chrono::nanoseconds slow_call{std::chrono::minutes{1}};
+
+  /**
+   * @brief Write the call count and latency distribution of each route,
+   * and warn about the routes with calls slower than slow_call
+   */
+  void report(std::ostream &os) const;
+
+private:
+  struct Bucket {
+    std::uint32_t remaining{0};
+    std::chrono::nanoseconds reset{0};
+  };
+
+  void mix(std::uint64_t v);
+
+  std::mt19937_64 rng;
+  std::array<RouteModel, api_route_count> models{};
+  std::array<RouteStats, api_route_count> route_stats{};
+  std::map<std::pair<ApiRoute, Snowflake>, Bucket> buckets;
+  std::uint64_t trace{0xcbf29ce484222325ULL};
+};
+
+#endif // SIMULATION_H